@@ -4,6 +4,14 @@ layout (location = 0) in vec3 aPosition;
 uniform mat4 uModel;
 uniform mat4 uLightMatrix;
 
+// terrain drawn as instances of a grid patch displaced by the height field (see world.vert)
+uniform int uDisplacement;
+uniform sampler2D uHeightField;
+uniform vec4 uTerrainRect;
+uniform ivec2 uTerrainSize;
+uniform int uTerrainPatches;
+uniform int uTerrainPatchCells;
+
 // unused
 uniform int uMode;
 uniform vec3 uColor;
@@ -12,8 +20,21 @@ uniform sampler2D uNormalmapImage;
 uniform float uShininess;
 uniform float uDiffuse;
 uniform float uSpecular;
+uniform float uTerrainTiles;
+
+float terrainHeight(ivec2 v) {
+    v = clamp(v, ivec2(0), uTerrainSize - 1);
+    return round(texelFetch(uHeightField, ivec2(v.y, uTerrainSize.x - 1 - v.x), 0).r * 255.0) / 50.0;
+}
 
 void main(void) 
 { 
-    gl_Position = uLightMatrix*uModel*vec4(aPosition, 1.0); 
+    vec3 position = aPosition;
+    if (uDisplacement == 1) {
+        ivec2 tile = ivec2(gl_InstanceID % uTerrainPatches, gl_InstanceID / uTerrainPatches);
+        ivec2 v = min(tile * uTerrainPatchCells + ivec2(aPosition.xz), uTerrainSize - 1);
+        position = vec3(uTerrainRect.x + float(v.x) / float(uTerrainSize.x) * uTerrainRect.z, terrainHeight(v),
+                        uTerrainRect.y + float(v.y) / float(uTerrainSize.y) * uTerrainRect.w);
+    }
+    gl_Position = uLightMatrix*uModel*vec4(position, 1.0); 
 }
@@ -32,6 +32,10 @@ out vec4 color;
 #define BIAS_MIN_E   0.0001
 #define BIAS_MAX_E   0.01
 
+// angle over which the sun goes down behind the horizon of the terrain, about a step of the horizon map (radians)
+#define HORIZON_BLEND   0.02
+#define PI              3.14159265
+
 
 /*   ------   INPUTS   ------   */
 
@@ -77,6 +81,11 @@ uniform int uLampShadowmapSize;
 uniform sampler2D uHeadlightShadowmap[2*NUM_CARS];
 uniform int uHeadlightShadowmapSize;
 
+// horizon of the terrain towards -Z and +Z (see horizon_map.h), used if uUseHorizon is 1
+uniform int uUseHorizon;
+uniform sampler2D uHorizon;
+uniform vec4 uHorizonTransform;
+
 // rendering mode
 uniform int uMode;
 
@@ -163,6 +172,19 @@ float isLitBySunPCF(vec3 N) {
    return lit;
 }
 
+// the sun turns in the YZ plane: it is hidden if it is lower than the horizon of the terrain on its side
+float isLitBySunHorizon() {
+   if (uDrawShadows == 0.0 || uUseHorizon == 0)
+      return 1.0;
+
+   vec2 uv = vPosWS.zx * uHorizonTransform.xy + uHorizonTransform.zw;
+   if (any(lessThan(uv, vec2(0.0))) || any(greaterThan(uv, vec2(1.0))))
+      return 1.0;
+   vec2 horizon = (texture(uHorizon, uv).rg - 0.5) * PI;
+   float elevation = atan(uSunDirection.y, abs(uSunDirection.z));
+   return smoothstep(-HORIZON_BLEND, HORIZON_BLEND, elevation - ((uSunDirection.z < 0.0) ? horizon.r : horizon.g));
+}
+
 float isLitByLampPCF(int i, vec3 N) {
    if (uDrawShadows == 0.0)
    return 1.0;
@@ -246,7 +268,7 @@ void main(void) {
    float sunint = sunlightIntensity();
    if (sunint > 0.0) {
       sunContrib = vec4(SUNLIGHT_COLOR,1.0) * sunint *
-	               isLitBySunPCF(surfaceNormal) *
+	               isLitBySunPCF(surfaceNormal) * isLitBySunHorizon() *
 	               (sunIntensityDiff + sunIntensitySpec);
    }
    
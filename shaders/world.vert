@@ -57,13 +57,50 @@ uniform mat4 uView;
 uniform mat4 uModel;
 uniform mat4 uProj;
 
+// terrain drawn as instances of a grid patch displaced by the height field (see terrain_displaced.h)
+uniform int uDisplacement;
+uniform sampler2D uHeightField;
+uniform vec4 uTerrainRect;
+uniform ivec2 uTerrainSize;
+uniform int uTerrainPatches;
+uniform int uTerrainPatchCells;
+uniform float uTerrainTiles;
+
+
+// height of vertex v of the terrain mesh, see terrain::hf
+float terrainHeight(ivec2 v) {
+   v = clamp(v, ivec2(0), uTerrainSize - 1);
+   return round(texelFetch(uHeightField, ivec2(v.y, uTerrainSize.x - 1 - v.x), 0).r * 255.0) / 50.0;
+}
+
+// vertex of the terrain mesh at vertex aPosition.xz of patch gl_InstanceID
+ivec2 terrainVertex() {
+   ivec2 tile = ivec2(gl_InstanceID % uTerrainPatches, gl_InstanceID / uTerrainPatches);
+   return min(tile * uTerrainPatchCells + ivec2(aPosition.xz), uTerrainSize - 1);
+}
+
 
 void main(void) {
-   vec4 pws = uModel * vec4(aPosition, 1.0);
+   vec3 position = aPosition;
+   vec3 normal = aNormal;
+   vec2 texCoord = aTexCoord;
+   
+   // the position, normal and texture coordinates of the full resolution terrain mesh (see terrain_mesh.h)
+   if (uDisplacement == 1) {
+      ivec2 v = terrainVertex();
+      position = vec3(uTerrainRect.x + float(v.x) / float(uTerrainSize.x) * uTerrainRect.z, terrainHeight(v),
+                      uTerrainRect.y + float(v.y) / float(uTerrainSize.y) * uTerrainRect.w);
+      normal = vec3((terrainHeight(v - ivec2(1, 0)) - terrainHeight(v + ivec2(1, 0))) / 2.0, 1.0,
+                    (terrainHeight(v - ivec2(0, 1)) - terrainHeight(v + ivec2(0, 1))) / 2.0);
+      texCoord = uTerrainTiles * vec2(v) / vec2(uTerrainSize);
+      vTexCoord = texCoord;
+   }
+   
+   vec4 pws = uModel * vec4(position, 1.0);
    
    // textured flat shading
    if (uMode == 0)
-      vTexCoord = aTexCoord;
+      vTexCoord = texCoord;
    
    // sun position in light-space
    vSunVS = (uView * vec4(uSunDirection, 1.0)).xyz;
@@ -92,7 +129,7 @@ void main(void) {
    }
 
    // vertex computations
-   vec4 vws = uModel * vec4(aNormal, 0.0);
+   vec4 vws = uModel * vec4(normal, 0.0);
    vNormalWS = normalize(vws).xyz;
    vNormalVS = normalize(uView * vws).xyz;
    vPosWS = pws.xyz;
@@ -82,6 +82,10 @@ public:
         return cameraPosition;
     }
 
+    void setPosition(glm::vec3 pos) {
+        cameraPosition = pos;
+    }
+
     void step(cardinalDirection_t direction, float delta) {
         float stepSize = cameraSpeed * delta;
 
@@ -8,6 +8,7 @@
 #include "common/renderable.h"
 #include "common/carousel/carousel.h"
 #include "common/carousel/carousel_to_renderable.h"
+#include "common/carousel/scene_watch.h"
 
 #define N_GROUND_TILES 20.0   // the terrain is covered with 20^2 tiles
 
@@ -36,11 +37,11 @@ inline std::vector<GLuint> generateTrackTriangles(int N) {
     return v;
 }
 
-inline std::vector<GLfloat> generateTrackTextureCoords(track t) {
+inline std::vector<GLfloat> generateTrackTextureCoords(const track& t) {
     std::vector<GLfloat> v;
 
-    std::vector<glm::vec3> left = t.curbs[1];
-    std::vector<glm::vec3> right = t.curbs[0];
+    const shared_array<glm::vec3>& left = t.curbs[1];
+    const shared_array<glm::vec3>& right = t.curbs[0];
 
     unsigned int N = left.size();
     v.resize(4 * N);         // one vertex for each side, each 2D vertex takes up 2 slots
@@ -65,66 +66,12 @@ inline std::vector<GLfloat> generateTrackTextureCoords(track t) {
     return v;
 }
 
-inline std::vector<GLfloat> generateTerrainTextureCoords(terrain t) {
-    std::vector<GLfloat> v;
-    const unsigned int Z = (t.size_pix[1]);
-    const unsigned int X = (t.size_pix[0]);
-    v.resize(2 * Z * X);
-
-    unsigned int slot = 0;
-    for (unsigned int iz = 0; iz < Z; ++iz) {
-        for (unsigned int ix = 0; ix < X; ++ix) {
-            v[slot] = N_GROUND_TILES * ix / float(X);
-            v[slot + 1] = N_GROUND_TILES * iz / float(Z);
-            slot += 2;
-        }
-    }
-
-    return v;
-}
-
-inline float getTerrainHeight(terrain t, const unsigned int i, const unsigned int j) {
-    const unsigned int& Z = static_cast<unsigned int>(t.size_pix[1]);
-    const unsigned int& X = static_cast<unsigned int>(t.size_pix[0]);
-
-    float x = t.rect_xz[0] + (i / float(X)) * t.rect_xz[2];
-    float z = t.rect_xz[1] + (j / float(Z)) * t.rect_xz[3];
-
-    return t.hf((i >= X) ? (X - 1) : (i), (j >= Z) ? (Z - 1) : (j));
-}
-
-inline glm::vec3 computeVertexNormal(terrain t, unsigned int ix, unsigned int iz) {
-   float hL = getTerrainHeight(t, ix - 1, iz);
-   float hR = getTerrainHeight(t, ix + 1, iz);
-   float hD = getTerrainHeight(t, ix, iz - 1);
-   float hU = getTerrainHeight(t, ix, iz + 1);
-
-   glm::vec3 n;
-   n.x = (hL - hR) / 2.f;
-   n.z = (hD - hU) / 2.f;
-   n.y = 1.0f;
-   return n;
-}
-
-inline void generateTerrainVertexNormals(terrain t, renderable& r) {
-    const unsigned int& Z = static_cast<unsigned int>(t.size_pix[1]);
-    const unsigned int& X = static_cast<unsigned int>(t.size_pix[0]);
-
-    std::vector<float> normals;
-    for (unsigned int iz = 0; iz < Z; ++iz) {
-        for (unsigned int ix = 0; ix < X; ++ix) {
-           pushVec3ToBuffer(normals, computeVertexNormal(t, ix, iz));
-        }
-    }
-
-    r.add_vertex_attribute<float>(&normals[0], X * Z * 3, 2, 3);
-}
-
-inline void generateTrackVertexNormals(track t, renderable& r) {
+// normals of the track vertices of curb points [first, last)
+inline std::vector<float> trackVertexNormals(const track& t, unsigned int first, unsigned int last) {
     unsigned int size = t.curbs[0].size();
 
     std::vector<float> normals;
-    for (unsigned int i = 0; i < size; ++i) {
+    for (unsigned int i = first; i < last; ++i) {
         glm::vec3 V0 = t.curbs[0][(i + 1) % size] - t.curbs[0][i];
         glm::vec3 V1 = t.curbs[1][(i + 1) % size] - t.curbs[0][i];
         glm::vec3 U = t.curbs[1][i] - t.curbs[0][i];
@@ -133,10 +80,17 @@ inline void generateTrackVertexNormals(track t, renderable& r) {
         pushVec3ToBuffer(normals, glm::normalize(glm::cross(V1, U)));
     }
 
+    return normals;
+}
+
+inline void generateTrackVertexNormals(const track& t, renderable& r) {
+    unsigned int size = t.curbs[0].size();
+    std::vector<float> normals = trackVertexNormals(t, 0, size);
+
     r.add_vertex_attribute<float>(&normals[0], 2 * 3 * size, 2, 3);
 }
 
-void inline prepareTrack(race r, renderable& r_track) {
+void inline prepareTrack(const race& r, renderable& r_track) {
    std::cout << "Generating track... ";
 
    r_track.create();
@@ -152,15 +106,73 @@ void inline prepareTrack(race r, renderable& r_track) {
    std::cout << "done" << std::endl;
 }
 
-void inline prepareTerrain(race r, renderable& r_terrain) {
+void inline prepareTerrain(const race& r, renderable& r_terrain) {
    std::cout << "Generating terrain... ";
 
    r_terrain.create();
-   game_to_renderable::to_heightfield(r, r_terrain);
+   game_to_renderable::to_heightfield(r, r_terrain, N_GROUND_TILES);
+   std::cout << "done" << std::endl;
+}
 
-   std::vector<GLfloat> terrainTextureCoords = generateTerrainTextureCoords(r.ter());
-   r_terrain.add_vertex_attribute<GLfloat>(&terrainTextureCoords[0], terrainTextureCoords.size(), 4, 2);
+// the buffers of prepareTrack: positions, texture coordinates and normals
+enum { TRACK_POSITIONS, TRACK_TEXCOORDS, TRACK_NORMALS };
+
+// upload again the vertices of curb points [curbs[0], curbs[1]) of the track, and what depends on them.
+// If the number of points changed the track is built again (see scene_watch::changes)
+void inline updateTrack(const race& r, renderable& r_track, glm::ivec2 curbs, bool resized) {
+   if (resized) {
+      r_track.destroy();
+      prepareTrack(r, r_track);
+      return;
+   }
+   const track& t = r.t();
+   const int N = (int)t.curbs[0].size();
+   const int first = curbs[0], last = curbs[1];
+   if (first >= last)
+      return;
+
+   std::vector<float> positions;
+   for (int i = first; i < last; ++i) {
+      pushVec3ToBuffer(positions, t.curbs[0][i]);
+      pushVec3ToBuffer(positions, t.curbs[1][i]);
+   }
+   r_track.update_vertex_attribute<float>(TRACK_POSITIONS, &positions[0], 6 * first, (unsigned int)positions.size());
+
+   // the normals of a point depend on the next one, the one of the last point on the first
+   const int n0 = std::max(first - 1, 0);
+   std::vector<float> normals = trackVertexNormals(t, n0, last);
+   r_track.update_vertex_attribute<float>(TRACK_NORMALS, &normals[0], 6 * n0, (unsigned int)normals.size());
+   if (first == 0 && last < N) {
+      normals = trackVertexNormals(t, N - 1, N);
+      r_track.update_vertex_attribute<float>(TRACK_NORMALS, &normals[0], 6 * (N - 1), 6);
+   }
+
+   // the texture coordinates follow the length of the curb, so they change up to the end. Their unit is the
+   // length of the first 100 segments
+   std::vector<GLfloat> textureCoords = generateTrackTextureCoords(t);
+   const int t0 = (first <= 100) ? 0 : first;
+   r_track.update_vertex_attribute<GLfloat>(TRACK_TEXCOORDS, &textureCoords[4 * t0], 4 * t0, 4 * (N - t0));
+}
 
-   generateTerrainVertexNormals(r.ter(), r_terrain);
-   std::cout << "done" << std::endl;
-}
\ No newline at end of file
+// upload again the vertices of the terrain that depend on the texels a reload changed.
+// If the size of the height field changed the terrain is built again
+void inline updateTerrain(const race& r, renderable& r_terrain, const scene_watch::changes& changes) {
+   const terrain& t = r.ter();
+   const int X = t.size_pix[0], Z = t.size_pix[1];
+   if (r_terrain.vn != (unsigned int)(X * Z)) {
+      r_terrain.destroy();
+      prepareTerrain(r, r_terrain);
+      return;
+   }
+
+   // the normals read the neighbours too
+   const glm::ivec4 v = changes.vertices(X, Z, 1);
+   const int ix0 = v[0], iz0 = v[1], ix1 = v[2], iz1 = v[3];
+   if (ix0 > ix1)
+      return;
+   std::vector<float> vertices((ix1 - ix0 + 1) * terrain_mesh::FLOATS);
+   for (int iz = iz0; iz <= iz1; ++iz) {
+      terrain_mesh::row(t, iz, ix0, ix1, N_GROUND_TILES, &vertices[0]);
+      r_terrain.update_vertex_attribute<float>(0, &vertices[0], (iz * X + ix0) * terrain_mesh::FLOATS, (unsigned int)vertices.size());
+   }
+}
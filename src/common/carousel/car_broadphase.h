@@ -0,0 +1,126 @@
+#pragma once
+
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <glm/glm.hpp>
+#include "carousel.h"
+
+/**
+	Broad phase proximity queries between the cars of a race, by sweep and prune along the dominant axis of the scene.
+	Call update() after race::update(); the cars are kept sorted along the sweep axis and re-sorted incrementally,
+	which is close to linear since cars move little between two updates.
+	Distances are measured between the world space axis aligned boxes of the cars: two cars are within d if their boxes,
+	grown by d, overlap. Overlapping pairs are candidates for a finer test.
+*/
+struct car_broadphase {
+	car_broadphase() :axis(-1), max_ext(0.f) {}
+
+	/// refresh the boxes of the cars from their current frames
+	void update(const race& r) {
+		const car_pool& pool = r.pool();
+		const size_t n = pool.size();
+
+		if (axis == -1) {
+			glm::vec3 ext = r.bbox().max - r.bbox().min;
+			axis = (ext.x >= ext.z) ? 0 : 2;
+		}
+		const int a1 = (axis + 1) % 3, a2 = (axis + 2) % 3;
+
+		bmin.resize(n);
+		bmax.resize(n);
+		for (size_t i = 0; i < n; ++i)
+			world_box(pool.frames[i], pool.boxes[i], bmin[i], bmax[i]);
+
+		// keep the order of the previous update and fix it with an insertion sort
+		if (order.size() != n) {
+			order.resize(n);
+			for (size_t i = 0; i < n; ++i)
+				order[i] = (int)i;
+			std::sort(order.begin(), order.end(), [&](int i0, int i1) { return bmin[i0][axis] < bmin[i1][axis]; });
+		}
+		else
+			for (size_t i = 1; i < n; ++i) {
+				int c = order[i];
+				float key = bmin[c][axis];
+				size_t j = i;
+				for (; j > 0 && bmin[order[j - 1]][axis] > key; --j)
+					order[j] = order[j - 1];
+				order[j] = c;
+			}
+
+		// sorted copies of the intervals, so that the sweep reads memory in order
+		s_min0.resize(n); s_max0.resize(n);
+		s_min1.resize(n); s_max1.resize(n);
+		s_min2.resize(n); s_max2.resize(n);
+		max_ext = 0.f;
+		for (size_t k = 0; k < n; ++k) {
+			const int c = order[k];
+			s_min0[k] = bmin[c][axis]; s_max0[k] = bmax[c][axis];
+			max_ext = std::max(max_ext, s_max0[k] - s_min0[k]);
+			s_min1[k] = bmin[c][a1];   s_max1[k] = bmax[c][a1];
+			s_min2[k] = bmin[c][a2];   s_max2[k] = bmax[c][a2];
+		}
+	}
+
+	/**
+	 * all the pairs of cars within distance d, each as (i,j) with i < j
+	 * @param d distance between the boxes, 0 for the overlapping ones
+	 */
+	void overlaps(float d, std::vector<std::pair<int, int> >& pairs) const {
+		pairs.clear();
+		const size_t n = order.size();
+		for (size_t k = 0; k < n; ++k) {
+			const float end = s_max0[k] + d;
+			for (size_t h = k + 1; h < n && s_min0[h] <= end; ++h)
+				if (s_min1[h] <= s_max1[k] + d && s_min1[k] <= s_max1[h] + d &&
+					s_min2[h] <= s_max2[k] + d && s_min2[k] <= s_max2[h] + d)
+					pairs.push_back(std::make_pair(std::min(order[k], order[h]), std::max(order[k], order[h])));
+		}
+	}
+
+	/// the cars within distance d from car ic (ic excluded)
+	void near(int ic, float d, std::vector<int>& cars) const {
+		cars.clear();
+		const glm::vec3 mi = bmin[ic] - glm::vec3(d), ma = bmax[ic] + glm::vec3(d);
+		const int a1 = (axis + 1) % 3, a2 = (axis + 2) % 3;
+
+		// boxes are sorted by min, so the first one that can reach mi starts at most max_ext before it
+		size_t k = std::lower_bound(s_min0.begin(), s_min0.end(), mi[axis] - max_ext) - s_min0.begin();
+		for (; k < order.size() && s_min0[k] <= ma[axis]; ++k)
+			if (order[k] != ic && s_max0[k] >= mi[axis] &&
+				s_min1[k] <= ma[a1] && s_max1[k] >= mi[a1] &&
+				s_min2[k] <= ma[a2] && s_max2[k] >= mi[a2])
+				cars.push_back(order[k]);
+	}
+
+	/// world space box of car i as of the last update
+	box3 box(int i) const { return box3(bmin[i], bmax[i]); }
+
+private:
+	/// sweep axis: 0 for x, 2 for z
+	int axis;
+
+	/// world space boxes, by car index
+	std::vector<glm::vec3> bmin, bmax;
+
+	/// car indices sorted by bmin[axis]
+	std::vector<int> order;
+
+	/// intervals along the sweep axis (0) and the other two, in sweep order
+	std::vector<float> s_min0, s_max0, s_min1, s_max1, s_min2, s_max2;
+
+	/// largest extent of a box along the sweep axis
+	float max_ext;
+
+	/// box of the box b transformed by F
+	static void world_box(const glm::mat4& F, const box3& b, glm::vec3& mi, glm::vec3& ma) {
+		glm::vec3 c = glm::vec3(F * glm::vec4(b.center(), 1.f));
+		glm::vec3 h = (b.max - b.min) * 0.5f;
+		glm::vec3 e;
+		for (int r = 0; r < 3; ++r)
+			e[r] = fabs(F[0][r]) * h.x + fabs(F[1][r]) * h.y + fabs(F[2][r]) * h.z;
+		mi = c - e;
+		ma = c + e;
+	}
+};
@@ -0,0 +1,263 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <glm/glm.hpp>
+#include "..\box3.h"
+#include "packed_path.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define CAR_POOL_AVX2
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define CAR_POOL_SSE2
+#endif
+
+/// how much of the per frame work of car_pool::update was done, as of the last update
+struct lod_counters {
+	lod_counters() :cars(0), near(0), far_updated(0), far_skipped(0), forced(0) {}
+
+	/// number of cars
+	size_t cars;
+
+	/// frames computed because the car is close to the view and inside its frustum
+	size_t near;
+
+	/// frames of cars far from the view computed because it was their turn
+	size_t far_updated;
+
+	/// frames of cars far from the view left as they were
+	size_t far_skipped;
+
+	/// frames computed because the car is pinned or targeted by a cameraman
+	size_t forced;
+};
+
+/**
+	Update rate level of detail of the cars. A car is relevant if it is within distance from the eye and inside the
+	view frustum; the others get their frame recomputed once every period updates, staggered so that the work is spread
+	over the updates. period 1 means every car is updated every time.
+*/
+struct car_lod {
+	car_lod() :period(1), distance(0.f), eye(0.f), has_view(false), count(0) {}
+
+	int period;
+	float distance;
+	glm::vec3 eye;
+
+	/// frustum planes (normal, offset) with the normals pointing inside
+	glm::vec4 planes[6];
+	bool has_view;
+
+	/// updates done so far, used to stagger the far cars
+	unsigned int count;
+
+	/**
+	 * set the view
+	 * @param view from the race reference frame to eye space
+	 * @param proj projection matrix
+	 */
+	void set_view(const glm::mat4& view, const glm::mat4& proj) {
+		eye = glm::vec3(glm::inverse(view)[3]);
+		glm::mat4 M = proj * view;
+		glm::vec4 row[4];
+		for (int i = 0; i < 4; ++i)
+			row[i] = glm::vec4(M[0][i], M[1][i], M[2][i], M[3][i]);
+		for (int i = 0; i < 3; ++i) {
+			planes[i * 2]     = row[3] + row[i];
+			planes[i * 2 + 1] = row[3] - row[i];
+		}
+		for (int i = 0; i < 6; ++i)
+			planes[i] /= glm::length(glm::vec3(planes[i]));
+		has_view = true;
+	}
+
+	/// is a sphere of center p and given radius relevant
+	bool relevant(const glm::vec3& p, float radius) const {
+		if (!has_view)
+			return true;
+		glm::vec3 d = p - eye;
+		if (glm::dot(d, d) > (distance + radius) * (distance + radius))
+			return false;
+		for (int i = 0; i < 6; ++i)
+			if (glm::dot(glm::vec3(planes[i]), p) + planes[i].w < -radius)
+				return false;
+		return true;
+	}
+};
+
+/**
+	Structure of arrays storage for the cars of a race. Car i moves along path id_path[i] starting
+	from sample delta_i[i]; update() writes its current sample index in cur_i[i] and its (interpolated) frame in frames[i].
+	Keeping the fields in separate arrays lets update() process several cars per instruction.
+	With a level of detail set (see car_lod) the frames of the cars that are not relevant may be some updates old.
+*/
+struct car_pool {
+	car_pool() :last_paths(0), last_u(0.f) {}
+
+	/// on which path each car is moving
+	std::vector<int> id_path;
+
+	/// starting sample of each car along its path
+	std::vector<int> delta_i;
+
+	/// current sample of each car along its path, as of the last update
+	std::vector<int> cur_i;
+
+	/// current frame of each car, as of the last update
+	std::vector<glm::mat4> frames;
+
+	/// bounding box of each car, in frame coordinates
+	std::vector<box3> boxes;
+
+	/// used[p] is true if some car runs on path p
+	std::vector<bool> used;
+
+	/// pinned cars always get their frame computed, whatever the level of detail
+	std::vector<unsigned char> pinned;
+
+	/// fresh[i] is 1 if frames[i] has been computed by the last update
+	std::vector<unsigned char> fresh;
+
+	/// update rate level of detail, see car_lod
+	car_lod lod;
+
+	/// work done by the last update
+	lod_counters counters;
+
+	size_t size() const { return id_path.size(); }
+
+	void clear() {
+		id_path.clear();
+		delta_i.clear();
+		cur_i.clear();
+		frames.clear();
+		boxes.clear();
+		used.clear();
+		pinned.clear();
+		fresh.clear();
+	}
+
+	void add(int path, int delta, const box3& box) {
+		id_path.push_back(path);
+		delta_i.push_back(delta);
+		cur_i.push_back(delta);
+		frames.push_back(glm::mat4(1.f));
+		boxes.push_back(box);
+		pinned.push_back(0);
+		fresh.push_back(0);
+		if ((int)used.size() <= path)
+			used.resize(path + 1, false);
+		used[path] = true;
+	}
+
+	/**
+	 * move every car to sample (tick + delta_i) of its path, plus u of the way to the next sample.
+	 * @param paths the paths of the race. Only the ones with cars on them are read
+	 * @param n_paths number of paths
+	 * @param tick number of samples elapsed since the start
+	 * @param u fraction of sample elapsed after tick, in [0,1)
+	 */
+	void update(const path* paths, size_t n_paths, long long tick, float u) {
+		// the phase of each path is computed once, so that the per car work is an add and a conditional subtract
+		base.resize(n_paths);
+		sizes.resize(n_paths);
+		for (size_t p = 0; p < n_paths; ++p) {
+			sizes[p] = (p < used.size() && used[p]) ? (int)paths[p].size() : 0;
+			base[p] = (sizes[p] > 0) ? int(tick % sizes[p]) : 0;
+		}
+
+		// the indices are cheap and always exact: what the level of detail saves is decoding and interpolating the frames
+		compute_indices();
+		last_paths = paths;
+		last_u = u;
+
+		const size_t n = size();
+		counters = lod_counters();
+		counters.cars = n;
+		if (lod.period <= 1) {
+			for (size_t i = 0; i < n; ++i)
+				frames[i] = paths[id_path[i]].frame(cur_i[i], u);
+			std::fill(fresh.begin(), fresh.end(), 1);
+			counters.near = n;
+			return;
+		}
+
+		for (size_t i = 0; i < n; ++i) {
+			const path& p = paths[id_path[i]];
+			bool update = true;
+			if (pinned[i])
+				++counters.forced;
+			else
+				if (lod.relevant(p.position(cur_i[i]), boxes[i].diagonal() * 0.5f))
+					++counters.near;
+				else
+					if ((lod.count + i) % lod.period == 0)
+						++counters.far_updated;
+					else {
+						++counters.far_skipped;
+						update = false;
+					}
+			if (update)
+				frames[i] = p.frame(cur_i[i], u);
+			fresh[i] = update;
+		}
+		++lod.count;
+	}
+
+	/// make sure frames[i] is exact for the last update, for cars skipped by the level of detail
+	void refresh(size_t i) {
+		if (fresh[i])
+			return;
+		frames[i] = last_paths[id_path[i]].frame(cur_i[i], last_u);
+		fresh[i] = 1;
+		--counters.far_skipped;
+		++counters.forced;
+	}
+
+private:
+	/// per path phase and number of samples, scratch buffers of update()
+	std::vector<int> base, sizes;
+
+	/// arguments of the last update, for refresh()
+	const path* last_paths;
+	float last_u;
+
+	/// cur_i = delta_i + base[id_path], wrapped around the path size (delta_i is always smaller than the size)
+	void compute_indices() {
+		const size_t n = size();
+		if (n == 0)
+			return;
+		const int* path_sizes = &sizes[0];
+		size_t i = 0;
+#if defined(CAR_POOL_AVX2)
+		for (; i + 8 <= n; i += 8) {
+			__m256i ids = _mm256_loadu_si256((const __m256i*) & id_path[i]);
+			__m256i d   = _mm256_loadu_si256((const __m256i*) & delta_i[i]);
+			__m256i b   = _mm256_i32gather_epi32(&base[0], ids, 4);
+			__m256i sz  = _mm256_i32gather_epi32(path_sizes, ids, 4);
+			__m256i ii  = _mm256_add_epi32(d, b);
+			__m256i wrap = _mm256_cmpgt_epi32(sz, ii);
+			ii = _mm256_sub_epi32(ii, _mm256_andnot_si256(wrap, sz));
+			_mm256_storeu_si256((__m256i*) & cur_i[i], ii);
+		}
+#elif defined(CAR_POOL_SSE2)
+		for (; i + 4 <= n; i += 4) {
+			const int* ids = &id_path[i];
+			__m128i d  = _mm_loadu_si128((const __m128i*) & delta_i[i]);
+			__m128i b  = _mm_setr_epi32(base[ids[0]], base[ids[1]], base[ids[2]], base[ids[3]]);
+			__m128i sz = _mm_setr_epi32(path_sizes[ids[0]], path_sizes[ids[1]], path_sizes[ids[2]], path_sizes[ids[3]]);
+			__m128i ii = _mm_add_epi32(d, b);
+			__m128i wrap = _mm_cmpgt_epi32(sz, ii);
+			ii = _mm_sub_epi32(ii, _mm_andnot_si128(wrap, sz));
+			_mm_storeu_si128((__m128i*) & cur_i[i], ii);
+		}
+#endif
+		for (; i < n; ++i) {
+			int ii = delta_i[i] + base[id_path[i]];
+			int sz = path_sizes[id_path[i]];
+			cur_i[i] = (ii < sz) ? ii : ii - sz;
+		}
+	}
+};
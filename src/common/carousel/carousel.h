@@ -1,13 +1,28 @@
 #pragma once
 
 #include <vector>
+#include <memory>
+#include <algorithm>
+#include <limits>
+#include <future>
 #include <time.h> 
 #include <glm/glm.hpp>  
 #include <glm/ext.hpp>  
 #include <glm/gtx/string_cast.hpp>
 #include "..\box3.h"
+#include "sim_clock.h"
+#include "packed_path.h"
+#include "car_pool.h"
+#include "terrain_tiles.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define TERRAIN_SSE2
+#endif
 
 struct carousel_loader;
+struct scene_cache;
+struct scene_watch;
 class race;
 
 struct point_object {
@@ -27,19 +42,108 @@ struct stick_object :public point_object{
 //@{
 
 
+/**
+	the samples of a path that are within the radius of a cameraman, computed once by the loader.
+	in_range(i) answers in constant time whether a car on sample i of the path can be filmed; the intervals tell
+	in logarithmic time how long a car stays in range or out of it, so that the locks can skip those ticks.
+*/
+struct visibility_table {
+
+	/// [first,last) sample ranges within the radius, in increasing order
+	shared_array<glm::ivec2> intervals;
+
+	/// one bit per sample of the path, set if the sample is inside one of the intervals
+	shared_array<unsigned long long> bits;
+
+	bool in_range(int i) const {
+		return (size_t(i >> 6) < bits.size()) && ((bits[i >> 6] >> (i & 63)) & 1ull);
+	}
+
+	/// samples from i to the first one within the radius, going around the path of n samples; -1 if there is none
+	int next_in_range(int i, int n) const {
+		if (intervals.empty())
+			return -1;
+		const glm::ivec2* it = containing(i);
+		if (it == intervals.end())
+			return intervals.front()[0] + n - i;
+		return std::max((*it)[0] - i, 0);
+	}
+
+	/// samples within the radius from i on, i included and going around the path of n samples: 0 if i is not
+	/// within it, INT_MAX if the whole path is
+	int in_range_after(int i, int n) const {
+		const glm::ivec2* it = containing(i);
+		if (it == intervals.end() || (*it)[0] > i)
+			return 0;
+		if ((*it)[0] == 0 && (*it)[1] == n)
+			return std::numeric_limits<int>::max();
+		int k = (*it)[1] - i;
+		if ((*it)[1] == n && intervals.front()[0] == 0)
+			k += intervals.front()[1];
+		return k;
+	}
+
+	/// as in_range_after, going back from i
+	int in_range_before(int i, int n) const {
+		const glm::ivec2* it = containing(i);
+		if (it == intervals.end() || (*it)[0] > i)
+			return 0;
+		if ((*it)[0] == 0 && (*it)[1] == n)
+			return std::numeric_limits<int>::max();
+		int k = i - (*it)[0] + 1;
+		if ((*it)[0] == 0 && intervals.back()[1] == n)
+			k += intervals.back()[1] - intervals.back()[0];
+		return k;
+	}
+
+	void build(const path& p, const glm::vec3& center, float radius) {
+		std::vector<glm::ivec2> in;
+		std::vector<unsigned long long> b((p.size() + 63) / 64, 0ull);
+		for (int i = 0; i < (int)p.size(); ++i) {
+			if (glm::length(center - p.position(i)) >= radius)
+				continue;
+			b[i >> 6] |= 1ull << (i & 63);
+			if (!in.empty() && in.back()[1] == i)
+				in.back()[1] = i + 1;
+			else
+				in.push_back(glm::ivec2(i, i + 1));
+		}
+		intervals.assign(std::move(in));
+		bits.assign(std::move(b));
+	}
+
+private:
+	/// the first interval that ends after sample i
+	const glm::ivec2* containing(int i) const {
+		return std::upper_bound(intervals.begin(), intervals.end(), i,
+			[](int i, const glm::ivec2& r) { return i < r[1]; });
+	}
+};
+
  
 /** Cameramen
 	The cameraman films the race from a given specified point of view. 
 	The cameraman has a  radius of action. When a car is within is radius the cameraman points the camera to it.
-	The cameraman is represented with a 4x4 matrix encoding its view frame
+	The cameraman is represented with a 4x4 matrix encoding its view frame.
+	Locks are decided once per sample tick (30 per second): an unlocked cameraman locks on the first car within its
+	radius, a locked one unlocks when its car leaves the radius. Once unlocked it keeps looking where its car left.
 */
 struct cameraman {
 	friend race;
-	cameraman(float r) :radius(r), locked(false) {}
+	friend carousel_loader;
+	friend scene_cache;
+	friend scene_watch;
+	cameraman(float r) :radius(r), target_car(-1), locked(false), last_target(-1), last_tick(-1) {}
 
 	/// cameraman view reference frame
 	glm::mat4 frame;
 
+	/// is it following a car
+	bool is_locked() const { return locked; }
+
+	/// the car it is following, if locked
+	int target() const { return target_car; }
+
 private:
 	/// lock if a car is closer than radius
 	float radius;
@@ -49,6 +153,12 @@ private:
 	
 	/// is looking to  a car
 	bool locked;
+
+	/// the car it was locked on the last time, -1 if never
+	int last_target;
+
+	/// the last tick it was locked
+	long long last_tick;
 };
  
  
@@ -60,7 +170,7 @@ private:
 struct track {
 	friend race;
 	track() {}
-	std::vector<glm::vec3> curbs[2]; 
+	shared_array<glm::vec3> curbs[2]; 
 
 	///length of the track
 	float length;
@@ -73,15 +183,6 @@ private:
 	}
 };
 
-struct path {
-
-	// store one frame every 1/30 of second
-	// frames[i] is the frame at time i* (1000.f/30.0) in milliseconds
-	std::vector<glm::mat4> frames; 
-
-	int T; // how many milliseconds for a lap to complete
-};
-
 
  
 /**
@@ -90,6 +191,7 @@ struct path {
 */
 struct car {
 	friend race;
+	friend scene_watch;
 
 	/// local frame of the car. the car front is on -z halfspace
 	glm::mat4 frame;
@@ -111,8 +213,31 @@ private:
 */
 struct  terrain {
 	
-	/// terrain specified as an height field
-	std::vector<unsigned char> height_field;
+	/// terrain specified as an height field, size_pix[0] x size_pix[1] bytes. The copies of a terrain share it,
+	/// and it may point into a memory mapped scene cache (see scene_cache)
+	std::shared_ptr<const unsigned char> height_field;
+
+	/// tiled storage of large height fields, read through a cache of mapped tiles. When set, height_field is empty
+	std::shared_ptr<const terrain_tiles> tiles;
+
+	/// replace the height field with a copy of the given one
+	void set_height_field(const unsigned char* data, int sx, int sy) {
+		std::shared_ptr<std::vector<unsigned char> > v = std::make_shared<std::vector<unsigned char> >(data, data + sx * sy);
+		height_field = std::shared_ptr<const unsigned char>(v, v->empty() ? 0 : &(*v)[0]);
+		tiles.reset();
+		size_pix = glm::ivec2(sx, sy);
+	}
+
+	/// use the tiled height field in filename (see terrain_tiles), keeping at most max_tiles tiles in memory
+	bool set_tiles(const char* filename, size_t max_tiles = 64) {
+		std::shared_ptr<terrain_tiles> tt = std::make_shared<terrain_tiles>();
+		if (!tt->open(filename, max_tiles))
+			return false;
+		tiles = tt;
+		height_field.reset();
+		size_pix = glm::ivec2(tt->width(), tt->height());
+		return true;
+	}
 
 	/// rectangle in xz where the terrain is located (minx,miny,sizex,sizey)
 	glm::vec4 rect_xz;
@@ -121,13 +246,18 @@ struct  terrain {
 	glm::ivec2 size_pix;
 
 	
+	/// byte at row, col of the height field image, whichever the storage
+	unsigned char texel(int row, int col) const {
+		return tiles ? tiles->texel(row, col) : height_field.get()[row * size_pix[0] + col];
+	}
+
 	float  hf(const unsigned int i, const unsigned int j) const {
-		return height_field[ (size_pix[0]-1-i) * size_pix[0] + j]/50.f;
+		return texel(size_pix[0]-1-i, j)/50.f;
 	}
 
  
 	/// given a 3D point, returns its orthogonal projection into the terrain (that is, along the y direction)
-	glm::vec3  p(glm::vec3 p_in) {
+	glm::vec3  p(glm::vec3 p_in) const {
 		return glm::vec3(p_in.x, y(p_in.x, p_in.z), p_in.z);
 	}
 
@@ -154,61 +284,488 @@ struct  terrain {
 		return	value;
 	}
 
+	/**
+	 * heights of n points (x[k], z[k]), and the gradients of the height (dy/dx, dy/dz) if grad is given.
+	 * The heights are the ones of y(), computed four at a time where SSE2 is available; points beyond the border of
+	 * the height field take the height of the border instead of reading outside it.
+	 */
+	void heights(const float* x, const float* z, size_t n, float* h, glm::vec2* grad = 0) const {
+		const float sx = rect_xz[2] / size_pix[0];
+		const float sy = rect_xz[3] / size_pix[1];
+		size_t k = 0;
+#if defined(TERRAIN_SSE2)
+		if (!tiles) {
+			const __m128 x0 = _mm_set1_ps(rect_xz[0]), z0 = _mm_set1_ps(rect_xz[1]);
+			const __m128 vsx = _mm_set1_ps(sx), vsy = _mm_set1_ps(sy), one = _mm_set1_ps(1.f), fifty = _mm_set1_ps(50.f);
+			const __m128i zero = _mm_setzero_si128();
+			const __m128i last_i = _mm_set1_epi32(size_pix[0] - 1), last_j = _mm_set1_epi32(size_pix[1] - 1);
+			const unsigned char* data = height_field.get();
+			for (; k + 4 <= n; k += 4) {
+				const __m128 i_min = _mm_div_ps(_mm_sub_ps(_mm_loadu_ps(x + k), x0), vsx);
+				const __m128 j_min = _mm_div_ps(_mm_sub_ps(_mm_loadu_ps(z + k), z0), vsy);
+				const __m128i i = floor_epi32(i_min), j = floor_epi32(j_min);
+				const __m128 u = _mm_sub_ps(i_min, _mm_cvtepi32_ps(i));
+				const __m128 v = _mm_sub_ps(j_min, _mm_cvtepi32_ps(j));
+
+				// the four texels around each point: rows from i (see hf), columns from j
+				int r0[4], r1[4], c0[4], c1[4];
+				_mm_storeu_si128((__m128i*)r0, _mm_sub_epi32(last_i, clamp_epi32(i, zero, last_i)));
+				_mm_storeu_si128((__m128i*)r1, _mm_sub_epi32(last_i, clamp_epi32(_mm_add_epi32(i, _mm_set1_epi32(1)), zero, last_i)));
+				_mm_storeu_si128((__m128i*)c0, clamp_epi32(j, zero, last_j));
+				_mm_storeu_si128((__m128i*)c1, clamp_epi32(_mm_add_epi32(j, _mm_set1_epi32(1)), zero, last_j));
+				const int w = size_pix[0];
+				const __m128 h00 = _mm_div_ps(_mm_setr_ps(data[r0[0] * w + c0[0]], data[r0[1] * w + c0[1]], data[r0[2] * w + c0[2]], data[r0[3] * w + c0[3]]), fifty);
+				const __m128 h01 = _mm_div_ps(_mm_setr_ps(data[r0[0] * w + c1[0]], data[r0[1] * w + c1[1]], data[r0[2] * w + c1[2]], data[r0[3] * w + c1[3]]), fifty);
+				const __m128 h10 = _mm_div_ps(_mm_setr_ps(data[r1[0] * w + c0[0]], data[r1[1] * w + c0[1]], data[r1[2] * w + c0[2]], data[r1[3] * w + c0[3]]), fifty);
+				const __m128 h11 = _mm_div_ps(_mm_setr_ps(data[r1[0] * w + c1[0]], data[r1[1] * w + c1[1]], data[r1[2] * w + c1[2]], data[r1[3] * w + c1[3]]), fifty);
+
+				// the terms are added in the order of y(), so that the heights are the same
+				const __m128 iu = _mm_sub_ps(one, u), iv = _mm_sub_ps(one, v);
+				__m128 value = _mm_mul_ps(_mm_mul_ps(h00, iu), iv);
+				value = _mm_add_ps(value, _mm_mul_ps(_mm_mul_ps(h01, iu), v));
+				value = _mm_add_ps(value, _mm_mul_ps(_mm_mul_ps(h10, u), iv));
+				value = _mm_add_ps(value, _mm_mul_ps(_mm_mul_ps(h11, u), v));
+				_mm_storeu_ps(h + k, value);
+
+				if (grad) {
+					const __m128 dx = _mm_div_ps(_mm_add_ps(_mm_mul_ps(_mm_sub_ps(h10, h00), iv), _mm_mul_ps(_mm_sub_ps(h11, h01), v)), vsx);
+					const __m128 dz = _mm_div_ps(_mm_add_ps(_mm_mul_ps(_mm_sub_ps(h01, h00), iu), _mm_mul_ps(_mm_sub_ps(h11, h10), u)), vsy);
+					float gx[4], gz[4];
+					_mm_storeu_ps(gx, dx);
+					_mm_storeu_ps(gz, dz);
+					for (int l = 0; l < 4; ++l)
+						grad[k + l] = glm::vec2(gx[l], gz[l]);
+				}
+			}
+		}
+#endif
+		for (; k < n; ++k) {
+			const float i_min = (x[k] - rect_xz[0]) / sx;
+			const float j_min = (z[k] - rect_xz[1]) / sy;
+			const int i = static_cast<int>(floor(i_min));
+			const int j = static_cast<int>(floor(j_min));
+			const float u = i_min - i;
+			const float v = j_min - j;
+			const float h00 = clamped_hf(i, j), h01 = clamped_hf(i, j + 1), h10 = clamped_hf(i + 1, j), h11 = clamped_hf(i + 1, j + 1);
+			h[k] = h00 * (1.f - u) * (1.f - v) + h01 * (1.f - u) * v + h10 * u * (1.f - v) + h11 * u * v;
+			if (grad)
+				grad[k] = glm::vec2(((h10 - h00) * (1.f - v) + (h11 - h01) * v) / sx, ((h01 - h00) * (1.f - u) + (h11 - h10) * u) / sy);
+		}
+	}
+
+private:
+	/// hf with i and j clamped to the height field
+	float clamped_hf(int i, int j) const {
+		i = std::min(std::max(i, 0), size_pix[0] - 1);
+		j = std::min(std::max(j, 0), size_pix[1] - 1);
+		return texel(size_pix[0] - 1 - i, j) / 50.f;
+	}
+
+#if defined(TERRAIN_SSE2)
+	/// floor of each lane, as int
+	static __m128i floor_epi32(__m128 a) {
+		const __m128i t = _mm_cvttps_epi32(a);
+		// truncation rounds the negative values up: take one off where the truncated value is larger
+		return _mm_add_epi32(t, _mm_castps_si128(_mm_cmpgt_ps(_mm_cvtepi32_ps(t), a)));
+	}
+
+	static __m128i clamp_epi32(__m128i a, __m128i lo, __m128i hi) {
+		__m128i lt = _mm_cmplt_epi32(a, lo);
+		a = _mm_or_si128(_mm_and_si128(lt, lo), _mm_andnot_si128(lt, a));
+		__m128i gt = _mm_cmpgt_epi32(a, hi);
+		return _mm_or_si128(_mm_and_si128(gt, hi), _mm_andnot_si128(gt, a));
+	}
+#endif
+
 };
 
 
 
 
+/**
+	   the parts of a race that never change while it runs. They are written once by the loader and then shared,
+	   read only, by all the copies of the race (see race::scene())
+*/
+struct race_scene {
+	box3 bbox;
+	terrain ter;
+	track t;
+	shared_array<stick_object> trees;
+	shared_array<stick_object> lamps;
+	std::vector<path> carpaths;
+
+	/// the visibility tables of a carpath, one per cameraman
+	typedef std::shared_ptr<const std::vector<visibility_table> > visibility_tables;
+
+	/// (*visibility[p])[ic] tells which samples of carpath p are within the radius of cameraman ic. The scenes a reload
+	/// makes share the tables of the carpaths that did not change, as long as the cameramen did not move (see scene_watch)
+	std::vector<visibility_tables> visibility;
+
+	/// carpaths_baked[p] becomes ready when carpaths[p] and visibility[p] have been computed
+	std::vector<std::shared_future<void> > carpaths_baked;
+};
+
  
+/// something that is told about every update of a race, e.g. a race_recorder. See race::set_observer
+struct race_observer {
+	virtual ~race_observer() {}
+
+	/// called at the end of race::update
+	virtual void updated(const race& r) = 0;
+};
+
+/// the dynamic part of a race at a given time, see race::evaluate
+struct race_state {
+	/// milliseconds since the start, pauses excluded
+	long long t;
+
+	glm::vec3 sunlight_direction;
+
+	/// frame of each car
+	std::vector<glm::mat4> car_frames;
+
+	/// cameramen with their frames and locks
+	std::vector<cameraman> cameramen;
+};
+
 /**
 	   a race is a scene with some static (terrain, trees, lamps...) and some dynamic components (cars, cameramen, sunlight direction) 
 */
 class race {
 	friend carousel_loader;
+	friend scene_cache;
+	friend scene_watch;
 public:
-	race():sim_time_ratio(60){}
+	race():_scene(std::make_shared<race_scene>()), _cars_stale(false), _clock(0), _observer(0), paused_ms(0), _elapsed(0), _tick(-1), sim_time(10 * 3600 * 1000LL), sim_time_ratio(60){}
 
 	/// bounding box of the whole scene
-	const box3& bbox() const {	return _bbox;}
+	const box3& bbox() const {	return _scene->bbox;}
 
 	/// terrain height field
-	const terrain& ter() const { return _ter; }
+	const terrain& ter() const { return _scene->ter; }
 
 	/// race track
-	const track& t() const { return _t; }
+	const track& t() const { return _scene->t; }
 
 	/// sunlight direction. It changes with time
 	const glm::vec3& sunlight_direction() const { return _sunlight_direction; }
 
 	/// a vector of trees
-	const std::vector<stick_object> & trees() const { return _trees;    }
+	const shared_array<stick_object> & trees() const { return _scene->trees;    }
 
 	/// a vector of lamps
-	const std::vector<stick_object> & lamps() const { return _lamps;    }
+	const shared_array<stick_object> & lamps() const { return _scene->lamps;    }
 
 	/// a vector of cameramen
 	const std::vector<cameraman>& cameramen() const { return _cameramen;}
 
-	/// a vector of cars
-	const std::vector<car>  &          cars() const { return _cars;     }
+	/// a vector of cars. The frames are copied out of the car pool only when they changed since the last call
+	const std::vector<car>  &          cars() const { 
+		if (_cars_stale) {
+			for (size_t i = 0; i < _cars.size(); ++i)
+				_cars[i].frame = _pool.frames[i];
+			_cars_stale = false;
+		}
+		return _cars;     
+	}
+
+	/// the paths the cars run along. They are baked in background by the loader: call wait_paths() before reading them
+	const std::vector<path>& paths() const { return _scene->carpaths; }
+
+	/// wait until carpath ip is ready
+	void wait_path(int ip) const {
+		const std::vector<std::shared_future<void> >& baked = _scene->carpaths_baked;
+		if (ip < (int)baked.size() && baked[ip].valid())
+			baked[ip].wait();
+	}
+
+	/// wait until all the carpaths are ready
+	void wait_paths() const {
+		for (size_t ip = 0; ip < _scene->carpaths.size(); ++ip)
+			wait_path((int)ip);
+	}
+
+	/**
+	 * the static part of the race. A copy of a race shares it with the original, so many races with different
+	 * cars and start times can run on the same scene loaded once.
+	 */
+	const std::shared_ptr<race_scene>& scene() const { return _scene; }
+
+	/// the cars stored as structure of arrays. This is what update() works on
+	const car_pool& pool() const { return _pool; }
+
+	/// simulated milliseconds elapsed since start, as of the last update (pauses excluded)
+	long long elapsed() const { return _elapsed; }
+
+	/**
+	 * replace the time source of the race. The race does not take ownership of the clock.
+	 * Pass 0 to go back to the default wall clock. Call it before start().
+	 */
+	void set_clock(sim_clock* c) { _clock = c; }
+
+	/// o is told about every update. The race does not take ownership of it; pass 0 to remove it
+	void set_observer(race_observer* o) { _observer = o; }
+
+	/**
+	 * update rate level of detail. Cars farther than distance from the view, or outside its frustum, get their frame
+	 * recomputed only once every period updates. Their position along the path and the cameramen locks stay exact,
+	 * and a car gets its exact frame back in the first update where it is relevant again. period 1 turns it off (default).
+	 */
+	void set_lod(float distance, int period) {
+		_pool.lod.distance = distance;
+		_pool.lod.period = period;
+	}
+
+	/**
+	 * the view the level of detail is measured from. Call it before update()
+	 * @param view from the race reference frame to eye space
+	 * @param proj projection matrix
+	 */
+	void set_lod_view(const glm::mat4& view, const glm::mat4& proj) { _pool.lod.set_view(view, proj); }
+
+	/// car ica gets its frame computed at every update, whatever the level of detail
+	void pin_car(unsigned int ica, bool pinned = true) { _pool.pinned[ica] = pinned; }
+
+	/// how many car frames the last update computed and skipped
+	const lod_counters& lod_stats() const { return _pool.counters; }
 	 
 private:
-	box3 _bbox;
-	terrain _ter;
-	track _t;
+	std::shared_ptr<race_scene> _scene;
 	glm::vec3 _sunlight_direction;
-	std::vector<stick_object> _trees;
-	std::vector<stick_object> _lamps;
 	std::vector<cameraman> _cameramen;
-	std::vector<car> _cars;
+	car_pool _pool;
 
+	/**
+	 * the cars within the radius of a cameraman at some tick of [from, until], in increasing order: in those ticks
+	 * they are the only ones its lock looks at. The list of a window is found once, walking all the cars, and is
+	 * then used by every tick of the window
+	 */
+	struct near_cars {
+		enum { TICKS = 30 };
+		near_cars() :from(0), until(-1) {}
+		long long from, until;
+		std::vector<unsigned int> cars;
+	};
+
+	/// near cars of each cameraman, for update
+	std::vector<near_cars> _near;
+
+	/// array of structures view of _pool, see cars()
+	mutable std::vector<car> _cars;
+	mutable bool _cars_stale;
+
+	/// time source, 0 means _wall_clock
+	sim_clock* _clock;
+	wall_clock _wall_clock;
+
+	/// told about every update, may be 0
+	race_observer* _observer;
+
+	/// sample of car ica at the given tick, as computed by car_pool::update
+	int sample_at(unsigned int ica, long long tick) const {
+		int sz = (int)_scene->carpaths[_pool.id_path[ica]].size();
+		int ii = _pool.delta_i[ica] + int(tick % sz);
+		return (ii < sz) ? ii : ii - sz;
+	}
 
-	std::vector<path> carpaths;
+	/// visibility of the path of car ica from cameraman ic, 0 if there is none
+	const visibility_table* table(unsigned int ic, unsigned int ica) const {
+		const std::vector<race_scene::visibility_tables>& v = _scene->visibility;
+		int id_path = _pool.id_path[ica];
+		const std::vector<visibility_table>* t = (id_path < (int)v.size()) ? v[id_path].get() : 0;
+		return (t && ic < t->size()) ? &(*t)[ic] : 0;
+	}
+
+	/// the near cars of cameraman ic in a window of n.TICKS ticks that has the given one, if the window of n does not
+	void near(unsigned int ic, long long tick, near_cars& n) const {
+		if (tick >= n.from && tick <= n.until)
+			return;
+		// going back, as seen_since does, the window ends at the tick
+		n.from = (tick < n.from) ? std::max(tick - near_cars::TICKS + 1, 0LL) : tick;
+		n.until = n.from + near_cars::TICKS - 1;
+		n.cars.clear();
+		for (unsigned int ica = 0; ica < _pool.size(); ++ica) {
+			const visibility_table* t = table(ic, ica);
+			int k = t ? t->next_in_range(sample_at(ica, n.from), (int)_scene->carpaths[_pool.id_path[ica]].size()) : -1;
+			if (k != -1 && k < near_cars::TICKS)
+				n.cars.push_back(ica);
+		}
+	}
+
+	/// the windows of update are no longer right: call it when the cars, their carpaths or the cameramen change
+	void forget_near() { _near.assign(_cameramen.size(), near_cars()); }
+
+	/// is car ica, at the given tick, within the radius of cameraman ic
+	bool sees(unsigned int ic, unsigned int ica, long long tick) const {
+		const visibility_table* t = table(ic, ica);
+		return t && t->in_range(sample_at(ica, tick));
+	}
+
+	/// ticks from the given one on in which car ica stays within the radius of cameraman ic, see in_range_after
+	long long seen_for(unsigned int ic, unsigned int ica, long long tick) const {
+		const visibility_table* t = table(ic, ica);
+		return t ? t->in_range_after(sample_at(ica, tick), (int)_scene->carpaths[_pool.id_path[ica]].size()) : 0;
+	}
+
+	/// the first tick from the given one up to end in which some car is within the radius of cameraman ic, -1 if none is
+	long long next_seen(unsigned int ic, long long tick, long long end, near_cars& n) const {
+		for (; tick <= end; tick = n.until + 1) {
+			near(ic, tick, n);
+			long long next = -1;
+			for (size_t i = 0; i < n.cars.size(); ++i) {
+				const unsigned int ica = n.cars[i];
+				int k = table(ic, ica)->next_in_range(sample_at(ica, tick), (int)_scene->carpaths[_pool.id_path[ica]].size());
+				if (k != -1 && (next == -1 || tick + k < next))
+					next = tick + k;
+			}
+			// the cars out of the window enter the radius after it
+			if (next != -1 && next <= n.until)
+				return next <= end ? next : -1;
+		}
+		return -1;
+	}
+
+	/// the first of the ticks up to the given one in which some car is always within the radius of cameraman ic,
+	/// tick + 1 if there is no car in it at tick
+	long long seen_since(unsigned int ic, long long tick, near_cars& n) const {
+		near(ic, tick, n);
+		long long since = tick + 1;
+		for (size_t i = 0; i < n.cars.size(); ++i) {
+			const unsigned int ica = n.cars[i];
+			int k = table(ic, ica)->in_range_before(sample_at(ica, tick), (int)_scene->carpaths[_pool.id_path[ica]].size());
+			since = std::min(since, tick + 1 - k);
+		}
+		return since;
+	}
+
+	/// the first car within the radius of cameraman ic at the given tick, -1 if none
+	int first_seen(unsigned int ic, long long tick, near_cars& n) const {
+		near(ic, tick, n);
+		for (size_t i = 0; i < n.cars.size(); ++i)
+			if (sees(ic, n.cars[i], tick))
+				return n.cars[i];
+		return -1;
+	}
+
+	/// move the lock of cameraman c from the previous tick to this one
+	void step_lock(unsigned int ic, long long tick, cameraman& c, near_cars& n) const {
+		if (!c.locked) {
+			c.target_car = first_seen(ic, tick, n);
+			c.locked = c.target_car != -1;
+		}
+		else
+			if (!sees(ic, c.target_car, tick))
+				c.locked = false;
+		if (c.locked) {
+			c.last_target = c.target_car;
+			c.last_tick = tick;
+		}
+	}
+
+	/**
+	 * bring the lock of cameraman c from tick t0 (-1: before the start) to tick t1 > t0.
+	 * A tick where no car is in range unlocks the cameraman whatever happened before, so the ticks are
+	 * replayed from the last such tick, going further back only to find the last car it was locked on.
+	 * The visibility intervals skip the ticks in which nothing changes: those with no car in range while
+	 * unlocked, and those with its car in range while locked. n keeps the near cars of ic between the calls.
+	 */
+	void advance_lock(unsigned int ic, long long t0, long long t1, cameraman& c, near_cars& n) const {
+		cameraman result = c;
+		bool first = true;
+		for (long long end = t1; ; ) {
+			long long reset = end;
+			while (reset > t0) {
+				long long since = seen_since(ic, reset, n);
+				if (since > reset)
+					break;
+				reset = std::max(since - 1, t0);
+			}
+
+			cameraman w = c;
+			if (reset > t0) {
+				w.locked = false;
+				w.last_target = -1;
+			}
+			for (long long tick = reset + 1; tick <= end; ++tick) {
+				if (!w.locked) {
+					long long next = next_seen(ic, tick, end, n);
+					if (next == -1) {
+						w.target_car = -1;
+						break;
+					}
+					tick = next;
+				}
+				else {
+					long long last = std::min(tick + seen_for(ic, w.target_car, tick) - 1, end);
+					if (last >= tick) {
+						w.last_target = w.target_car;
+						w.last_tick = last;
+						tick = last;
+						continue;
+					}
+				}
+				step_lock(ic, tick, w, n);
+			}
+
+			if (first) {
+				result = w;
+				first = false;
+			}
+			if (w.last_target != -1 || reset == t0) {
+				result.last_target = w.last_target;
+				result.last_tick = w.last_tick;
+				break;
+			}
+			end = reset - 1;
+		}
+		c.target_car = result.target_car;
+		c.locked = result.locked;
+		c.last_target = result.last_target;
+		c.last_tick = result.last_tick;
+	}
+
+	/**
+	 * point cameraman c to its car, or where its car left if unlocked
+	 * @param target_pos position of the target car, used if locked
+	 */
+	void aim(cameraman& c, const glm::vec3& target_pos) const {
+		glm::vec3 cp = *(glm::vec3*)&c.frame[3];
+		glm::vec3 tcp;
+		if (c.locked)
+			tcp = target_pos;
+		else
+			if (c.last_target != -1)
+				tcp = glm::vec3(_scene->carpaths[_pool.id_path[c.last_target]].frame(sample_at(c.last_target, c.last_tick), 1.f)[3]);
+			else {
+				c.frame = glm::mat4(1.f);
+				c.frame[3] = glm::vec4(cp, 1.f);
+				return;
+			}
+		c.frame = glm::lookAt(cp, tcp, glm::vec3(0, 1, 0));
+		c.frame = glm::inverse(c.frame);
+	}
+
+	/// sunlight direction cs milliseconds after the start
+	glm::vec3 sun_at(long long cs) const {
+		long long day_ms = 3600000LL * 24;
+		long long daytime = (this->sim_time + cs * sim_time_ratio) % (day_ms);
+		glm::mat4 R = glm::rotate(glm::mat4(1.f), glm::radians(360.f * daytime / float(day_ms)), glm::vec3(1, 0, 0));
+		return glm::vec3(R * glm::vec4(0.f, -1.f, 0.f, 0.f));
+	}
 
-	int clock_start;
+	sim_clock& time_source() { return (_clock) ? *_clock : _wall_clock; }
+
+	/// total length of the pauses in milliseconds
+	long long paused_ms;
+
+	/// time of the last update in milliseconds
+	long long _elapsed;
+
+	/// sample tick of the last update, -1 before the first one
+	long long _tick;
 
 	/// simulation sunlight time in milliseconds
-	int sim_time;
+	long long sim_time;
 
 	/// how long a real second in simulated sunlight time
 	int sim_time_ratio; 
@@ -222,11 +779,21 @@ public:
 	 * @param ratio between the actual time and the simulated time for the sunlight direction
 	 */
 	void start( int h = -1, int m = -1, int s = -1, int _sim_time_ratio = 60) {
-		clock_start = clock();
+		time_source().reset();
+		paused_ms = 0;
+		_elapsed = 0;
+		_tick = -1;
+		for (unsigned int ic = 0; ic < _cameramen.size(); ++ic) {
+			cameraman& c = _cameramen[ic];
+			c.locked = false;
+			c.target_car = c.last_target = -1;
+			c.last_tick = -1;
+			aim(c, glm::vec3(0.f));
+		}
 		if (h != -1) 
-			sim_time = (s + m * 60 + h * 3600) * 1000;
+			sim_time = (s + m * 60 + h * 3600) * 1000LL;
 		else
-			sim_time = ( 10 * 3600) * 1000; // start at ten in the morning
+			sim_time = ( 10 * 3600) * 1000LL; // start at ten in the morning
 		if (_sim_time_ratio != 60)
 			sim_time_ratio = _sim_time_ratio;
 	}
@@ -237,18 +804,24 @@ public:
 	* @param delta shift the starting point along the path
 	* */
 	void add_car(int id_path, float delta = -1) {
+		const std::vector<path>& carpaths = _scene->carpaths;
 		if (id_path >= carpaths.size()) {
 			std::cout << "car path > " << carpaths.size() - 1 << "\n";
 			exit(-1);
 		}
+		// update() reads only the paths with cars on them, so this is the only place that waits
+		wait_path(id_path);
 		car c; 
 		c.box.add(glm::vec3(-1, 1.5, -2));
 		c.box.add(glm::vec3( 1, 0,    2));
 		c.id_path = id_path;
 		 
-		c.delta_i = (int) floor(((delta == -1) ? rand() / float(RAND_MAX):delta) * (carpaths[id_path].frames.size() - 2));
+		c.delta_i = (int) floor(((delta == -1) ? rand() / float(RAND_MAX):delta) * (carpaths[id_path].size() - 2));
 
 		_cars.push_back(c);
+		_pool.add(c.id_path, c.delta_i, c.box);
+		forget_near();
+		_cars_stale = true;
 	}
 
 	/**
@@ -257,54 +830,81 @@ public:
 	 * @param delta shift the starting point along the path
 	 */
 	void add_car(float delta = -1) {
-		int id = (int) floor((rand() / float(RAND_MAX)) *  carpaths.size());
+		int id = (int) floor((rand() / float(RAND_MAX)) *  _scene->carpaths.size());
 		add_car(id,delta);
 	}
 
 	/**
 	 * update the carousel. Call this at the beginning of any render cycle
+	 * @param pause_length milliseconds the race has been paused since the last update; they are not simulated
 	 * */
 	void update(unsigned int pause_length=0) {
-		clock_start += pause_length;
-		int cs = clock() - clock_start;
-		for (size_t i = 0; i < _cars.size();++i) {
-			int ii = ((int)((cs) / 1000.f * 30.f)+ _cars[i].delta_i) % carpaths[_cars[i].id_path].frames.size();
-			//std::cout << ii << std::endl;
-			_cars[i].frame = carpaths[_cars[i].id_path].frames[ii];
+		paused_ms += pause_length;
+		long long cs = time_source().now() - paused_ms;
+		_elapsed = cs;
+
+		// cars are interpolated between the two samples around the current time. Paths without cars may still be baking
+		// and are not touched
+		long long tick = cs * 30 / 1000;
+		float u = ((cs * 30) % 1000) / 1000.f;
+		const std::vector<path>& carpaths = _scene->carpaths;
+		_pool.update(carpaths.empty() ? 0 : &carpaths[0], carpaths.size(), tick, u);
+		_cars_stale = true;
+		_sunlight_direction = sun_at(cs);
+
+		// update cameramen locks, tick by tick since the last update. If time went back, replay from the start
+		if (tick < _tick) {
+			for (unsigned int ic = 0; ic < _cameramen.size(); ++ic) {
+				_cameramen[ic].locked = false;
+				_cameramen[ic].last_target = -1;
+			}
+			_tick = -1;
 		}
-		int day_ms = 3600000 * 24;
-		 
-		int daytime = (  this->sim_time + cs * sim_time_ratio) % (day_ms);
-		glm::mat4 R = glm::rotate(glm::mat4(1.f), glm::radians(360.f * daytime / float(day_ms)), glm::vec3(1, 0, 0));
-		_sunlight_direction = R * glm::vec4(0.f, -1.f, 0.f,0.f);
-
-		// update cameramen frames
+		if (_near.size() != _cameramen.size())
+			forget_near();
 		for (unsigned int ic = 0; ic < _cameramen.size(); ++ic) {
 			cameraman& c = _cameramen[ic];
-			glm::vec3 cp = *(glm::vec3*)&c.frame[3];
+			if (tick > _tick)
+				advance_lock(ic, _tick, tick, c, _near[ic]);
+			if (c.locked)
+				_pool.refresh(c.target_car);
+			aim(c, c.locked ? glm::vec3(_pool.frames[c.target_car][3]) : glm::vec3(0.f));
+		}
+		_tick = tick;
 
-			if (!c.locked) {
-				for (unsigned int ica = 0; ica < _cars.size(); ++ica)
-					if (glm::length(cp - *(glm::vec3*)&_cars[ica].frame[3]) < c.radius) {
-						c.target_car = ica;
-						c.locked = true;
-						break;
-					}
-			}
+		if (_observer)
+			_observer->updated(*this);
+	}
 
-			if (c.locked) {
-				glm::vec3 tcp = *(glm::vec3*)&_cars[c.target_car].frame[3];
-				if (glm::length(cp - tcp) < c.radius)
-				{
-					c.frame = glm::lookAt(cp, tcp, glm::vec3(0, 1, 0));
-					c.frame = glm::inverse(c.frame);
-				}
-				else
-					c.locked = false;
-			}
+	/**
+	 * the dynamic state of the race t milliseconds after the start (pauses excluded), without changing the race.
+	 * It is the same state update() reaches at time t whatever the sequence of previous updates, so frames can be
+	 * computed out of order, e.g. by many threads each with its own range of times.
+	 * The cost grows with how many times the cameramen have changed lock since they last had no car in range before t.
+	 */
+	race_state evaluate(long long t) const {
+		race_state st;
+		st.t = t;
+		st.sunlight_direction = sun_at(t);
+
+		long long tick = t * 30 / 1000;
+		float u = ((t * 30) % 1000) / 1000.f;
+		st.car_frames.resize(_pool.size());
+		for (unsigned int ica = 0; ica < _pool.size(); ++ica)
+			st.car_frames[ica] = _scene->carpaths[_pool.id_path[ica]].frame(sample_at(ica, tick), u);
+
+		st.cameramen = _cameramen;
+		for (unsigned int ic = 0; ic < st.cameramen.size(); ++ic) {
+			cameraman& c = st.cameramen[ic];
+			c.locked = false;
+			c.target_car = c.last_target = -1;
+			c.last_tick = -1;
+			near_cars n;
+			advance_lock(ic, -1, tick, c, n);
+			aim(c, c.locked ? glm::vec3(st.car_frames[c.target_car][3]) : glm::vec3(0.f));
 		}
+		return st;
 	}
-
 };
 
 
@@ -1,127 +1,338 @@
 #pragma once
 #include "carousel.h"
 #include "..\path.h"
+#include "..\thread_pool.h"
+#include "..\svg_stream.h"
+#include "scene_cache.h"
+#include "..\load_profile.h"
 
 struct carousel_loader {
 	carousel_loader() {}
 
 	static race* & r() {   static race * r; return r; }
 
-	static void push_stick_object(NSVGpath* npath,float h, std::vector<stick_object> & vso) {
+	/// process the shapes of the svg and bake the carpaths on thread_pool::global() (default), or all in the calling thread
+	static bool& parallel() { static bool p = true; return p; }
+
+	/// what a shape of the svg adds to the scene, see process_shape
+	struct shape_result {
+		std::vector<stick_object> trees, lamps;
+		std::vector<cameraman> cameramen;
+		std::vector<glm::vec3> curbs[2];
+		std::vector<std::vector<glm::vec3> > carpaths_points;
+	};
+
+	/// the shapes of the svg and what they added to the scene, kept by load for scene_watch
+	struct loaded_shapes {
+		loaded_shapes() :parsed(false) {}
+
+		/// false if the scene came from the cache, which has neither
+		bool parsed;
+		svg_stream::image image;
+		std::vector<shape_result> results;
+	};
+
+	static void push_stick_object(const svg_stream::path& npath,float h, const terrain& ter, std::vector<stick_object> & vso) {
 		stick_object  so; 
-		so.pos = glm::vec3(npath->pts[0], r()->ter().y(npath->pts[0], npath->pts[1]), npath->pts[1]);
+		so.pos = glm::vec3(npath.pts[0].x, ter.y(npath.pts[0].x, npath.pts[0].y), npath.pts[0].y);
 		so.height = 2.0;
 		vso.push_back(so);
 	}
 
-	static void push_cameraman(NSVGpath* npath, float rd, std::vector<cameraman>& vc) {
+	static void push_cameraman(const svg_stream::path& npath, float rd, const terrain& ter, std::vector<cameraman>& vc) {
 		cameraman  so(rd);
 		so.frame = glm::mat4(1.f);
-		so.frame[3] = glm::vec4(npath->pts[0], r()->ter().y(npath->pts[0], npath->pts[1]), npath->pts[1], 1.0);
+		so.frame[3] = glm::vec4(npath.pts[0].x, ter.y(npath.pts[0].x, npath.pts[0].y), npath.pts[0].y, 1.0);
 		vc.push_back(so);
 	}
 
-	static void regular_sampling(const NSVGpath * path, double delta, std::vector<glm::vec3>& samples_pos, std::vector<glm::vec3>& samples_tan, float* tot = 0) {
-		int ip = 0;
+	static void control_points(const svg_stream::path& path, std::vector<glm::vec3>& controlPoints) {
+		for (size_t i = 0; i < path.pts.size(); i += 1)
+			controlPoints.push_back(glm::vec3(path.pts[i].x, 0, path.pts[i].y));
+	}
+
+	static void regular_sampling(const std::vector<glm::vec3>& controlPoints, double delta, std::vector<glm::vec3>& samples_pos, std::vector<glm::vec3>& samples_tan, float* tot = 0) {
+		bezier_path::regular_sampling(controlPoints, delta, samples_pos, samples_tan, tot);
+	}
+
+	static void regular_sampling(const svg_stream::path& path, double delta, std::vector<glm::vec3>& samples_pos, std::vector<glm::vec3>& samples_tan, float* tot = 0) {
 		std::vector<glm::vec3> controlPoints;
-		for (int i = 0; i < path->npts; i += 1)
-			controlPoints.push_back(glm::vec3(path->pts[i * 2], 0, path->pts[i * 2 + 1]));
-		bezier_path::regular_sampling(controlPoints, 0.1f, samples_pos, samples_tan);
+		control_points(path, controlPoints);
+		regular_sampling(controlPoints, delta, samples_pos, samples_tan, tot);
 	}
 
-	static int load(const char * svgFile, const char* terrain_image,race & r) {
-		std::cout << "Loading scene... ";
+	/**
+	 * sample carpath ip of the scene, build its frames and its visibility table for every cameraman.
+	 * Runs on a worker thread: it only writes s.carpaths[ip] and s.visibility[ip], and only reads the terrain.
+	 * @param cameramen position (xyz) and radius (w) of each cameraman
+	 */
+	static void bake_carpath(race_scene& s, unsigned int ip, const std::vector<glm::vec3>& controlPoints, const std::vector<glm::vec4>& cameramen) {
+		std::vector<glm::vec3> samples_pos, samples_tan;
 
-		carousel_loader::r() = &r;
-		int sx, sy,comp;
-		unsigned char* data = stbi_load( terrain_image, &sx, &sy, &comp, 1);
+		// one sample every 33 ms for a lap of a minute
+		{
+			load_profile::phase sampling("bezier sampling");
+			float tot_length = bezier_path::length(controlPoints);
+			float delta = tot_length / 60000 * 33.f;
+			regular_sampling(controlPoints, delta, samples_pos, samples_tan, &tot_length);
+		}
 
-		r._ter.size_pix[0] = sx;
-		r._ter.size_pix[1] = sy;
+		load_profile::phase projection("terrain projection");
+		std::vector<float> xs, zs, heights(samples_pos.size());
+		std::vector<glm::vec2> gradients(samples_pos.size());
+		xz(samples_pos, xs, zs);
+		if (!samples_pos.empty())
+			s.ter.heights(&xs[0], &zs[0], samples_pos.size(), &heights[0], &gradients[0]);
 
-		r._ter.height_field.resize(sx*sy);
-		memcpy_s(&r._ter.height_field[0], sx * sy , data, sx * sy );
+		// the axes lie on the plane tangent to the terrain: backward along the path (z) and sideways (x)
+		std::vector<glm::mat4> frames(samples_pos.size(), glm::mat4(1.f));
+		for (unsigned int i = 0; i < samples_pos.size(); ++i) {
+			frames[i][3] = glm::vec4(xs[i], heights[i], zs[i], 1.0);
+			const glm::vec2& g = gradients[i];
+			glm::vec3 tn = glm::normalize(samples_tan[i]);
+			glm::vec3  z = glm::normalize(glm::vec3(-tn.x, -(g.x * tn.x + g.y * tn.z), -tn.z));
 
-		struct NSVGimage* image;
-		struct ::NSVGrasterizer* rast = ::nsvgCreateRasterizer();
-		image = nsvgParseFromFile(svgFile, "px", 96);
-		//printf("size: %f x %f\n", image->width, image->height);
-		
-		r._bbox.add(glm::vec3(0.f, 0.f, 0.f));
-		r._bbox.add(glm::vec3(image->width, 0.f, image->height));
-		r._ter.rect_xz = glm::vec4(0, 0, image->width, image->height);
+			glm::vec3 d = glm::vec3(-samples_tan[i].z, 0, samples_tan[i].x);
+			d = glm::normalize(d);
+			glm::vec3  x = glm::normalize(glm::vec3(d.x, g.x * d.x + g.y * d.z, d.z));
+			glm::vec3 y = glm::cross(z, x);
+			frames[i][0] = glm::vec4(x, 0); 
+			frames[i][1] = glm::vec4(y, 0);
+			frames[i][2] = glm::vec4(z, 0);
+		}
 
-		for (NSVGshape* shape = image->shapes; shape != NULL; shape = shape->next) {
-			//printf("id %s\n", shape->id);
+		// only the packed frames are kept
+		s.carpaths[ip].pack(frames);
 
-			if (std::string(shape->id).find("tree") != std::string::npos)  
-				push_stick_object(shape->paths, 2.f, r._trees);
-			else
-			if (std::string(shape->id).find("lamp") != std::string::npos) 
-				push_stick_object(shape->paths, 2.f, r._lamps);
-			else
-				if (std::string(shape->id).find("cameraman") != std::string::npos) {
-					size_t pos1 = std::string(shape->id).find_first_of("_")+1;
-					size_t pos2 = std::string(shape->id).find_last_of("_");
-					std::string rad  = std::string(shape->id).substr(pos1 , pos2 - pos1);
-					float radius = (float) atof(rad.c_str());
-					push_cameraman(shape->paths, 15.f, r._cameramen);
+		load_profile::phase visibility("visibility");
+		std::shared_ptr<std::vector<visibility_table> > tables = std::make_shared<std::vector<visibility_table> >(cameramen.size());
+		for (unsigned int ic = 0; ic < cameramen.size(); ++ic)
+			(*tables)[ic].build(s.carpaths[ip], glm::vec3(cameramen[ic]), cameramen[ic].w);
+		s.visibility[ip] = tables;
+	}
+
+	/// the x and z coordinates of the points, in two arrays for terrain::heights
+	static void xz(const std::vector<glm::vec3>& points, std::vector<float>& xs, std::vector<float>& zs) {
+		xs.resize(points.size());
+		zs.resize(points.size());
+		for (size_t i = 0; i < points.size(); ++i) {
+			xs[i] = points[i].x;
+			zs[i] = points[i].z;
+		}
+	}
+
+	/// start baking the carpaths on the worker threads, see race::wait_path
+	static void bake_carpaths(race& r, const std::vector<std::vector<glm::vec3> >& carpaths_points) {
+		race_scene& s = *r._scene;
+		std::vector<glm::vec4> cameramen;
+		for (unsigned int ic = 0; ic < r._cameramen.size(); ++ic)
+			cameramen.push_back(glm::vec4(glm::vec3(r._cameramen[ic].frame[3]), r._cameramen[ic].radius));
+
+		// all the slots are allocated before the tasks start, so that each task writes only its own
+		s.carpaths.resize(carpaths_points.size());
+		s.visibility.assign(carpaths_points.size(), race_scene::visibility_tables());
+		s.carpaths_baked.resize(carpaths_points.size());
+
+		// the tasks keep the scene alive even if the race goes away before they finish
+		std::shared_ptr<race_scene> scene = r._scene;
+		const int profile_parent = load_profile::current();
+		for (unsigned int ip = 0; ip < carpaths_points.size(); ++ip) {
+			if (!parallel()) {
+				load_profile::phase bake("bake_carpath");
+				bake_carpath(s, ip, carpaths_points[ip], cameramen);
+				continue;
+			}
+			std::vector<glm::vec3> controlPoints = carpaths_points[ip];
+			s.carpaths_baked[ip] = thread_pool::global().submit([scene, ip, controlPoints, cameramen, profile_parent]() {
+				load_profile::phase bake("bake_carpath", profile_parent);
+				bake_carpath(*scene, ip, controlPoints, cameramen);
+			}).share();
+		}
+	}
+
+	/// the shapes of the svg the loader uses, see process_shape
+	static bool wanted(const std::string& id) {
+		return id.find("tree") != std::string::npos || id.find("lamp") != std::string::npos ||
+			id.find("cameraman") != std::string::npos || id.find("track") != std::string::npos ||
+			id.find("carpath") != std::string::npos;
+	}
+
+	/// turn a shape of the svg into trees, lamps, cameramen, track curbs or carpath control points
+	static void process_shape(const svg_stream::shape& shape, const terrain& ter, shape_result& out) {
+		//printf("id %s\n", shape.id.c_str());
+
+		if (shape.id.find("tree") != std::string::npos)  
+			push_stick_object(shape.paths[0], 2.f, ter, out.trees);
+		else
+		if (shape.id.find("lamp") != std::string::npos) 
+			push_stick_object(shape.paths[0], 2.f, ter, out.lamps);
+		else
+			if (shape.id.find("cameraman") != std::string::npos) {
+				size_t pos1 = shape.id.find_first_of("_")+1;
+				size_t pos2 = shape.id.find_last_of("_");
+				std::string rad  = shape.id.substr(pos1 , pos2 - pos1);
+				float radius = (float) atof(rad.c_str());
+				push_cameraman(shape.paths[0], 15.f, ter, out.cameramen);
+			}
+		else
+			if (shape.id.find("track") != std::string::npos) {
+				std::vector<glm::vec3> samples_pos, samples_tan;
+				{
+					load_profile::phase sampling("bezier sampling");
+					regular_sampling(shape.paths[0], 0.1f, samples_pos, samples_tan);
+				}
+
+				load_profile::phase projection("terrain projection");
+				std::vector<glm::vec3> curbs[2];
+				for (unsigned int i = 0;i < samples_pos.size();++i) {
+					glm::vec3 d =glm::vec3 (-samples_tan[i].z, 0, samples_tan[i].x);
+					d = glm::normalize(d);
+					curbs[0].push_back(samples_pos[i] + d * 2.f);
+					curbs[1].push_back(samples_pos[i] - d * 2.f);
+				}
+				for (int c = 0; c < 2; ++c) {
+					std::vector<float> xs, zs, heights(curbs[c].size());
+					xz(curbs[c], xs, zs);
+					if (!curbs[c].empty())
+						ter.heights(&xs[0], &zs[0], curbs[c].size(), &heights[0]);
+					for (unsigned int i = 0; i < curbs[c].size(); ++i)
+						out.curbs[c].push_back(glm::vec3(xs[i], heights[i], zs[i]));
 				}
+				
+			}
 			else
-				if (std::string(shape->id).find("track") != std::string::npos) {
-					int ip = 0;
-					std::vector<glm::vec3> samples_pos, samples_tan;
-					regular_sampling(shape->paths, 0.1f, samples_pos, samples_tan);
-
-					for (unsigned int i = 0;i < samples_pos.size();++i) {
-						glm::vec3 d =glm::vec3 (-samples_tan[i].z, 0, samples_tan[i].x);
-						d = glm::normalize(d);
-						r._t.curbs[0].push_back(r._ter.p(samples_pos[i] + d * 2.f));
-						r._t.curbs[1].push_back(r._ter.p(samples_pos[i] - d * 2.f));
+				if (shape.id.find("carpath") != std::string::npos) {
+					for (size_t ip = 0; ip < shape.paths.size(); ++ip) {
+						out.carpaths_points.push_back(std::vector<glm::vec3>());
+						control_points(shape.paths[ip], out.carpaths_points.back());
 					}
-					
 				}
-				else
-					if (std::string(shape->id).find("carpath") != std::string::npos) {
-						int ip = 0;
-						std::vector<glm::vec3> samples_pos, samples_tan;
-						for (NSVGpath* path = shape->paths; path != NULL; path = path->next) {
-							int ip = 0;
-							std::vector<glm::vec3> samples_pos, samples_tan;
-
-							float tot_length;
-							regular_sampling(shape->paths, 1.f, samples_pos, samples_tan, &tot_length);
-							samples_pos.clear();
-							samples_tan.clear();
-
-							float delta = tot_length / 60000 * 33.f;
-							regular_sampling(shape->paths, delta, samples_pos, samples_tan, &tot_length);
-
-							r.carpaths.push_back(::path());
-							for (unsigned int i = 0; i < samples_pos.size(); ++i) {
-								r.carpaths.back().frames.push_back(glm::mat4(1.f));
-								r.carpaths.back().frames.back()[3] = glm::vec4(r._ter.p(samples_pos[i]), 1.0);
-								glm::vec3 tn = glm::normalize(samples_tan[i]);
-								glm::vec3  z = glm::normalize(r._ter.p(samples_pos[i] - tn) -  r._ter.p(samples_pos[i]));
-
-								glm::vec3 d = glm::vec3(-samples_tan[i].z, 0, samples_tan[i].x);
-								d = glm::normalize(d);
-								glm::vec3  x = glm::normalize(r._ter.p(samples_pos[i] + d) - r._ter.p(samples_pos[i]));
-								glm::vec3 y = glm::cross(z, x);
-								r.carpaths.back().frames.back()[0] = glm::vec4(x, 0); 
-								r.carpaths.back().frames.back()[1] = glm::vec4(y, 0);
-								r.carpaths.back().frames.back()[2] = glm::vec4(z, 0);
-
-							}
-
-							//
-						}
+	}
 
-					}
+	/**
+	 * load the scene of r from an svg file and a terrain image, or a tiled height field (a ".tiles" file, see terrain_tiles).
+	 * @param use_cache use the binary cache next to the svg file (svgFile + ".cache"), if it is there and matches the
+	 * inputs, instead of processing them. If it does not, it is rewritten in background once the carpaths are baked
+	 * @param keep if given, gets the shapes and their results, see scene_watch::watch
+	 */
+	static int load(const char * svgFile, const char* terrain_image,race & r, bool use_cache = true, loaded_shapes* keep = 0) {
+		std::cout << "Loading scene... ";
+		load_profile::phase loading("carousel_loader::load");
+
+		carousel_loader::r() = &r;
+		if (keep)
+			*keep = loaded_shapes();
+
+		const std::string cache_file = std::string(svgFile) + ".cache";
+		unsigned long long key = 0;
+		{
+			load_profile::phase cache("scene_cache::load");
+			std::vector<std::string> inputs;
+			inputs.push_back(svgFile);
+			inputs.push_back(terrain_image);
+			key = use_cache ? scene_cache::hash_files(inputs) : 0;
+			if (key) {
+				cache.read_file(svgFile);
+				cache.read(scene_cache::is_tiled(terrain_image) ? (unsigned long long)terrain_tiles::HEADER_BYTES : load_profile::file_size(terrain_image));
+			}
+			if (key && scene_cache::load(cache_file.c_str(), key, r)) {
+				cache.read_file(cache_file.c_str());
+				std::cout << "done (from " << cache_file << ")" << std::endl;
+				return 1;
+			}
+		}
+
+		// a fresh scene: r may be a copy sharing the scene of another race
+		r._scene = std::make_shared<race_scene>();
+		race_scene& s = *r._scene;
+		{
+			load_profile::phase decode("terrain");
+			// a tiled height field is opened, not read: its tiles are mapped when the terrain is sampled
+			if (scene_cache::is_tiled(terrain_image)) {
+				s.ter.set_tiles(terrain_image);
+				decode.read(terrain_tiles::HEADER_BYTES);
+			}
+			else {
+				int sx, sy,comp;
+				unsigned char* data = stbi_load( terrain_image, &sx, &sy, &comp, 1);
+				decode.read_file(terrain_image);
+
+				s.ter.set_height_field(data, sx, sy);
+				stbi_image_free(data);
+			}
+		}
+
+		// only the shapes the loader uses are extracted, the svg is never held in memory as a whole
+		svg_stream::image image;
+		{
+			load_profile::phase parse("svg parse");
+			svg_stream::parse(svgFile, wanted, image, 96.f);
+			parse.read_file(svgFile);
+		}
+		//printf("size: %f x %f\n", image.width, image.height);
+		
+		s.bbox.add(glm::vec3(0.f, 0.f, 0.f));
+		s.bbox.add(glm::vec3(image.width, 0.f, image.height));
+		s.ter.rect_xz = glm::vec4(0, 0, image.width, image.height);
+
+		// the shapes are independent: they are processed concurrently, then merged in the order of the svg
+		// so that the scene does not depend on the scheduling
+		const std::vector<svg_stream::shape>& shapes = image.shapes;
+		std::vector<shape_result> results(shapes.size());
+		{
+			load_profile::phase shaping("shapes");
+			if (parallel())
+				thread_pool::global().parallel_for(shapes.size(), [&](size_t i) {
+					load_profile::phase shape("process_shape", shaping.id);
+					process_shape(shapes[i], s.ter, results[i]);
+				});
+			else
+				for (size_t i = 0; i < shapes.size(); ++i) {
+					load_profile::phase shape("process_shape");
+					process_shape(shapes[i], s.ter, results[i]);
+				}
+		}
+
+		std::vector<std::vector<glm::vec3> > carpaths_points;
+		std::vector<stick_object> trees, lamps;
+		std::vector<glm::vec3> curbs[2];
+		for (size_t i = 0; i < results.size(); ++i) {
+			const shape_result& sr = results[i];
+			trees.insert(trees.end(), sr.trees.begin(), sr.trees.end());
+			lamps.insert(lamps.end(), sr.lamps.begin(), sr.lamps.end());
+			r._cameramen.insert(r._cameramen.end(), sr.cameramen.begin(), sr.cameramen.end());
+			for (int c = 0; c < 2; ++c)
+				curbs[c].insert(curbs[c].end(), sr.curbs[c].begin(), sr.curbs[c].end());
+			carpaths_points.insert(carpaths_points.end(), sr.carpaths_points.begin(), sr.carpaths_points.end());
+		}
+		s.trees.assign(std::move(trees));
+		s.lamps.assign(std::move(lamps));
+		for (int c = 0; c < 2; ++c)
+			s.t.curbs[c].assign(std::move(curbs[c]));
+
+		// carpaths need all the cameramen, so they are baked once the whole svg has been read.
+		// The bake_carpath phases end after load returns
+		bake_carpaths(r, carpaths_points);
+		r.forget_near();
+
+		if (keep) {
+			keep->image = std::move(image);
+			keep->results = std::move(results);
+			keep->parsed = true;
+		}
+
+		// the copy shares the scene with r
+		if (key) {
+			race baked = r;
+			const int profile_parent = loading.id;
+			thread_pool::global().submit([baked, cache_file, key, profile_parent]() {
+				baked.wait_paths();
+				load_profile::phase save("scene_cache::save", profile_parent);
+				scene_cache::save(cache_file.c_str(), key, baked);
+			});
 		}
 
 		std::cout << "done" << std::endl;
-		nsvgDelete(image);
 		return 1;
 	}
 };
\ No newline at end of file
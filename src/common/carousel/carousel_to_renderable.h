@@ -2,6 +2,7 @@
 
 #include "..\renderable.h"
 #include "carousel.h"
+#include "terrain_mesh.h"
 
 
 
@@ -24,7 +25,7 @@ struct game_to_renderable {
 		r_t.add_vertex_attribute<float>(&buffer_pos[0], static_cast<unsigned int>(buffer_pos.size()), 0, 3);
 	}
 
-	static void to_stick_object(const std::vector<stick_object>& vec, renderable& r_t) {
+	static void to_stick_object(const shared_array<stick_object>& vec, renderable& r_t) {
 
 		std::vector<float> buffer_pos;
 		buffer_pos.resize((vec.size()*2) * 3 );
@@ -46,35 +47,25 @@ struct game_to_renderable {
 
 
 
-	static void to_heightfield(const race& r, renderable& r_hf) {
-		std::vector<unsigned int > buffer_id;
-		const unsigned int& Z =static_cast<unsigned int>(r.ter().size_pix[1]);
-		const unsigned int& X =static_cast<unsigned int>(r.ter().size_pix[0]);
+	/// the full resolution mesh of the terrain (see terrain_mesh): position, normal and texture coordinates
+	/// interleaved in one buffer, at attributes 0, 2 and 4
+	static void to_heightfield(const race& r, renderable& r_hf, float tiles) {
+		std::vector<float> vertices;
+		std::vector<unsigned int> indices;
+		terrain_mesh::vertices(r.ter(), tiles, vertices);
+		terrain_mesh::indices(r.ter(), indices);
 
-		terrain ter = r.ter();
-
-		std::vector<float>   hf3d;
-		for (unsigned int iz = 0; iz < Z; ++iz)
-			for (unsigned int ix = 0; ix < X; ++ix) {
-				hf3d.push_back(ter.rect_xz[0] + (ix / float(X)) * ter.rect_xz[2]);
-				hf3d.push_back(r.ter().hf(ix, iz));
-				hf3d.push_back(ter.rect_xz[1] + (iz / float(Z)) * ter.rect_xz[3]);
-			}
-
-		for (unsigned int iz = 0; iz < Z-1; ++iz)
-			for (unsigned int ix = 0; ix < X-1; ++ix) {
-				
-				buffer_id.push_back((iz * Z) + ix);
-				buffer_id.push_back((iz * Z) + ix + 1);
-				buffer_id.push_back((iz + 1) * Z + ix + 1);
-
-				buffer_id.push_back((iz * Z) + ix);
-				buffer_id.push_back((iz + 1) * Z + ix + 1);
-				buffer_id.push_back((iz + 1) * Z + ix);
-			}
-
-		r_hf.add_vertex_attribute<float>(&hf3d[0], X * Z * 3, 0, 3);
-		r_hf.add_indices<unsigned int>(&buffer_id[0], static_cast<unsigned int>(buffer_id.size()), GL_TRIANGLES);
+		GLuint vbo;
+		glBindVertexArray(r_hf.vao);
+		glGenBuffers(1, &vbo);
+		glBindBuffer(GL_ARRAY_BUFFER, vbo);
+		glBufferData(GL_ARRAY_BUFFER, sizeof(float) * vertices.size(), &vertices[0], GL_STATIC_DRAW);
+		const unsigned int stride = sizeof(float) * terrain_mesh::FLOATS;
+		const unsigned int n = static_cast<unsigned int>(vertices.size() / terrain_mesh::FLOATS);
+		r_hf.assign_vertex_attribute(vbo, n, 0, 3, GL_FLOAT, stride, 0);
+		r_hf.assign_vertex_attribute(vbo, n, 2, 3, GL_FLOAT, stride, sizeof(float) * 3);
+		r_hf.assign_vertex_attribute(vbo, n, 4, 2, GL_FLOAT, stride, sizeof(float) * 6);
+		r_hf.add_indices<unsigned int>(&indices[0], static_cast<unsigned int>(indices.size()), GL_TRIANGLES);
 	}
 
 };
\ No newline at end of file
@@ -0,0 +1,259 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <limits>
+#include <glm/glm.hpp>
+#include "..\thread_pool.h"
+#include "carousel.h"
+#include "scene_watch.h"
+
+/**
+	Ray queries against the terrain mesh (the triangles of terrain_mesh: vertex (ix, iz) at height hf(ix, iz), the cells
+	split along the diagonal from (ix, iz) to (ix + 1, iz + 1)), for picking, ground collision and line of sight.
+
+	Level 0 of the pyramid keeps, for every cell of the mesh, the largest byte of its four vertices; every level above
+	keeps the largest of 2x2 cells of the one below, up to a level of a single cell. Cell (ci, cj) of a level comes at
+	ci * cells in z + cj, the order in which the height field keeps the vertices. A ray walks the cells of a level
+	and only goes down into the cells its segment gets below the top of; at level 0 it is intersected with the two
+	triangles of the cell, so the hits are those of the mesh that is drawn. The pyramid takes about 4/3 of a byte per texel.
+
+	The terrain is copied into the pyramid, which shares its height field (see terrain), so the queries need nothing else.
+*/
+struct height_pyramid {
+
+	void build(const terrain& ter) {
+		_ter = ter;
+		const int X = ter.size_pix[0], Z = ter.size_pix[1];
+		_levels.clear();
+		_size.clear();
+		_size.push_back(glm::ivec2(std::max(X - 1, 1), std::max(Z - 1, 1)));
+		_levels.push_back(std::vector<unsigned char>(size_t(_size[0].x) * _size[0].y));
+
+		// level 0, a column of cells per task: in memory the vertices (ix, 0..Z-1) are a line of the image (see terrain::hf)
+		thread_pool::global().parallel_for(_size[0].x, [&](size_t ci) {
+			cells(int(ci), 0, _size[0].y - 1);
+		}, 16);
+
+		while (_size.back().x > 1 || _size.back().y > 1) {
+			const glm::ivec2 below = _size.back();
+			_size.push_back(glm::ivec2((below.x + 1) / 2, (below.y + 1) / 2));
+			_levels.push_back(std::vector<unsigned char>(size_t(_size.back().x) * _size.back().y));
+			merge(int(_levels.size()) - 1, glm::ivec4(0, 0, _size.back().x - 1, _size.back().y - 1));
+		}
+	}
+
+	/**
+	 * compute again the cells of the vertices whose height a reload changed, and the cells above them. The pyramid is
+	 * built again if the size or the rectangle of the terrain changed
+	 */
+	void update(const terrain& ter, const scene_watch::changes& changes) {
+		if (_levels.empty() || ter.size_pix != _ter.size_pix || ter.rect_xz != _ter.rect_xz) {
+			build(ter);
+			return;
+		}
+		_ter = ter;
+		const glm::ivec4 v = changes.vertices(ter.size_pix[0], ter.size_pix[1]);
+		if (v[0] > v[2])
+			return;
+
+		// the cells on both sides of a vertex have it as a corner
+		glm::ivec4 c(std::max(v[0] - 1, 0), std::max(v[1] - 1, 0), std::min(v[2], _size[0].x - 1), std::min(v[3], _size[0].y - 1));
+		for (int ci = c[0]; ci <= c[2]; ++ci)
+			cells(ci, c[1], c[3]);
+		for (int l = 1; l < int(_levels.size()); ++l) {
+			c = glm::ivec4(c[0] / 2, c[1] / 2, c[2] / 2, c[3] / 2);
+			merge(l, c);
+		}
+	}
+
+	/// number of levels, level 0 included
+	int levels() const { return int(_levels.size()); }
+
+	/// bytes taken by the levels
+	size_t bytes() const {
+		size_t n = 0;
+		for (size_t l = 0; l < _levels.size(); ++l)
+			n += _levels[l].size();
+		return n;
+	}
+
+	/**
+	 * first intersection of the ray o + t d, with t in [0, t_max], with the terrain mesh. On a hit t is set.
+	 * d does not need to be normalized: t is in units of d
+	 */
+	bool ray(glm::vec3 o, glm::vec3 d, float t_max, float& t) const {
+		if (_levels.empty())
+			return false;
+		const int X = _ter.size_pix[0], Z = _ter.size_pix[1];
+
+		// in the space of the grid, where cell (ci, cj) spans [ci, ci + 1] x [cj, cj + 1] in x and z; t is unchanged
+		const float sx = X / _ter.rect_xz[2], sz = Z / _ter.rect_xz[3];
+		const glm::vec3 O((o.x - _ter.rect_xz[0]) * sx, o.y, (o.z - _ter.rect_xz[1]) * sz);
+		const glm::vec3 D(d.x * sx, d.y, d.z * sz);
+
+		// clip to the box of the grid, below the highest vertex
+		float t0 = 0.f, t1 = t_max;
+		const float top = _levels.back()[0] / 50.f;
+		if (!slab(O.x, D.x, 0.f, float(X - 1), t0, t1) || !slab(O.z, D.z, 0.f, float(Z - 1), t0, t1) ||
+			!slab(O.y, D.y, -std::numeric_limits<float>::infinity(), top, t0, t1))
+			return false;
+
+		// a step along the ray of a thousandth of a cell, to get into the next cell past a border
+		const float probe = 1e-3f / std::max(std::max(fabsf(D.x), fabsf(D.z)), 1e-6f);
+		const int top_level = int(_levels.size()) - 1;
+		int level = top_level;
+		float tc = t0;
+		while (tc <= t1) {
+			const int s = 1 << level;
+			const glm::ivec2& size = _size[level];
+			const float tp = std::min(tc + probe, t1);
+			const int ci = std::min(std::max(int(floorf((O.x + D.x * tp) / s)), 0), size.x - 1);
+			const int cj = std::min(std::max(int(floorf((O.z + D.z * tp) / s)), 0), size.y - 1);
+
+			// where the ray leaves the cell
+			float t_exit = t1;
+			if (D.x > 0.f) t_exit = std::min(t_exit, ((ci + 1) * s - O.x) / D.x);
+			if (D.x < 0.f) t_exit = std::min(t_exit, (ci * s - O.x) / D.x);
+			if (D.z > 0.f) t_exit = std::min(t_exit, ((cj + 1) * s - O.z) / D.z);
+			if (D.z < 0.f) t_exit = std::min(t_exit, (cj * s - O.z) / D.z);
+			t_exit = std::max(t_exit, tp);
+
+			// the segment is linear in y, so it is lowest at one of its ends
+			const float h = _levels[level][size_t(ci) * size.y + cj] / 50.f;
+			if (std::min(O.y + D.y * tc, O.y + D.y * t_exit) <= h) {
+				if (level > 0) {
+					--level;
+					continue;
+				}
+				if (cell(ci, cj, o, d, t0, t1, t))
+					return true;
+			}
+			else
+				level = std::min(level + 1, top_level);
+			if (t_exit >= t1)
+				break;
+			tc = t_exit;
+		}
+		return false;
+	}
+
+	/// ray() of n rays: t[i] is the hit of ray i, or a negative value if it misses. Runs on the global thread pool
+	void rays(const glm::vec3* o, const glm::vec3* d, size_t n, float t_max, float* t) const {
+		thread_pool::global().parallel_for(n, [&](size_t i) {
+			if (!ray(o[i], d[i], t_max, t[i]))
+				t[i] = -1.f;
+		}, 256);
+	}
+
+	/// true if no triangle of the terrain is between a and b
+	bool visible(glm::vec3 a, glm::vec3 b) const {
+		float t;
+		return !ray(a, b - a, 1.f, t);
+	}
+
+	/// height of the terrain mesh at (x, z), false outside the terrain
+	bool height(float x, float z, float& y) const {
+		const int X = _ter.size_pix[0], Z = _ter.size_pix[1];
+		const float gx = (x - _ter.rect_xz[0]) * X / _ter.rect_xz[2], gz = (z - _ter.rect_xz[1]) * Z / _ter.rect_xz[3];
+		if (_levels.empty() || !(gx >= 0.f && gx <= X - 1 && gz >= 0.f && gz <= Z - 1))
+			return false;
+		const int ci = std::min(int(gx), X - 2), cj = std::min(int(gz), Z - 2);
+		const float u = gx - ci, v = gz - cj;
+		const float h00 = byte(ci, cj) / 50.f, h10 = byte(ci + 1, cj) / 50.f;
+		const float h01 = byte(ci, cj + 1) / 50.f, h11 = byte(ci + 1, cj + 1) / 50.f;
+		y = (u >= v) ? h00 + u * (h10 - h00) + v * (h11 - h10) : h00 + v * (h01 - h00) + u * (h11 - h01);
+		return true;
+	}
+
+private:
+	terrain _ter;
+	std::vector<std::vector<unsigned char> > _levels;
+	std::vector<glm::ivec2> _size;
+
+	/// compute the cells (ci, cj0..cj1) of level 0 from the vertices of the terrain
+	void cells(int ci, int cj0, int cj1) {
+		const int X = _ter.size_pix[0], Z = _ter.size_pix[1];
+		unsigned char* out = &_levels[0][size_t(ci) * _size[0].y];
+		const unsigned char* data = _ter.tiles ? 0 : _ter.height_field.get();
+		if (data && X > 1 && Z > 1) {
+			const unsigned char* a = data + size_t(X - 1 - ci) * X, * b = a - X;
+			for (int cj = cj0; cj <= cj1; ++cj)
+				out[cj] = std::max(std::max(a[cj], a[cj + 1]), std::max(b[cj], b[cj + 1]));
+		}
+		else
+			for (int cj = cj0; cj <= cj1; ++cj)
+				out[cj] = std::max(std::max(byte(ci, cj), byte(ci + 1, cj)), std::max(byte(ci, cj + 1), byte(ci + 1, cj + 1)));
+	}
+
+	/// compute the cells (ci0, cj0) to (ci1, cj1) of level l, given as (ci0, cj0, ci1, cj1), from the 2x2 cells below
+	void merge(int l, glm::ivec4 c) {
+		const glm::ivec2 below = _size[l - 1], s = _size[l];
+		const std::vector<unsigned char>& b = _levels[l - 1];
+		std::vector<unsigned char>& out = _levels[l];
+		for (int ci = c[0]; ci <= c[2]; ++ci)
+			for (int cj = c[1]; cj <= c[3]; ++cj) {
+				const int i0 = 2 * ci, i1 = std::min(2 * ci + 1, below.x - 1);
+				const int j0 = 2 * cj, j1 = std::min(2 * cj + 1, below.y - 1);
+				out[size_t(ci) * s.y + cj] = std::max(std::max(b[size_t(i0) * below.y + j0], b[size_t(i0) * below.y + j1]),
+					std::max(b[size_t(i1) * below.y + j0], b[size_t(i1) * below.y + j1]));
+			}
+	}
+
+	/// byte of vertex (ix, iz), clamped to the terrain, see terrain::hf
+	unsigned char byte(int ix, int iz) const {
+		ix = std::min(std::max(ix, 0), _ter.size_pix[0] - 1);
+		iz = std::min(std::max(iz, 0), _ter.size_pix[1] - 1);
+		return _ter.texel(_ter.size_pix[0] - 1 - ix, iz);
+	}
+
+	/// vertex (ix, iz) of the mesh, as terrain_mesh::vertex
+	glm::vec3 vertex(int ix, int iz) const {
+		return glm::vec3(_ter.rect_xz[0] + (ix / float(_ter.size_pix[0])) * _ter.rect_xz[2], byte(ix, iz) / 50.f,
+			_ter.rect_xz[1] + (iz / float(_ter.size_pix[1])) * _ter.rect_xz[3]);
+	}
+
+	/// intersect the interval [t0, t1] of the ray with the slab [lo, hi] of one axis
+	static bool slab(float o, float d, float lo, float hi, float& t0, float& t1) {
+		if (d == 0.f)
+			return o >= lo && o <= hi;
+		float ta = (lo - o) / d, tb = (hi - o) / d;
+		if (ta > tb)
+			std::swap(ta, tb);
+		t0 = std::max(t0, ta);
+		t1 = std::min(t1, tb);
+		return t0 <= t1;
+	}
+
+	/// nearest hit in [t0, t1] of the ray with the two triangles of cell (ci, cj)
+	bool cell(int ci, int cj, glm::vec3 o, glm::vec3 d, float t0, float t1, float& t) const {
+		const glm::vec3 p00 = vertex(ci, cj), p10 = vertex(ci + 1, cj), p01 = vertex(ci, cj + 1), p11 = vertex(ci + 1, cj + 1);
+		float ta, tb;
+		const bool a = triangle(o, d, p00, p10, p11, ta) && ta >= t0 && ta <= t1;
+		const bool b = triangle(o, d, p00, p11, p01, tb) && tb >= t0 && tb <= t1;
+		if (!a && !b)
+			return false;
+		t = (a && b) ? std::min(ta, tb) : (a ? ta : tb);
+		return true;
+	}
+
+	/// Moller-Trumbore, both sides
+	static bool triangle(glm::vec3 o, glm::vec3 d, glm::vec3 p0, glm::vec3 p1, glm::vec3 p2, float& t) {
+		const glm::vec3 e1 = p1 - p0, e2 = p2 - p0;
+		const glm::vec3 p = glm::cross(d, e2);
+		const float det = glm::dot(e1, p);
+		if (fabsf(det) < 1e-12f)
+			return false;
+		const float inv = 1.f / det;
+		const glm::vec3 s = o - p0;
+		const float u = glm::dot(s, p) * inv;
+		if (u < 0.f || u > 1.f)
+			return false;
+		const glm::vec3 q = glm::cross(s, e1);
+		const float v = glm::dot(d, q) * inv;
+		if (v < 0.f || u + v > 1.f)
+			return false;
+		t = glm::dot(e2, q) * inv;
+		return true;
+	}
+};
@@ -0,0 +1,114 @@
+#pragma once
+
+#include <vector>
+#include <glm/glm.hpp>
+#include <glm/ext.hpp>
+#include <glm/gtc/quaternion.hpp>
+#include "shared_array.h"
+
+/**
+	a path sample in 14 bytes instead of the 64 of a glm::mat4: the position is quantized on 16 bits per axis
+	within the bounding box of the path, the orientation is a unit quaternion quantized on 16 bits per component.
+*/
+struct packed_frame {
+	unsigned short pos[3];
+	short rot[4];
+};
+
+/**
+	a carpath: the frames of a car running along it, one every 1/30 of second.
+	Frames are stored packed; frame(i) decodes sample i, frame(i, u) interpolates between sample i and the next one.
+	The frames are orthonormal, with the same x (side), y (up) and z (back) axes of the frames they were built from.
+*/
+struct path {
+	path() :origin(0.f), step(0.f), T(0) {}
+
+	// store one frame every 1/30 of second
+	// frame(i) is the frame at time i* (1000.f/30.0) in milliseconds. They may be in the mapping of a scene_cache
+	shared_array<packed_frame> samples;
+
+	/// quantization box: position = origin + pos * step
+	glm::vec3 origin, step;
+
+	int T; // how many milliseconds for a lap to complete
+
+	/// number of samples
+	size_t size() const { return samples.size(); }
+
+	/// replace the samples with the (packed) given frames
+	void pack(const std::vector<glm::mat4>& frames) {
+		std::vector<packed_frame> packed(frames.size());
+		if (frames.empty()) {
+			samples.assign(std::move(packed));
+			return;
+		}
+
+		glm::vec3 mi = glm::vec3(frames[0][3]), ma = mi;
+		for (size_t i = 1; i < frames.size(); ++i) {
+			mi = glm::min(mi, glm::vec3(frames[i][3]));
+			ma = glm::max(ma, glm::vec3(frames[i][3]));
+		}
+		origin = mi;
+		step = (ma - mi) / 65535.f;
+
+		glm::quat prev(1.f, 0.f, 0.f, 0.f);
+		for (size_t i = 0; i < frames.size(); ++i) {
+			packed_frame& pf = packed[i];
+			glm::vec3 p = glm::vec3(frames[i][3]) - origin;
+			for (int c = 0; c < 3; ++c)
+				pf.pos[c] = (step[c] > 0.f) ? (unsigned short)glm::clamp(p[c] / step[c] + 0.5f, 0.f, 65535.f) : 0;
+
+			// orthonormalize keeping z, so the frame is a rotation
+			glm::vec3 z = glm::normalize(glm::vec3(frames[i][2]));
+			glm::vec3 x = glm::normalize(glm::vec3(frames[i][0]) - z * glm::dot(glm::vec3(frames[i][0]), z));
+			glm::vec3 y = glm::cross(z, x);
+			glm::quat q = glm::quat_cast(glm::mat3(x, y, z));
+
+			// consecutive quaternions on the same hemisphere, so that interpolating them takes the short way
+			if (glm::dot(q, prev) < 0.f)
+				q = -q;
+			prev = q;
+			for (int c = 0; c < 4; ++c)
+				pf.rot[c] = (short)floor(glm::clamp(q[c], -1.f, 1.f) * 32767.f + 0.5f);
+		}
+		samples.assign(std::move(packed));
+	}
+
+	glm::vec3 position(size_t i) const {
+		const packed_frame& pf = samples[i];
+		return origin + step * glm::vec3(pf.pos[0], pf.pos[1], pf.pos[2]);
+	}
+
+	glm::quat rotation(size_t i) const {
+		const packed_frame& pf = samples[i];
+		glm::quat q;
+		for (int c = 0; c < 4; ++c)
+			q[c] = pf.rot[c] / 32767.f;
+		return q;
+	}
+
+	/// frame of sample i
+	glm::mat4 frame(size_t i) const {
+		return to_mat4(position(i), glm::normalize(rotation(i)));
+	}
+
+	/// frame at u (in [0,1)) of the way between sample i and sample i+1. The path is closed, the last sample is followed by the first
+	glm::mat4 frame(size_t i, float u) const {
+		size_t j = (i + 1 == samples.size()) ? 0 : i + 1;
+		glm::vec3 p = glm::mix(position(i), position(j), u);
+		glm::quat qi = rotation(i), qj = rotation(j);
+		if (glm::dot(qi, qj) < 0.f)  // only across the seam of the loop
+			qj = -qj;
+		return to_mat4(p, glm::normalize(qi * (1.f - u) + qj * u));
+	}
+
+	/// memory taken by the samples, in bytes
+	size_t bytes() const { return samples.size() * sizeof(packed_frame); }
+
+private:
+	static glm::mat4 to_mat4(const glm::vec3& p, const glm::quat& q) {
+		glm::mat4 F = glm::mat4_cast(q);
+		F[3] = glm::vec4(p, 1.f);
+		return F;
+	}
+};
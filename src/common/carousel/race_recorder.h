@@ -0,0 +1,528 @@
+#pragma once
+
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+#include <glm/glm.hpp>
+#include <glm/ext.hpp>
+#include <glm/gtc/quaternion.hpp>
+#include "carousel.h"
+
+/** @name Race recording
+ *
+	A recording is a header followed by one record per race update and, if the recording was closed properly,
+	an index of the keyframes. All the values are stored in the byte order of the machine that wrote them.
+
+	header    "CRRC" u32 version, u32 keyframe_every, f32 pos_step, u32 reserved[2]
+	record    u8 type (1 keyframe, 2 delta), u32 payload bytes, payload
+	keyframe  i64 t, f32 sun[3], u32 n_cars, n_cars x (i32 pos[3], i16 rot[4]), u32 n_cameramen, n_cameramen x i32 target
+	delta     i64 t, f32 sun[3], n_cars x varint (pos[3], rot[4]) differences, u32 n_events, n_events x (u32 cameraman, i32 target)
+	index     n x (i64 t, u64 offset of the keyframe), u32 n, "CRIX"
+
+	Positions are quantized with step pos_step, orientations as unit quaternions on 16 bits per component (as in
+	packed_frame). Deltas are taken from the quantized values of the previous record, so errors do not accumulate.
+	Differences are zigzag varints, 7 bits per byte: one byte for a difference in [-64, 63], as the motion of a car
+	between two updates usually is, two bytes up to [-8192, 8191].
+	A target of -1 means unlocked; a delta record lists only the cameramen whose target changed.
+*/
+//@{
+
+/// one record of a recording, as decoded by race_reader
+struct race_record {
+	/// milliseconds since the start of the race
+	long long t;
+
+	glm::vec3 sunlight_direction;
+
+	/// frame of each car
+	std::vector<glm::mat4> car_frames;
+
+	/// car followed by each cameraman, -1 if unlocked
+	std::vector<int> targets;
+
+	/// (cameraman, new target) for the locks that changed since the previous record
+	std::vector<glm::ivec2> lock_events;
+};
+
+/// quantization shared by race_recorder and race_reader
+struct race_codec {
+	enum { KEYFRAME = 1, DELTA = 2, VERSION = 1 };
+
+	/// quantized frame of a car
+	struct qframe {
+		int pos[3];
+		short rot[4];
+	};
+
+	static qframe quantize(const glm::mat4& F, float pos_step, const qframe& prev) {
+		qframe q;
+		for (int c = 0; c < 3; ++c)
+			q.pos[c] = (int)floor(F[3][c] / pos_step + 0.5f);
+		glm::quat r = glm::quat_cast(glm::mat3(F));
+
+		// on the same hemisphere of the previous one, so that the differences are small
+		float d = 0.f;
+		for (int c = 0; c < 4; ++c)
+			d += r[c] * prev.rot[c];
+		if (d < 0.f)
+			r = -r;
+		for (int c = 0; c < 4; ++c)
+			q.rot[c] = (short)floor(glm::clamp(r[c], -1.f, 1.f) * 32767.f + 0.5f);
+		return q;
+	}
+
+	static glm::mat4 frame(const qframe& q, float pos_step) {
+		glm::quat r;
+		for (int c = 0; c < 4; ++c)
+			r[c] = q.rot[c] / 32767.f;
+		glm::mat4 F = glm::mat4_cast(glm::normalize(r));
+		F[3] = glm::vec4(q.pos[0] * pos_step, q.pos[1] * pos_step, q.pos[2] * pos_step, 1.f);
+		return F;
+	}
+
+	static void put_varint(std::vector<char>& b, int v) {
+		unsigned int z = ((unsigned int)v << 1) ^ (unsigned int)(v >> 31);
+		while (z >= 0x80) {
+			b.push_back(char((z & 0x7f) | 0x80));
+			z >>= 7;
+		}
+		b.push_back(char(z));
+	}
+
+	static int get_varint(const char*& p) {
+		unsigned int z = 0;
+		for (int shift = 0; ; shift += 7) {
+			unsigned char c = (unsigned char)*p++;
+			z |= (unsigned int)(c & 0x7f) << shift;
+			if (!(c & 0x80))
+				break;
+		}
+		return int(z >> 1) ^ -int(z & 1);
+	}
+
+	template <class T>
+	static void put(std::vector<char>& b, const T& v) {
+		b.insert(b.end(), (const char*)&v, (const char*)&v + sizeof(T));
+	}
+
+	template <class T>
+	static T get(const char*& p) {
+		T v;
+		memcpy(&v, p, sizeof(T));
+		p += sizeof(T);
+		return v;
+	}
+};
+
+/**
+	Records a race to a file. Attach it with race::set_observer: every update is encoded on the calling thread, which
+	only costs a few bytes per car, and the encoded blocks are written to disk by a thread of the recorder, so the
+	render loop never waits for the disk.
+	With the level of detail of the race on, the frames of the far cars are recorded as they are, i.e. some updates old.
+*/
+struct race_recorder : public race_observer {
+	race_recorder() :f(0), keyframe_every(30), pos_step(1.f / 256.f), n_records(0), offset(0), stopping(false) {}
+	~race_recorder() { close(); }
+
+	/**
+	 * start recording to a file
+	 * @param keyframe_every one keyframe every this many records, seeks decode at most this many records
+	 * @param pos_step quantization step of the positions, in scene units
+	 */
+	bool open(const char* filename, unsigned int _keyframe_every = 30, float _pos_step = 1.f / 256.f) {
+		close();
+		f = fopen(filename, "wb");
+		if (!f)
+			return false;
+		keyframe_every = std::max(1u, _keyframe_every);
+		pos_step = _pos_step;
+		n_records = 0;
+		index.clear();
+		prev.clear();
+		prev_targets.clear();
+		stopping = false;
+
+		block.clear();
+		block.insert(block.end(), "CRRC", "CRRC" + 4);
+		race_codec::put(block, (unsigned int)race_codec::VERSION);
+		race_codec::put(block, keyframe_every);
+		race_codec::put(block, pos_step);
+		race_codec::put(block, 0u);
+		race_codec::put(block, 0u);
+		offset = block.size();
+		flush_block();
+
+		writer = std::thread(&race_recorder::write_loop, this);
+		return true;
+	}
+
+	bool is_open() const { return f != 0; }
+
+	/// write the index and close the file. Waits for the pending blocks to be written
+	void close() {
+		if (!f)
+			return;
+		for (size_t i = 0; i < index.size(); ++i) {
+			race_codec::put(block, index[i].first);
+			race_codec::put(block, index[i].second);
+		}
+		race_codec::put(block, (unsigned int)index.size());
+		block.insert(block.end(), "CRIX", "CRIX" + 4);
+		flush_block();
+		{
+			std::lock_guard<std::mutex> lock(m);
+			stopping = true;
+		}
+		cv.notify_one();
+		writer.join();
+		fclose(f);
+		f = 0;
+	}
+
+	/// bytes encoded so far
+	unsigned long long bytes() const { return offset; }
+
+	/// records encoded so far
+	unsigned long long records() const { return n_records; }
+
+	void updated(const race& r) {
+		if (!f)
+			return;
+		const car_pool& pool = r.pool();
+		const std::vector<cameraman>& cms = r.cameramen();
+
+		// a keyframe every keyframe_every records, or when cars or cameramen have been added
+		bool key = (n_records % keyframe_every == 0) || prev.size() != pool.size() || prev_targets.size() != cms.size();
+		if (key)
+			index.push_back(std::make_pair(r.elapsed(), offset));
+
+		record.clear();
+		race_codec::put(record, r.elapsed());
+		race_codec::put(record, r.sunlight_direction());
+		if (key) {
+			race_codec::put(record, (unsigned int)pool.size());
+			prev.resize(pool.size());
+			for (size_t i = 0; i < pool.size(); ++i) {
+				race_codec::qframe q = race_codec::quantize(pool.frames[i], pos_step, prev[i]);
+				race_codec::put(record, q.pos);
+				race_codec::put(record, q.rot);
+				prev[i] = q;
+			}
+			race_codec::put(record, (unsigned int)cms.size());
+			prev_targets.resize(cms.size());
+			for (size_t ic = 0; ic < cms.size(); ++ic) {
+				prev_targets[ic] = cms[ic].is_locked() ? cms[ic].target() : -1;
+				race_codec::put(record, prev_targets[ic]);
+			}
+		}
+		else {
+			for (size_t i = 0; i < pool.size(); ++i) {
+				race_codec::qframe q = race_codec::quantize(pool.frames[i], pos_step, prev[i]);
+				for (int c = 0; c < 3; ++c)
+					race_codec::put_varint(record, q.pos[c] - prev[i].pos[c]);
+				for (int c = 0; c < 4; ++c)
+					race_codec::put_varint(record, q.rot[c] - prev[i].rot[c]);
+				prev[i] = q;
+			}
+			events.clear();
+			for (size_t ic = 0; ic < cms.size(); ++ic) {
+				int target = cms[ic].is_locked() ? cms[ic].target() : -1;
+				if (target != prev_targets[ic]) {
+					events.push_back(glm::ivec2((int)ic, target));
+					prev_targets[ic] = target;
+				}
+			}
+			race_codec::put(record, (unsigned int)events.size());
+			for (size_t e = 0; e < events.size(); ++e) {
+				race_codec::put(record, (unsigned int)events[e].x);
+				race_codec::put(record, events[e].y);
+			}
+		}
+
+		block.push_back(char(key ? race_codec::KEYFRAME : race_codec::DELTA));
+		race_codec::put(block, (unsigned int)record.size());
+		block.insert(block.end(), record.begin(), record.end());
+		offset += 1 + sizeof(unsigned int) + record.size();
+		++n_records;
+
+		if (block.size() >= (1 << 16))
+			flush_block();
+	}
+
+private:
+	FILE* f;
+	unsigned int keyframe_every;
+	float pos_step;
+	unsigned long long n_records;
+
+	/// bytes of the file so far, including the ones not written yet
+	unsigned long long offset;
+
+	/// (time, offset) of each keyframe
+	std::vector<std::pair<long long, unsigned long long> > index;
+
+	/// quantized frames and targets of the last record
+	std::vector<race_codec::qframe> prev;
+	std::vector<int> prev_targets;
+
+	/// scratch buffers of updated()
+	std::vector<char> record;
+	std::vector<glm::ivec2> events;
+
+	/// records encoded but not queued yet
+	std::vector<char> block;
+
+	/// blocks queued for the writer thread
+	std::deque<std::vector<char> > queue;
+	std::mutex m;
+	std::condition_variable cv;
+	std::thread writer;
+	bool stopping;
+
+	void flush_block() {
+		if (block.empty())
+			return;
+		{
+			std::lock_guard<std::mutex> lock(m);
+			queue.push_back(std::vector<char>());
+			queue.back().swap(block);
+		}
+		cv.notify_one();
+	}
+
+	void write_loop() {
+		for (;;) {
+			std::vector<char> b;
+			{
+				std::unique_lock<std::mutex> lock(m);
+				cv.wait(lock, [this]() { return stopping || !queue.empty(); });
+				if (queue.empty())
+					return;
+				b.swap(queue.front());
+				queue.pop_front();
+			}
+			fwrite(&b[0], 1, b.size(), f);
+		}
+	}
+};
+
+/**
+	Reads a recording written by race_recorder, sequentially with next() or at any time with seek().
+	If the recording has no index (the recorder was not closed) the keyframes are found by scanning the file once.
+*/
+struct race_reader {
+	race_reader() :f(0), pos_step(1.f), data_end(0) {}
+	~race_reader() { close(); }
+
+	bool open(const char* filename) {
+		close();
+		f = fopen(filename, "rb");
+		if (!f)
+			return false;
+		char header[24];
+		if (fread(header, 1, 24, f) != 24 || memcmp(header, "CRRC", 4) != 0) {
+			close();
+			return false;
+		}
+		const char* p = header + 8;
+		race_codec::get<unsigned int>(p);
+		pos_step = race_codec::get<float>(p);
+
+		fseek_(0, SEEK_END);
+		long long size = ftell_();
+		data_end = size;
+		index.clear();
+
+		// the index at the end, if any
+		char tail[8];
+		if (size >= 24 + 8) {
+			fseek_(size - 8, SEEK_SET);
+			fread(tail, 1, 8, f);
+			if (memcmp(tail + 4, "CRIX", 4) == 0) {
+				const char* tp = tail;
+				unsigned int n = race_codec::get<unsigned int>(tp);
+				long long index_bytes = (long long)n * (sizeof(long long) + sizeof(unsigned long long));
+				std::vector<char> b((size_t)index_bytes);
+				fseek_(size - 8 - index_bytes, SEEK_SET);
+				if (n)
+					fread(&b[0], 1, b.size(), f);
+				const char* bp = b.empty() ? 0 : &b[0];
+				for (unsigned int i = 0; i < n; ++i) {
+					long long t = race_codec::get<long long>(bp);
+					unsigned long long o = race_codec::get<unsigned long long>(bp);
+					index.push_back(std::make_pair(t, o));
+				}
+				data_end = size - 8 - index_bytes;
+			}
+		}
+		if (data_end == size)
+			scan();
+
+		fseek_(24, SEEK_SET);
+		return true;
+	}
+
+	void close() {
+		if (f)
+			fclose(f);
+		f = 0;
+	}
+
+	/// time of the first and of the last keyframe
+	long long first_keyframe() const { return index.empty() ? 0 : index.front().first; }
+	long long last_keyframe() const { return index.empty() ? 0 : index.back().first; }
+
+	/**
+	 * decode the next record
+	 * @return false at the end of the recording
+	 */
+	bool next(race_record& r) {
+		unsigned char type;
+		if (!read_record(type))
+			return false;
+		decode(type, r);
+		return true;
+	}
+
+	/**
+	 * go to the last record at or before time t and decode it
+	 * @return false if the recording has nothing before t
+	 */
+	bool seek(long long t, race_record& r) {
+		std::vector<std::pair<long long, unsigned long long> >::const_iterator it =
+			std::upper_bound(index.begin(), index.end(), std::make_pair(t, ~0ULL));
+		if (it == index.begin())
+			return false;
+		--it;
+		fseek_((long long)it->second, SEEK_SET);
+		unsigned char type;
+		if (!read_record(type))
+			return false;
+		decode(type, r);
+
+		// decode the deltas up to t
+		for (;;) {
+			long long at = ftell_();
+			if (!read_record(type))
+				break;
+			const char* p = &payload[0];
+			if (type == race_codec::KEYFRAME || race_codec::get<long long>(p) > t) {
+				fseek_(at, SEEK_SET);
+				break;
+			}
+			decode(type, r);
+		}
+		return true;
+	}
+
+private:
+	FILE* f;
+	float pos_step;
+	long long data_end;
+	std::vector<std::pair<long long, unsigned long long> > index;
+
+	/// decoder state: quantized frames and targets of the last record
+	std::vector<race_codec::qframe> prev;
+	std::vector<int> targets;
+
+	std::vector<char> payload;
+
+	void fseek_(long long o, int whence) {
+#if defined(_WIN32)
+		_fseeki64(f, o, whence);
+#else
+		fseeko(f, (off_t)o, whence);
+#endif
+	}
+
+	long long ftell_() {
+#if defined(_WIN32)
+		return _ftelli64(f);
+#else
+		return (long long)ftello(f);
+#endif
+	}
+
+	bool read_record(unsigned char& type) {
+		char h[5];
+		if (ftell_() + 5 > data_end || fread(h, 1, 5, f) != 5)
+			return false;
+		type = (unsigned char)h[0];
+		const char* p = h + 1;
+		unsigned int n = race_codec::get<unsigned int>(p);
+		payload.resize(std::max(n, 1u));
+		return fread(&payload[0], 1, n, f) == n;
+	}
+
+	/// build the index of the keyframes by reading all the record headers
+	void scan() {
+		long long end = 24;
+		for (;;) {
+			fseek_(end, SEEK_SET);
+			char h[5 + sizeof(long long)];
+			if (fread(h, 1, sizeof(h), f) != sizeof(h))
+				break;
+			const char* p = h + 1;
+			unsigned int n = race_codec::get<unsigned int>(p);
+			long long t = race_codec::get<long long>(p);
+			// a record cut by a crash is dropped
+			if (end + 5 + n > data_end)
+				break;
+			if ((unsigned char)h[0] == race_codec::KEYFRAME)
+				index.push_back(std::make_pair(t, (unsigned long long)end));
+			end += 5 + n;
+		}
+		data_end = end;
+	}
+
+	void decode(unsigned char type, race_record& r) {
+		const char* p = &payload[0];
+		r.t = race_codec::get<long long>(p);
+		r.sunlight_direction = race_codec::get<glm::vec3>(p);
+		r.lock_events.clear();
+		if (type == race_codec::KEYFRAME) {
+			prev.resize(race_codec::get<unsigned int>(p));
+			for (size_t i = 0; i < prev.size(); ++i) {
+				for (int c = 0; c < 3; ++c)
+					prev[i].pos[c] = race_codec::get<int>(p);
+				for (int c = 0; c < 4; ++c)
+					prev[i].rot[c] = race_codec::get<short>(p);
+			}
+			// the keyframe holds all the targets: the events are the ones that changed since the last record read
+			targets.resize(race_codec::get<unsigned int>(p), -1);
+			for (size_t ic = 0; ic < targets.size(); ++ic) {
+				int target = race_codec::get<int>(p);
+				if (target != targets[ic])
+					r.lock_events.push_back(glm::ivec2((int)ic, target));
+				targets[ic] = target;
+			}
+		}
+		else {
+			for (size_t i = 0; i < prev.size(); ++i) {
+				for (int c = 0; c < 3; ++c)
+					prev[i].pos[c] += race_codec::get_varint(p);
+				for (int c = 0; c < 4; ++c)
+					prev[i].rot[c] = short(prev[i].rot[c] + race_codec::get_varint(p));
+			}
+			unsigned int n = race_codec::get<unsigned int>(p);
+			for (unsigned int e = 0; e < n; ++e) {
+				int ic = (int)race_codec::get<unsigned int>(p);
+				int target = race_codec::get<int>(p);
+				targets[ic] = target;
+				r.lock_events.push_back(glm::ivec2(ic, target));
+			}
+		}
+		r.car_frames.resize(prev.size());
+		for (size_t i = 0; i < prev.size(); ++i)
+			r.car_frames[i] = race_codec::frame(prev[i], pos_step);
+		r.targets = targets;
+	}
+};
+
+//@}
@@ -0,0 +1,284 @@
+#pragma once
+
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <sys/stat.h>
+#include "carousel.h"
+#include "..\mapped_file.h"
+#include "..\hash64.h"
+
+/**
+	Binary cache of a loaded scene: height field (or the name of the tiled one), track curbs, trees, lamps, cameramen,
+	packed carpaths and visibility tables, i.e. everything carousel_loader computes from the svg and the terrain image.
+	The cache is keyed by a hash of the input files and of the format version, so a stale cache is never used.
+	It is loaded by mapping the file in memory, with no parsing: the height field, the curbs, the trees and lamps,
+	the carpath samples and the visibility tables are used in place (see shared_array) and keep the mapping alive.
+	Only the cameramen, which the race changes, are copied out.
+
+	layout: "CRSC" u32 version u64 key, then the sections in the order of save(), each aligned to 8 bytes.
+	Values are stored in the byte order of the machine that wrote them.
+*/
+struct scene_cache {
+	enum { VERSION = 4 };
+
+	/// hash of the content of the files (see hash64), nonzero if they could all be read
+	static unsigned long long hash_files(const std::vector<std::string>& files) {
+		unsigned long long h = hash64::basis();
+		h = hash64::bytes(h, "CRSC", 4);
+		unsigned int version = VERSION;
+		h = hash64::bytes(h, &version, sizeof(version));
+		for (size_t i = 0; i < files.size(); ++i) {
+			FILE* f = fopen(files[i].c_str(), "rb");
+			if (!f)
+				return 0;
+			// a tiled height field is keyed by its header, size and modification time, so that opening it
+			// does not read the whole terrain
+			const bool tiled = is_tiled(files[i]);
+			size_t left = tiled ? size_t(terrain_tiles::HEADER_BYTES) : size_t(-1);
+			char buf[1 << 16];
+			size_t n;
+			while (left > 0 && (n = fread(buf, 1, std::min(sizeof(buf), left), f)) > 0) {
+				h = hash64::bytes(h, buf, n);
+				left -= n;
+			}
+			fclose(f);
+			if (tiled) {
+				struct stat st;
+				if (stat(files[i].c_str(), &st) != 0)
+					return 0;
+				const long long size_time[2] = { (long long)st.st_size, (long long)st.st_mtime };
+				h = hash64::bytes(h, size_time, sizeof(size_time));
+			}
+		}
+		return h ? h : 1;
+	}
+
+	/// is filename a tiled height field (see terrain_tiles)
+	static bool is_tiled(const std::string& filename) {
+		return filename.size() >= 6 && filename.compare(filename.size() - 6, 6, ".tiles") == 0;
+	}
+
+	/**
+	 * replace the scene of r with the cached one
+	 * @return false if there is no cache for the given key
+	 */
+	static bool load(const char* filename, unsigned long long key, race& r) {
+		std::shared_ptr<mapped_file> mf = std::make_shared<mapped_file>(filename);
+		if (!mf->is_open() || mf->size() < 16)
+			return false;
+		reader in(mf->data(), mf->size());
+		if (memcmp(in.bytes(4), "CRSC", 4) != 0 || in.get<unsigned int>() != VERSION || in.get<unsigned long long>() != key)
+			return false;
+
+		std::shared_ptr<race_scene> sp = std::make_shared<race_scene>();
+		race_scene& s = *sp;
+		s.bbox.min = in.get<glm::vec3>();
+		s.bbox.max = in.get<glm::vec3>();
+
+		s.ter.rect_xz = in.get<glm::vec4>();
+		s.ter.size_pix = in.get<glm::ivec2>();
+		if (in.get<unsigned int>()) {
+			// a tiled height field is not copied in the cache, only its file name
+			std::vector<char> name;
+			in.array(name);
+			name.push_back(0);
+			if (!in.ok() || !s.ter.set_tiles(&name[0]))
+				return false;
+		}
+		else {
+			// the height field stays in the mapping, which lives as long as the terrain and its copies
+			in.align();
+			const unsigned char* hf = in.bytes(size_t(s.ter.size_pix[0]) * s.ter.size_pix[1]);
+			s.ter.height_field = std::shared_ptr<const unsigned char>(mf, hf);
+		}
+
+		in.view(mf, s.t.curbs[0]);
+		in.view(mf, s.t.curbs[1]);
+		s.t.length = in.get<float>();
+		in.view(mf, s.trees);
+		in.view(mf, s.lamps);
+
+		std::vector<cameraman> cameramen(in.get<unsigned int>(), cameraman(0.f));
+		for (size_t ic = 0; ic < cameramen.size(); ++ic) {
+			cameramen[ic].frame = in.get<glm::mat4>();
+			cameramen[ic].radius = in.get<float>();
+		}
+
+		s.carpaths.resize(in.get<unsigned int>());
+		for (size_t ip = 0; ip < s.carpaths.size(); ++ip) {
+			path& p = s.carpaths[ip];
+			p.origin = in.get<glm::vec3>();
+			p.step = in.get<glm::vec3>();
+			p.T = in.get<int>();
+			in.view(mf, p.samples);
+		}
+
+		std::vector<std::shared_ptr<std::vector<visibility_table> > > tables(s.carpaths.size());
+		for (size_t ip = 0; ip < s.carpaths.size(); ++ip)
+			tables[ip] = std::make_shared<std::vector<visibility_table> >(cameramen.size());
+		for (size_t ic = 0; ic < cameramen.size(); ++ic)
+			for (size_t ip = 0; ip < s.carpaths.size(); ++ip) {
+				in.view(mf, (*tables[ip])[ic].intervals);
+				in.view(mf, (*tables[ip])[ic].bits);
+			}
+		s.visibility.assign(tables.begin(), tables.end());
+		if (!in.ok())
+			return false;
+
+		r._scene = sp;
+		r._cameramen = cameramen;
+		r.forget_near();
+		return true;
+	}
+
+	/**
+	 * write the scene of r. The carpaths must be ready, see race::wait_paths.
+	 * The file is written under a temporary name and renamed, so a reader never sees it half written.
+	 */
+	static bool save(const char* filename, unsigned long long key, const race& r) {
+		const race_scene& s = *r._scene;
+		std::vector<char> out;
+		out.insert(out.end(), "CRSC", "CRSC" + 4);
+		put(out, (unsigned int)VERSION);
+		put(out, key);
+
+		put(out, s.bbox.min);
+		put(out, s.bbox.max);
+
+		put(out, s.ter.rect_xz);
+		put(out, s.ter.size_pix);
+		put(out, (unsigned int)(s.ter.tiles ? 1 : 0));
+		if (s.ter.tiles) {
+			const std::string& name = s.ter.tiles->filename();
+			put_array(out, std::vector<char>(name.begin(), name.end()));
+		}
+		else {
+			align(out);
+			const unsigned char* hf = s.ter.height_field.get();
+			out.insert(out.end(), hf, hf + size_t(s.ter.size_pix[0]) * s.ter.size_pix[1]);
+		}
+
+		put_array(out, s.t.curbs[0]);
+		put_array(out, s.t.curbs[1]);
+		put(out, s.t.length);
+		put_array(out, s.trees);
+		put_array(out, s.lamps);
+
+		put(out, (unsigned int)r._cameramen.size());
+		for (size_t ic = 0; ic < r._cameramen.size(); ++ic) {
+			put(out, r._cameramen[ic].frame);
+			put(out, r._cameramen[ic].radius);
+		}
+
+		put(out, (unsigned int)s.carpaths.size());
+		for (size_t ip = 0; ip < s.carpaths.size(); ++ip) {
+			const path& p = s.carpaths[ip];
+			put(out, p.origin);
+			put(out, p.step);
+			put(out, p.T);
+			put_array(out, p.samples);
+		}
+
+		for (size_t ic = 0; ic < r._cameramen.size(); ++ic)
+			for (size_t ip = 0; ip < s.visibility.size(); ++ip) {
+				put_array(out, (*s.visibility[ip])[ic].intervals);
+				put_array(out, (*s.visibility[ip])[ic].bits);
+			}
+
+		std::string tmp = std::string(filename) + ".tmp";
+		FILE* f = fopen(tmp.c_str(), "wb");
+		if (!f)
+			return false;
+		bool written = fwrite(&out[0], 1, out.size(), f) == out.size();
+		written = (fclose(f) == 0) && written;
+		remove(filename);
+		return written && rename(tmp.c_str(), filename) == 0;
+	}
+
+private:
+	template <class T>
+	static void put(std::vector<char>& out, const T& v) {
+		out.insert(out.end(), (const char*)&v, (const char*)&v + sizeof(T));
+	}
+
+	static void align(std::vector<char>& out) {
+		out.resize((out.size() + 7) & ~size_t(7), 0);
+	}
+
+	/// u32 count, then the elements aligned to 8 bytes
+	template <class T>
+	static void put_array(std::vector<char>& out, const std::vector<T>& v) {
+		align(out);
+		put(out, (unsigned int)v.size());
+		align(out);
+		if (!v.empty())
+			out.insert(out.end(), (const char*)&v[0], (const char*)&v[0] + v.size() * sizeof(T));
+	}
+
+	template <class T>
+	static void put_array(std::vector<char>& out, const shared_array<T>& v) {
+		align(out);
+		put(out, (unsigned int)v.size());
+		align(out);
+		out.insert(out.end(), (const char*)v.begin(), (const char*)v.end());
+	}
+
+	/// bounds checked cursor on the mapping
+	struct reader {
+		reader(const unsigned char* d, size_t n) :data(d), size(n), at(0), failed(false) {}
+
+		const unsigned char* bytes(size_t n) {
+			if (failed || at + n > size) {
+				failed = true;
+				return data;
+			}
+			const unsigned char* p = data + at;
+			at += n;
+			return p;
+		}
+
+		template <class T>
+		T get() {
+			T v = T();
+			const unsigned char* p = bytes(sizeof(T));
+			if (!failed)
+				memcpy(&v, p, sizeof(T));
+			return v;
+		}
+
+		void align() { at = (at + 7) & ~size_t(7); }
+
+		template <class T>
+		void array(std::vector<T>& v) {
+			align();
+			unsigned int n = get<unsigned int>();
+			align();
+			const unsigned char* p = bytes(size_t(n) * sizeof(T));
+			if (failed)
+				n = 0;
+			v.resize(n);
+			if (n)
+				memcpy(&v[0], p, size_t(n) * sizeof(T));
+		}
+
+		/// as array, pointing into the mapping instead of copying
+		template <class T>
+		void view(const std::shared_ptr<mapped_file>& mf, shared_array<T>& v) {
+			align();
+			unsigned int n = get<unsigned int>();
+			align();
+			const unsigned char* p = bytes(size_t(n) * sizeof(T));
+			v.alias(mf, (const T*)p, failed ? 0 : n);
+		}
+
+		bool ok() const { return !failed; }
+
+		const unsigned char* data;
+		size_t size, at;
+		bool failed;
+	};
+};
@@ -0,0 +1,162 @@
+#pragma once
+
+#include <stdio.h>
+#include <math.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <glm/glm.hpp>
+#include "terrain_tiles.h"
+
+/**
+	Synthetic scenes in the format carousel_loader::load reads: an svg with a closed track, carpaths running along it,
+	lamps on its side, cameramen around it and trees scattered away from it, plus a height field. Everything is drawn
+	from params.seed, so the same params always give the same scene. Used to measure the loader, the simulation and the
+	renderer on scenes much larger than the shipped one, see main_generate.
+*/
+struct scene_generator {
+
+	struct params {
+		params() :size(100.f), terrain(256), lamps(19), trees(53), cameramen(4), carpaths(2), seed(1) {}
+
+		/// side of the scene in svg units
+		float size;
+
+		/// side of the height field in texels
+		int terrain;
+
+		int lamps, trees, cameramen, carpaths;
+		unsigned int seed;
+
+		/// a scene with scale times the objects of assets/small_test.svg, on an area scale times larger
+		static params scaled(float scale) {
+			params p;
+			const float side = sqrtf(std::max(scale, 0.01f));
+			p.size = 100.f * side;
+			p.terrain = std::max(2, int(256 * side));
+			p.lamps = std::max(1, int(19 * scale));
+			p.trees = int(53 * scale);
+			p.cameramen = std::max(1, int(4 * scale));
+			p.carpaths = std::max(1, int(2 * scale));
+			return p;
+		}
+	};
+
+	/// distance of the track from the center of the scene at angle a, see write_svg
+	static float track_radius(const params& p, float a) {
+		const float phase = float(p.seed % 628) * 0.01f;
+		return p.size * 0.35f * (1.f + 0.12f * sinf(3.f * a + phase) + 0.06f * cosf(5.f * a));
+	}
+
+	static bool write_svg(const char* filename, const params& p) {
+		FILE* f = fopen(filename, "w");
+		if (!f)
+			return false;
+		fprintf(f, "<?xml version=\"1.0\"?>\n<!-- generated by scene_generator, seed %u -->\n", p.seed);
+		fprintf(f, "<svg xmlns=\"http://www.w3.org/2000/svg\" width=\"%g\" height=\"%g\">\n", p.size, p.size);
+
+		// the track and its carpaths, which share its shape at a lateral offset within the curbs (2 units each side)
+		write_loop(f, "track", p, 0.f);
+		for (int i = 0; i < p.carpaths; ++i)
+			write_loop(f, ("carpath" + std::to_string(i)).c_str(), p, -1.5f + 3.f * (i + 0.5f) / p.carpaths);
+
+		// lamps outside the curb, cameramen farther out, both evenly spaced along the track
+		for (int i = 0; i < p.lamps; ++i)
+			write_point(f, ("lamp" + std::to_string(i)).c_str(), loop_point(p, 6.2831853f * i / p.lamps, 3.f));
+		for (int i = 0; i < p.cameramen; ++i)
+			write_point(f, ("cameraman_15_" + std::to_string(i)).c_str(), loop_point(p, 6.2831853f * (i + 0.5f) / p.cameramen, 6.f));
+
+		// trees anywhere at least 4 units away from the track (fewer if the scene is too small to find room for them)
+		unsigned int state = p.seed * 2654435761u + 1u;
+		const glm::vec2 center(p.size * 0.5f);
+		for (long long i = 0, tries = 0; i < p.trees && tries < 100LL * p.trees; ++tries) {
+			glm::vec2 q(uniform(state) * p.size, uniform(state) * p.size);
+			const glm::vec2 d = q - center;
+			if (fabsf(glm::length(d) - track_radius(p, atan2f(d.y, d.x))) < 4.f)
+				continue;
+			write_point(f, ("tree" + std::to_string(i)).c_str(), q);
+			++i;
+		}
+
+		fprintf(f, "</svg>\n");
+		return fclose(f) == 0;
+	}
+
+	/**
+	 * a p.terrain x p.terrain height field of a few octaves of value noise, rows of p.terrain bytes. The heights stay in
+	 * [0, 120] (2.4 units, see terrain::hf)
+	 */
+	static void height_field(const params& p, std::vector<unsigned char>& data) {
+		const int n = p.terrain;
+		data.resize(size_t(n) * n);
+		for (int row = 0; row < n; ++row)
+			for (int col = 0; col < n; ++col) {
+				float h = 0.f, amplitude = 0.5f, frequency = 4.f / n;
+				for (int o = 0; o < 4; ++o) {
+					h += amplitude * value_noise(p.seed + o, row * frequency, col * frequency);
+					amplitude *= 0.5f;
+					frequency *= 2.f;
+				}
+				data[size_t(row) * n + col] = (unsigned char)std::min(120.f, std::max(0.f, h * 128.f));
+			}
+	}
+
+	/// write the height field in the tiled format, see terrain_tiles
+	static bool write_tiles(const char* filename, const params& p) {
+		std::vector<unsigned char> data;
+		height_field(p, data);
+		return terrain_tiles::write(filename, &data[0], p.terrain, p.terrain);
+	}
+
+private:
+	/// the point at angle a of the track, moved by offset along the direction away from the center
+	static glm::vec2 loop_point(const params& p, float a, float offset) {
+		return glm::vec2(p.size * 0.5f) + (track_radius(p, a) + offset) * glm::vec2(cosf(a), sinf(a));
+	}
+
+	/// a closed loop of cubic Beziers through 64 points of the track at the given offset (Catmull-Rom tangents)
+	static void write_loop(FILE* f, const char* id, const params& p, float offset) {
+		const int n = 64;
+		std::vector<glm::vec2> q(n);
+		for (int i = 0; i < n; ++i)
+			q[i] = loop_point(p, 6.2831853f * i / n, offset);
+		fprintf(f, "<path id=\"%s\" style=\"fill:none;stroke:#000000\" d=\"M %g %g", id, q[0].x, q[0].y);
+		for (int i = 0; i < n; ++i) {
+			const glm::vec2& p0 = q[(i + n - 1) % n];
+			const glm::vec2& p1 = q[i];
+			const glm::vec2& p2 = q[(i + 1) % n];
+			const glm::vec2& p3 = q[(i + 2) % n];
+			const glm::vec2 c1 = p1 + (p2 - p0) / 6.f, c2 = p2 - (p3 - p1) / 6.f;
+			fprintf(f, " C %g %g %g %g %g %g", c1.x, c1.y, c2.x, c2.y, p2.x, p2.y);
+		}
+		fprintf(f, "\"/>\n");
+	}
+
+	static void write_point(FILE* f, const char* id, const glm::vec2& q) {
+		fprintf(f, "<rect id=\"%s\" style=\"fill:#008000\" x=\"%g\" y=\"%g\" width=\"0.4\" height=\"0.4\"/>\n", id, q.x, q.y);
+	}
+
+	/// uniform in [0,1), xorshift
+	static float uniform(unsigned int& state) {
+		state ^= state << 13;
+		state ^= state >> 17;
+		state ^= state << 5;
+		return (state >> 8) * (1.f / 16777216.f);
+	}
+
+	static float lattice(unsigned int seed, int i, int j) {
+		unsigned int h = seed * 374761393u + (unsigned int)i * 668265263u + (unsigned int)j * 2246822519u;
+		h = (h ^ (h >> 13)) * 1274126177u;
+		return ((h ^ (h >> 16)) & 0xffffff) * (1.f / 16777216.f);
+	}
+
+	/// smoothly interpolated lattice values, in [0,1)
+	static float value_noise(unsigned int seed, float x, float y) {
+		const int i = int(floorf(x)), j = int(floorf(y));
+		float u = x - i, v = y - j;
+		u = u * u * (3.f - 2.f * u);
+		v = v * v * (3.f - 2.f * v);
+		const float a = lattice(seed, i, j), b = lattice(seed, i + 1, j), c = lattice(seed, i, j + 1), d = lattice(seed, i + 1, j + 1);
+		return (a * (1.f - u) + b * u) * (1.f - v) + (c * (1.f - u) + d * u) * v;
+	}
+};
@@ -0,0 +1,563 @@
+#pragma once
+
+#include <string.h>
+#include <float.h>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <sys/stat.h>
+#include "carousel_loader.h"
+
+/**
+	Reloads the scene of a race when its svg or its terrain change on disk, redoing only the work the edit calls for.
+	The shapes of the svg are matched with the ones of the previous load by the hash of their source text (see
+	svg_stream::shape): only the paths of the new and modified ones are built, and only those are processed again.
+	The others keep their result, copied only if the terrain changed under them. Only the carpaths whose control
+	points changed, or that cross the changed part of the terrain, are baked again.
+
+	The terrain is compared by blocks of rows, or by tiles for a tiled one, through their hashes: only the blocks
+	whose hash changed are compared texel by texel.
+
+	The race gets a new scene, so the copies sharing the old one are not disturbed. The new scene shares with the old
+	one every array the edit leaves alone (see shared_array). changes tells what has to be uploaded again to draw it,
+	see updateTrack and updateTerrain in carousel_augment.h.
+*/
+struct scene_watch {
+	scene_watch() :last_width(0.f), last_height(0.f) {}
+
+	/// what a reload changed
+	struct changes {
+		changes() :trees(false), lamps(false), cameramen(false), curbs(0, 0), track_resized(false), texels(0, 0, -1, -1) {}
+
+		/// trees, lamps or cameramen were moved, added or removed
+		bool trees, lamps, cameramen;
+
+		/// curb points [curbs[0], curbs[1]) changed; if track_resized, their number changed
+		glm::ivec2 curbs;
+		bool track_resized;
+
+		/// texels of the height field that changed: rows texels[0]..texels[2], columns texels[1]..texels[3] (see terrain::texel)
+		glm::ivec4 texels;
+
+		/// the carpaths baked again
+		std::vector<int> carpaths;
+
+		/**
+		 * the vertices (ix, iz) of a terrain mesh of X x Z vertices whose height changed, grown by margin vertices on
+		 * every side and clamped to the mesh, as (ix0, iz0, ix1, iz1). Texel (row, col) is the height of vertex
+		 * (X - 1 - row, col), see terrain::hf. Empty (ix0 > ix1) if the terrain did not change
+		 */
+		glm::ivec4 vertices(int X, int Z, int margin = 0) const {
+			if (!terrain())
+				return glm::ivec4(0, 0, -1, -1);
+			return glm::ivec4(std::max(X - 1 - texels[2] - margin, 0), std::max(texels[1] - margin, 0),
+				std::min(X - 1 - texels[0] + margin, X - 1), std::min(texels[3] + margin, Z - 1));
+		}
+
+		bool track() const { return track_resized || curbs[0] < curbs[1]; }
+		bool terrain() const { return texels[0] <= texels[2]; }
+		bool any() const { return trees || lamps || cameramen || track() || terrain() || !carpaths.empty(); }
+	};
+
+	/**
+	 * watch the files r has been loaded from (see carousel_loader::load), the reference the next reloads are compared
+	 * with. The shapes are taken from loaded if it has them, else the svg is read and its shapes are processed once
+	 */
+	bool watch(const char* svgFile, const char* terrain_image, const race& r, carousel_loader::loaded_shapes* loaded = 0) {
+		svg_file = svgFile;
+		terrain_file = terrain_image;
+		svg_stamp = stamp_of(svgFile);
+		terrain_stamp = stamp_of(terrain_image);
+
+		svg_stream::image image;
+		std::vector<carousel_loader::shape_result> results;
+		if (loaded && loaded->parsed) {
+			image = std::move(loaded->image);
+			results = std::move(loaded->results);
+			*loaded = carousel_loader::loaded_shapes();
+		}
+		else {
+			if (!svg_stream::parse(svgFile, carousel_loader::wanted, image, 96.f))
+				return false;
+			results.assign(image.shapes.size(), carousel_loader::shape_result());
+			const terrain& ter = r.ter();
+			thread_pool::global().parallel_for(image.shapes.size(), [&](size_t i) {
+				carousel_loader::process_shape(image.shapes[i], ter, results[i]);
+			});
+		}
+		last.assign(image.shapes.size(), piece());
+		for (size_t i = 0; i < last.size(); ++i)
+			last[i] = make_piece(image.shapes[i].source, results[i]);
+		last_width = image.width;
+		last_height = image.height;
+		gather(last, last_points, last_cameramen);
+		block_hashes(r.ter(), terrain_hashes);
+		return true;
+	}
+
+	/// have the files changed since the last load
+	bool changed() const {
+		return !(stamp_of(svg_file.c_str()) == svg_stamp) || !(stamp_of(terrain_file.c_str()) == terrain_stamp);
+	}
+
+	/// reload r if the files changed. Returns true if r has been reloaded, c tells what changed
+	bool poll(race& r, changes& c) {
+		return changed() && reload(r, c);
+	}
+
+	/// reload r from the files it has been loaded from, c tells what changed. r is left as it is if they cannot be read
+	bool reload(race& r, changes& c) {
+		c = changes();
+		const stamp svg_now = stamp_of(svg_file.c_str()), terrain_now = stamp_of(terrain_file.c_str());
+
+		// the new scene starts as a copy of the old one, sharing its arrays, so its carpaths must be complete
+		r.wait_paths();
+		const race_scene& old = *r._scene;
+		std::shared_ptr<race_scene> fresh = std::make_shared<race_scene>(old);
+		race_scene& s = *fresh;
+
+		std::vector<unsigned long long> hashes;
+		const bool terrain_changed = !(terrain_now == terrain_stamp);
+		if (terrain_changed) {
+			if (scene_cache::is_tiled(terrain_file.c_str())) {
+				// a tiled height field has the hashes of its tiles: the changed ones are not even read
+				if (!s.ter.set_tiles(terrain_file.c_str()))
+					return false;
+				c.texels = changed_tiles(old.ter, s.ter);
+			}
+			else {
+				int sx, sy, comp;
+				unsigned char* data = stbi_load(terrain_file.c_str(), &sx, &sy, &comp, 1);
+				if (!data)
+					return false;
+				block_hashes(data, sx, sy, hashes);
+				c.texels = changed_texels(old.ter, terrain_hashes, data, sx, sy, hashes);
+				if (c.terrain())
+					s.ter.set_height_field(data, sx, sy);
+				stbi_image_free(data);
+			}
+		}
+
+		// the shapes whose source is the one of a shape of the last load keep its result, the others are built
+		std::vector<piece> pieces;
+		std::vector<size_t> modified;
+		svg_stream::image image;
+		image.width = last_width;
+		image.height = last_height;
+		if (!(svg_now == svg_stamp)) {
+			std::unordered_map<unsigned long long, size_t> by_source;
+			for (size_t i = 0; i < last.size(); ++i)
+				if (last[i].source)
+					by_source[last[i].source] = i;
+			const auto known = [&](unsigned long long source) { return by_source.count(source) != 0; };
+			if (!svg_stream::reparse(svg_file.c_str(), carousel_loader::wanted, known, image, 96.f))
+				return false;
+			pieces.resize(image.shapes.size());
+			for (size_t i = 0; i < image.shapes.size(); ++i)
+				if (image.shapes[i].paths.empty())
+					pieces[i] = last[by_source[image.shapes[i].source]];
+				else
+					modified.push_back(i);
+		}
+		else
+			pieces = last;
+
+		// a new size of the image moves the terrain, and everything on it
+		if (image.width != last_width || image.height != last_height) {
+			s.bbox = box3();
+			s.bbox.add(glm::vec3(0.f, 0.f, 0.f));
+			s.bbox.add(glm::vec3(image.width, 0.f, image.height));
+			s.ter.rect_xz = glm::vec4(0, 0, image.width, image.height);
+			c.texels = all_texels(s.ter);
+		}
+		const glm::vec4 area = c.terrain() ? region(s.ter, c) : glm::vec4(FLT_MAX, FLT_MAX, -FLT_MAX, -FLT_MAX);
+
+		// the results kept are copied only if they have something where the terrain changed
+		std::vector<size_t> moved;
+		for (size_t i = 0; i < pieces.size(); ++i)
+			if (pieces[i].result && overlaps(pieces[i].bounds, area))
+				moved.push_back(i);
+		std::vector<carousel_loader::shape_result> results(modified.size() + moved.size());
+		thread_pool::global().parallel_for(results.size(), [&](size_t k) {
+			if (k < modified.size())
+				carousel_loader::process_shape(image.shapes[modified[k]], s.ter, results[k]);
+			else {
+				results[k] = *pieces[moved[k - modified.size()]].result;
+				reproject(results[k], s.ter, area);
+			}
+		});
+		for (size_t k = 0; k < results.size(); ++k) {
+			const size_t i = (k < modified.size()) ? modified[k] : moved[k - modified.size()];
+			pieces[i] = make_piece((k < modified.size()) ? image.shapes[i].source : pieces[i].source, results[k]);
+		}
+
+		std::vector<const std::vector<glm::vec3>*> points;
+		std::vector<glm::vec4> cameramen;
+		gather(pieces, points, cameramen);
+		if (points.empty() && r._pool.size() > 0) {
+			std::cout << "scene_watch: " << svg_file << " has no carpath left for the cars, not reloaded" << std::endl;
+			return false;
+		}
+
+		// only the arrays made of results that are not the ones of the last load are built again
+		c.trees = rebuild(pieces, last, trees_of, s.trees);
+		c.lamps = rebuild(pieces, last, lamps_of, s.lamps);
+		c.cameramen = cameramen != last_cameramen;
+		glm::ivec2 curbs;
+		if (rebuild(pieces, last, left_curb_of, s.t.curbs[0], &curbs)) {
+			rebuild(pieces, last, right_curb_of, s.t.curbs[1]);
+			c.track_resized = s.t.curbs[0].size() != old.t.curbs[0].size();
+			c.curbs = c.track_resized ? glm::ivec2(0, (int)s.t.curbs[0].size()) : narrow(s.t, old.t, curbs);
+		}
+
+		// carpaths: the unchanged ones keep their frames, and the visibility tables of the cameramen that did not move
+		std::vector<int> old_cameraman(cameramen.size(), -1);
+		std::vector<bool> taken(last_cameramen.size(), false);
+		for (size_t ic = 0; ic < cameramen.size(); ++ic)
+			for (size_t oc = 0; oc < last_cameramen.size(); ++oc)
+				if (!taken[oc] && cameramen[ic] == last_cameramen[oc]) {
+					old_cameraman[ic] = (int)oc;
+					taken[oc] = true;
+					break;
+				}
+
+		const size_t np = points.size();
+		s.carpaths.resize(np);
+		s.carpaths_baked.resize(np);
+		s.visibility.resize(np);
+		for (size_t ip = 0; ip < np; ++ip) {
+			if (ip >= last_points.size() || (points[ip] != last_points[ip] && *points[ip] != *last_points[ip]) ||
+				crosses(old.carpaths[ip], *points[ip], area)) {
+				s.visibility[ip].reset();
+				c.carpaths.push_back((int)ip);
+				continue;
+			}
+			// s starts as a copy of old, so the tables stay shared if no cameraman moved
+			if (!c.cameramen)
+				continue;
+			std::shared_ptr<std::vector<visibility_table> > tables = std::make_shared<std::vector<visibility_table> >(cameramen.size());
+			for (size_t ic = 0; ic < cameramen.size(); ++ic)
+				if (old_cameraman[ic] != -1)
+					(*tables)[ic] = (*old.visibility[ip])[old_cameraman[ic]];
+				else
+					(*tables)[ic].build(s.carpaths[ip], glm::vec3(cameramen[ic]), cameramen[ic].w);
+			s.visibility[ip] = tables;
+		}
+
+		// the cars are moved to the new paths below, so the bake is waited for
+		for (size_t k = 0; k < c.carpaths.size(); ++k) {
+			const unsigned int ip = c.carpaths[k];
+			const std::vector<glm::vec3>& controlPoints = *points[ip];
+			if (carousel_loader::parallel())
+				s.carpaths_baked[ip] = thread_pool::global().submit([fresh, ip, controlPoints, cameramen]() {
+					carousel_loader::bake_carpath(*fresh, ip, controlPoints, cameramen);
+				}).share();
+			else
+				carousel_loader::bake_carpath(s, ip, controlPoints, cameramen);
+		}
+		for (size_t k = 0; k < c.carpaths.size(); ++k)
+			if (s.carpaths_baked[c.carpaths[k]].valid())
+				s.carpaths_baked[c.carpaths[k]].wait();
+
+		move_cars(r, old, s, c.carpaths);
+
+		// the cameramen that did not move keep their locks
+		std::vector<cameraman> cams;
+		for (size_t i = 0; i < pieces.size(); ++i)
+			cams.insert(cams.end(), pieces[i].result->cameramen.begin(), pieces[i].result->cameramen.end());
+		for (size_t ic = 0; ic < cams.size(); ++ic)
+			if (old_cameraman[ic] != -1 && old_cameraman[ic] < (int)r._cameramen.size())
+				cams[ic] = r._cameramen[old_cameraman[ic]];
+		r._cameramen.swap(cams);
+
+		r._scene = fresh;
+		r._cars_stale = true;
+		r.forget_near();
+
+		svg_stamp = svg_now;
+		terrain_stamp = terrain_now;
+		last.swap(pieces);
+		last_width = image.width;
+		last_height = image.height;
+		last_points.swap(points);
+		last_cameramen.swap(cameramen);
+		if (terrain_changed)
+			terrain_hashes.swap(hashes);
+		return true;
+	}
+
+private:
+	struct stamp {
+		stamp() :mtime(0), size(-1) {}
+		long long mtime, size;
+		bool operator==(const stamp& o) const { return mtime == o.mtime && size == o.size; }
+	};
+
+	static stamp stamp_of(const char* filename) {
+		stamp s;
+		struct stat st;
+		if (stat(filename, &st) == 0) {
+			s.mtime = (long long)st.st_mtime;
+			s.size = (long long)st.st_size;
+		}
+		return s;
+	}
+
+	std::string svg_file, terrain_file;
+	stamp svg_stamp, terrain_stamp;
+
+	/// what a shape of the svg added to the scene
+	struct piece {
+		piece() :source(0) {}
+
+		/// see svg_stream::shape
+		unsigned long long source;
+		std::shared_ptr<const carousel_loader::shape_result> result;
+
+		/// where the trees, lamps, cameramen and curbs of result are, as (min x, min z, max x, max z)
+		glm::vec4 bounds;
+	};
+
+	/// the shapes of the last load in the order of the svg, the size of the image, the carpaths control points and
+	/// the cameramen
+	std::vector<piece> last;
+	float last_width, last_height;
+	std::vector<const std::vector<glm::vec3>*> last_points;
+	std::vector<glm::vec4> last_cameramen;
+
+	/// rows of the flat height field hashed together, see block_hashes
+	enum { BLOCK_ROWS = 16 };
+
+	/// the hashes of the blocks of rows of the flat height field of the last load
+	std::vector<unsigned long long> terrain_hashes;
+
+	/// the piece of a shape, taking its result
+	static piece make_piece(unsigned long long source, carousel_loader::shape_result& sr) {
+		piece p;
+		p.source = source;
+		p.bounds = glm::vec4(FLT_MAX, FLT_MAX, -FLT_MAX, -FLT_MAX);
+		for (size_t i = 0; i < sr.trees.size(); ++i)
+			add(p.bounds, sr.trees[i].pos);
+		for (size_t i = 0; i < sr.lamps.size(); ++i)
+			add(p.bounds, sr.lamps[i].pos);
+		for (size_t i = 0; i < sr.cameramen.size(); ++i)
+			add(p.bounds, glm::vec3(sr.cameramen[i].frame[3]));
+		for (int c = 0; c < 2; ++c)
+			for (size_t i = 0; i < sr.curbs[c].size(); ++i)
+				add(p.bounds, sr.curbs[c][i]);
+		p.result = std::make_shared<const carousel_loader::shape_result>(std::move(sr));
+		return p;
+	}
+
+	static void add(glm::vec4& bounds, const glm::vec3& p) {
+		bounds = glm::vec4(std::min(bounds[0], p.x), std::min(bounds[1], p.z), std::max(bounds[2], p.x), std::max(bounds[3], p.z));
+	}
+
+	static bool overlaps(const glm::vec4& a, const glm::vec4& b, float margin = 0.f) {
+		return a[0] <= b[2] + margin && a[2] >= b[0] - margin && a[1] <= b[3] + margin && a[3] >= b[1] - margin;
+	}
+
+	/// the carpaths control points and the cameramen of the pieces, in the order of the svg
+	static void gather(const std::vector<piece>& pieces, std::vector<const std::vector<glm::vec3>*>& points, std::vector<glm::vec4>& cameramen) {
+		points.clear();
+		cameramen.clear();
+		for (size_t i = 0; i < pieces.size(); ++i) {
+			const carousel_loader::shape_result& sr = *pieces[i].result;
+			for (size_t ip = 0; ip < sr.carpaths_points.size(); ++ip)
+				points.push_back(&sr.carpaths_points[ip]);
+			for (size_t ic = 0; ic < sr.cameramen.size(); ++ic)
+				cameramen.push_back(glm::vec4(glm::vec3(sr.cameramen[ic].frame[3]), sr.cameramen[ic].radius));
+		}
+	}
+
+	static const std::vector<stick_object>& trees_of(const carousel_loader::shape_result& sr) { return sr.trees; }
+	static const std::vector<stick_object>& lamps_of(const carousel_loader::shape_result& sr) { return sr.lamps; }
+	static const std::vector<glm::vec3>& left_curb_of(const carousel_loader::shape_result& sr) { return sr.curbs[0]; }
+	static const std::vector<glm::vec3>& right_curb_of(const carousel_loader::shape_result& sr) { return sr.curbs[1]; }
+
+	/// the results of the pieces with a non empty part, in the order of the svg
+	template <class PART>
+	static std::vector<const carousel_loader::shape_result*> parts(const std::vector<piece>& pieces, PART part) {
+		std::vector<const carousel_loader::shape_result*> out;
+		for (size_t i = 0; i < pieces.size(); ++i)
+			if (!part(*pieces[i].result).empty())
+				out.push_back(pieces[i].result.get());
+		return out;
+	}
+
+	/**
+	 * build a again from the parts of the results of pieces, unless they are the ones it was built from, the results
+	 * of before: a result that is not rebuilt is shared, so the same object has the same content.
+	 * @param changed if given, the range of a that differs from the old array, if they have the same size
+	 * @return true if a has been built again
+	 */
+	template <class T, class PART>
+	static bool rebuild(const std::vector<piece>& pieces, const std::vector<piece>& before, PART part, shared_array<T>& a, glm::ivec2* changed = 0) {
+		const std::vector<const carousel_loader::shape_result*> now = parts(pieces, part), was = parts(before, part);
+		size_t head = 0, tail = 0;
+		while (head < now.size() && head < was.size() && now[head] == was[head])
+			++head;
+		if (head == now.size() && head == was.size())
+			return false;
+		while (head + tail < now.size() && head + tail < was.size() && now[now.size() - 1 - tail] == was[was.size() - 1 - tail])
+			++tail;
+
+		std::vector<T> v;
+		size_t first = 0, after = 0;
+		for (size_t k = 0; k < now.size(); ++k) {
+			const std::vector<T>& p = part(*now[k]);
+			if (k < head)
+				first += p.size();
+			if (k + tail >= now.size())
+				after += p.size();
+			v.insert(v.end(), p.begin(), p.end());
+		}
+		if (changed)
+			*changed = glm::ivec2((int)first, int(v.size() - after));
+		a.assign(std::move(v));
+		return true;
+	}
+
+	/// the part of range, curb points of two tracks of the same size, where they differ
+	static glm::ivec2 narrow(const track& now, const track& before, glm::ivec2 range) {
+		while (range[0] < range[1] && now.curbs[0][range[0]] == before.curbs[0][range[0]] && now.curbs[1][range[0]] == before.curbs[1][range[0]])
+			++range[0];
+		while (range[1] > range[0] && now.curbs[0][range[1] - 1] == before.curbs[0][range[1] - 1] && now.curbs[1][range[1] - 1] == before.curbs[1][range[1] - 1])
+			--range[1];
+		return range;
+	}
+
+	static glm::ivec4 all_texels(const terrain& ter) {
+		return glm::ivec4(0, 0, ter.size_pix[1] - 1, ter.size_pix[0] - 1);
+	}
+
+	/// the hash of each block of BLOCK_ROWS rows of a flat height field of sx x sy bytes
+	static void block_hashes(const unsigned char* data, int sx, int sy, std::vector<unsigned long long>& hashes) {
+		hashes.resize((sy + BLOCK_ROWS - 1) / BLOCK_ROWS);
+		for (size_t b = 0; b < hashes.size(); ++b) {
+			const int rows = std::min((int)BLOCK_ROWS, sy - int(b) * BLOCK_ROWS);
+			hashes[b] = terrain_tiles::hash(data + b * BLOCK_ROWS * size_t(sx), size_t(rows) * sx);
+		}
+	}
+
+	static void block_hashes(const terrain& ter, std::vector<unsigned long long>& hashes) {
+		hashes.clear();
+		if (ter.height_field)
+			block_hashes(ter.height_field.get(), ter.size_pix[0], ter.size_pix[1], hashes);
+	}
+
+	/// the texels of the flat height field of ter, whose blocks have the given hashes, that differ from data, sx x sy
+	/// bytes whose blocks have the hashes now. Only the blocks whose hash changed are compared
+	static glm::ivec4 changed_texels(const terrain& ter, const std::vector<unsigned long long>& before, const unsigned char* data, int sx, int sy,
+		const std::vector<unsigned long long>& now) {
+		if (!ter.height_field || ter.size_pix != glm::ivec2(sx, sy) || before.size() != now.size())
+			return glm::ivec4(0, 0, sy - 1, sx - 1);
+		glm::ivec4 t(sy, sx, -1, -1);
+		for (size_t b = 0; b < now.size(); ++b) {
+			if (now[b] == before[b])
+				continue;
+			for (int row = int(b) * BLOCK_ROWS; row < std::min(int(b + 1) * BLOCK_ROWS, sy); ++row) {
+				const unsigned char* a = ter.height_field.get() + size_t(row) * sx;
+				const unsigned char* d = data + size_t(row) * sx;
+				if (memcmp(a, d, sx) == 0)
+					continue;
+				int c0 = 0, c1 = sx - 1;
+				while (a[c0] == d[c0])
+					++c0;
+				while (a[c1] == d[c1])
+					--c1;
+				t = glm::ivec4(std::min(t[0], row), std::min(t[1], c0), std::max(t[2], row), std::max(t[3], c1));
+			}
+		}
+		return t;
+	}
+
+	/// the texels of the tiles of a tiled height field whose hash differs from the one of the tiles before
+	static glm::ivec4 changed_tiles(const terrain& before, const terrain& now) {
+		const terrain_tiles& tn = *now.tiles;
+		if (!before.tiles || before.size_pix != now.size_pix || tn.tile_hashes().empty() || before.tiles->tile_hashes().size() != tn.tile_hashes().size())
+			return all_texels(now);
+		const std::vector<unsigned long long>& a = before.tiles->tile_hashes();
+		const std::vector<unsigned long long>& b = tn.tile_hashes();
+		const int T = terrain_tiles::TILE;
+		glm::ivec4 t(tn.height(), tn.width(), -1, -1);
+		for (size_t k = 0; k < b.size(); ++k)
+			if (a[k] != b[k]) {
+				const int it = int(k) / tn.tiles_across(), jt = int(k) % tn.tiles_across();
+				t = glm::ivec4(std::min(t[0], it * T), std::min(t[1], jt * T),
+					std::max(t[2], std::min((it + 1) * T, tn.height()) - 1), std::max(t[3], std::min((jt + 1) * T, tn.width()) - 1));
+			}
+		return t;
+	}
+
+	/// the part of the xz plane whose heights depend on the given texels, as (min x, min z, max x, max z)
+	static glm::vec4 region(const terrain& ter, const changes& c) {
+		// the height of a vertex is interpolated over one vertex around it. The border vertices also give the
+		// heights of everything past the border of the terrain
+		const int X = ter.size_pix[0], Z = ter.size_pix[1];
+		const glm::ivec4 v = c.vertices(X, Z, 1);
+		const float sx = ter.rect_xz[2] / X, sz = ter.rect_xz[3] / Z;
+		return glm::vec4(v[0] == 0 ? -FLT_MAX : ter.rect_xz[0] + v[0] * sx, v[1] == 0 ? -FLT_MAX : ter.rect_xz[1] + v[1] * sz,
+			v[2] == X - 1 ? FLT_MAX : ter.rect_xz[0] + v[2] * sx, v[3] == Z - 1 ? FLT_MAX : ter.rect_xz[1] + v[3] * sz);
+	}
+
+	static bool inside(const glm::vec4& area, const glm::vec3& p, float margin = 0.f) {
+		return p.x >= area[0] - margin && p.z >= area[1] - margin && p.x <= area[2] + margin && p.z <= area[3] + margin;
+	}
+
+	/// the frames of a carpath read the terrain up to a unit away from its samples (see carousel_loader::bake_carpath).
+	/// The samples lie on the Bezier segments, within the bounds of their control points
+	static bool crosses(const path& p, const std::vector<glm::vec3>& controlPoints, const glm::vec4& area) {
+		glm::vec4 bounds(FLT_MAX, FLT_MAX, -FLT_MAX, -FLT_MAX);
+		for (size_t i = 0; i < controlPoints.size(); ++i)
+			add(bounds, controlPoints[i]);
+		if (!overlaps(bounds, area, 1.f))
+			return false;
+		for (unsigned int i = 0; i < p.size(); ++i)
+			if (inside(area, p.position(i), 1.f))
+				return true;
+		return false;
+	}
+
+	/// put back on the terrain what the result of a shape has in area
+	static void reproject(carousel_loader::shape_result& sr, const terrain& ter, const glm::vec4& area) {
+		for (size_t i = 0; i < sr.trees.size(); ++i)
+			if (inside(area, sr.trees[i].pos))
+				sr.trees[i].pos = ter.p(sr.trees[i].pos);
+		for (size_t i = 0; i < sr.lamps.size(); ++i)
+			if (inside(area, sr.lamps[i].pos))
+				sr.lamps[i].pos = ter.p(sr.lamps[i].pos);
+		for (size_t i = 0; i < sr.cameramen.size(); ++i) {
+			glm::vec3 p(sr.cameramen[i].frame[3]);
+			if (inside(area, p))
+				sr.cameramen[i].frame[3] = glm::vec4(ter.p(p), 1.f);
+		}
+		for (int c = 0; c < 2; ++c)
+			for (size_t i = 0; i < sr.curbs[c].size(); ++i)
+				if (inside(area, sr.curbs[c][i]))
+					sr.curbs[c][i] = ter.p(sr.curbs[c][i]);
+	}
+
+	/// keep the cars on the carpaths baked again at the same fraction of the lap, and move the ones whose carpath is gone
+	static void move_cars(race& r, const race_scene& old, const race_scene& s, const std::vector<int>& rebaked) {
+		car_pool& pool = r._pool;
+		const int np = (int)s.carpaths.size();
+		std::vector<bool> moved(np, false);
+		for (size_t k = 0; k < rebaked.size(); ++k)
+			moved[rebaked[k]] = true;
+		pool.used.assign(np, false);
+		for (size_t i = 0; i < pool.size(); ++i) {
+			const int ip = pool.id_path[i];
+			const int np_i = (ip < np) ? ip : int(i % np);
+			if (np_i != ip || moved[np_i]) {
+				const int before = std::max((int)old.carpaths[ip].size(), 1);
+				const int now = std::max((int)s.carpaths[np_i].size(), 1);
+				pool.delta_i[i] = std::min(int((long long)pool.delta_i[i] * now / before), now - 1);
+				pool.id_path[i] = np_i;
+				r._cars[i].id_path = np_i;
+				r._cars[i].delta_i = pool.delta_i[i];
+			}
+			pool.used[np_i] = true;
+		}
+	}
+};
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+
+/**
+	A read only array whose elements are either its own or in memory kept alive by someone else, such as the mapping
+	of scene_cache: the elements are shared by the copies of the array, as terrain::height_field is. To change an
+	element, build a vector and assign it.
+*/
+template <class T>
+struct shared_array {
+	shared_array() :_size(0) {}
+
+	/// take the elements of v
+	void assign(std::vector<T>&& v) {
+		std::shared_ptr<std::vector<T> > own = std::make_shared<std::vector<T> >(std::move(v));
+		_size = own->size();
+		_data = std::shared_ptr<const T>(own, own->empty() ? 0 : &(*own)[0]);
+	}
+
+	/// the n elements at data, which stay valid as long as owner lives
+	void alias(const std::shared_ptr<const void>& owner, const T* data, size_t n) {
+		_size = n;
+		_data = std::shared_ptr<const T>(owner, n ? data : 0);
+	}
+
+	size_t size() const { return _size; }
+	bool empty() const { return _size == 0; }
+
+	const T& operator[](size_t i) const { return _data.get()[i]; }
+	const T* begin() const { return _data.get(); }
+	const T* end() const { return _data.get() + _size; }
+	const T& front() const { return _data.get()[0]; }
+	const T& back() const { return _data.get()[_size - 1]; }
+
+private:
+	std::shared_ptr<const T> _data;
+	size_t _size;
+};
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <chrono>
+
+/** @name Simulation clocks
+ *
+*/
+//@{
+
+/**
+	A sim_clock is the time source of a race. The race calls reset() when it starts and now() once per update;
+	now() returns the simulated milliseconds elapsed since the last reset.
+*/
+struct sim_clock {
+	virtual ~sim_clock() {}
+
+	/// restart counting from zero
+	virtual void reset() = 0;
+
+	/// milliseconds elapsed since the last reset
+	virtual long long now() = 0;
+};
+
+/**
+	Real (wall) time, independent of how much CPU time the process gets. This is the default clock of a race.
+*/
+struct wall_clock : public sim_clock {
+	wall_clock() { reset(); }
+
+	void reset() { start = std::chrono::steady_clock::now(); }
+
+	long long now() {
+		return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+	}
+
+private:
+	std::chrono::steady_clock::time_point start;
+};
+
+/**
+	Fixed timestep: every call to now() advances the time by step milliseconds, whatever the real time elapsed.
+	The first call after reset() returns 0. Use it to step a race headless faster (or slower) than real time.
+*/
+struct fixed_step_clock : public sim_clock {
+	fixed_step_clock(long long step_ms = 1000 / 30) :step(step_ms), t(0) {}
+
+	void reset() { t = 0; }
+
+	long long now() {
+		long long cur = t;
+		t += step;
+		return cur;
+	}
+
+	/// milliseconds added at each update
+	long long step;
+
+private:
+	long long t;
+};
+
+/**
+	Externally driven time: the owner sets or advances the time explicitly, now() just reports it.
+*/
+struct external_clock : public sim_clock {
+	external_clock() :t(0) {}
+
+	void reset() { t = 0; }
+
+	long long now() { return t; }
+
+	/// set the current time in milliseconds
+	void set(long long ms) { t = ms; }
+
+	/// advance the current time by ms milliseconds
+	void advance(long long ms) { t += ms; }
+
+private:
+	long long t;
+};
+
+//@}
@@ -0,0 +1,327 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <glm/glm.hpp>
+#include "..\box3.h"
+#include "..\thread_pool.h"
+#include "carousel.h"
+#include "terrain_mesh.h"
+
+/**
+	Chunked level of detail of a terrain: a quadtree whose nodes all have the same grid of CELLS x CELLS cells. The
+	leaves sample the height field at every texel, each level above at every other sample of the one below, so the root
+	covers the whole terrain with a single coarse grid. Each node knows its geometric error, a bound on the largest
+	vertical distance of its mesh from the full resolution one: its distance from the mesh of its children plus their error.
+
+	select() walks the tree for a view and keeps the coarsest nodes whose error projects to fewer than a given number of
+	pixels, skipping the ones outside the view. Adjacent nodes of different levels do not share their edge vertices: the
+	cracks between them are covered by skirts, strips hanging down from the edges of every node by more than the largest
+	gap an edge can have. The skirts lie under the surface, so only the cracks show them.
+
+	The vertices of all the nodes are in one array, VERTICES per node, and all the nodes share the same indices (see
+	TerrainLOD, which draws each selected node with a base vertex).
+*/
+struct terrain_chunks {
+	enum {
+		CELLS = 32,
+		SIDE = CELLS + 1,
+		GRID_VERTICES = SIDE * SIDE,
+		/// the grid, then the bottom of the skirts of the four edges (z = 0, x = CELLS, z = CELLS, x = 0)
+		VERTICES = GRID_VERTICES + 4 * SIDE,
+		/// floats per vertex, those of terrain_mesh
+		FLOATS = terrain_mesh::FLOATS
+	};
+
+	struct node {
+		/// the node samples every (1 << level) texels, leaves are level 0
+		int level;
+
+		/// vertex (ix, iz) of the terrain mesh at the corner of the node
+		glm::ivec2 origin;
+
+		/// of the full resolution surface the node covers (its skirts excluded)
+		box3 bbox;
+
+		/// of the node and of all the nodes below it
+		float error;
+
+		/// -1 where the quarter of the node is outside the terrain
+		int children[4];
+	};
+
+	/// nodes[0] is the root, the children of a node always come after it
+	std::vector<node> nodes;
+
+	/// FLOATS * VERTICES floats per node
+	std::vector<float> vertices;
+
+	/// the triangles of a node, indices of its vertices
+	std::vector<unsigned short> indices;
+
+	/// number of levels of the tree
+	int levels;
+
+	/// texture coordinates repeat tiles times across the terrain, like those of the full resolution mesh
+	void build(const terrain& ter, float tiles) {
+		_tiles = tiles;
+		nodes.clear();
+		const int X = ter.size_pix[0], Z = ter.size_pix[1];
+		const int leaves = std::max((X - 2) / CELLS + 1, (Z - 2) / CELLS + 1);
+		levels = 1;
+		while ((1 << (levels - 1)) < leaves)
+			++levels;
+		add_node(ter, levels - 1, glm::ivec2(0, 0));
+
+		build_indices();
+		vertices.resize(nodes.size() * VERTICES * FLOATS);
+		std::vector<int> all(nodes.size());
+		for (size_t i = 0; i < nodes.size(); ++i)
+			all[i] = int(i);
+		_root_error = -1.f;
+		compute(ter, all);
+	}
+
+	/**
+	 * build again the nodes that have one of the vertices (ix0, iz0) to (ix1, iz1), given as (ix0, iz0, ix1, iz1)
+	 * (see scene_watch::changes::vertices), and return them. The size of the height field must not have changed
+	 */
+	std::vector<int> rebuild(const terrain& ter, glm::ivec4 vertices) {
+		const glm::ivec2 lo(vertices[0], vertices[1]), hi(vertices[2], vertices[3]);
+		std::vector<int> changed;
+		if (lo.x > hi.x)
+			return changed;
+		for (size_t i = 0; i < nodes.size(); ++i) {
+			const node& n = nodes[i];
+			const int span = CELLS << n.level;
+			if (n.origin.x <= hi.x && n.origin.x + span >= lo.x && n.origin.y <= hi.y && n.origin.y + span >= lo.y)
+				changed.push_back(int(i));
+		}
+		if (!changed.empty() && compute(ter, changed)) {
+			changed.resize(nodes.size());
+			for (size_t i = 0; i < nodes.size(); ++i)
+				changed[i] = int(i);
+		}
+		return changed;
+	}
+
+	/**
+	 * the nodes to draw for the view view_proj (projection * view * model), rendered at the given resolution in pixels:
+	 * the coarsest ones whose error is within tolerance pixels on screen, among those inside the view frustum
+	 */
+	void select(const glm::mat4& view_proj, float resolution, float tolerance, std::vector<int>& out) const {
+		out.clear();
+		if (nodes.empty())
+			return;
+		// clip units per world unit at w = 1, in the worst direction
+		float scale = 0.f;
+		for (int c = 0; c < 3; ++c)
+			scale = std::max(scale, glm::length(glm::vec2(view_proj[c][0], view_proj[c][1])));
+		select(0, view_proj, scale * resolution * 0.5f, tolerance, out);
+	}
+
+	/// triangles drawn for the nodes in selection, skirts included
+	size_t triangles(const std::vector<int>& selection) const {
+		return selection.size() * (indices.size() / 3);
+	}
+
+	/// triangles of the full resolution mesh
+	static size_t full_triangles(const terrain& ter) {
+		return size_t(ter.size_pix[0] - 1) * (ter.size_pix[1] - 1) * 2;
+	}
+
+private:
+	float _tiles;
+
+	/// the error of the root the skirts were made for
+	float _root_error;
+
+	int add_node(const terrain& ter, int level, glm::ivec2 origin) {
+		if (origin.x >= ter.size_pix[0] - 1 || origin.y >= ter.size_pix[1] - 1)
+			return -1;
+		const int id = int(nodes.size());
+		nodes.push_back(node());
+		nodes[id].level = level;
+		nodes[id].origin = origin;
+		nodes[id].error = 0.f;
+		for (int c = 0; c < 4; ++c)
+			nodes[id].children[c] = -1;
+		if (level > 0) {
+			const int half = CELLS << (level - 1);
+			for (int c = 0; c < 4; ++c) {
+				const int child = add_node(ter, level - 1, origin + glm::ivec2((c & 1) * half, (c >> 1) * half));
+				nodes[id].children[c] = child;
+			}
+		}
+		return id;
+	}
+
+	/// two triangles per cell, as in terrain_mesh, and the skirts facing both ways
+	void build_indices() {
+		indices.clear();
+		for (int b = 0; b < CELLS; ++b)
+			for (int a = 0; a < CELLS; ++a) {
+				const unsigned short v00 = b * SIDE + a, v10 = v00 + 1, v01 = v00 + SIDE, v11 = v01 + 1;
+				const unsigned short quad[6] = { v00, v10, v11, v00, v11, v01 };
+				indices.insert(indices.end(), quad, quad + 6);
+			}
+		for (int e = 0; e < 4; ++e)
+			for (int k = 0; k < CELLS; ++k) {
+				const unsigned short t0 = edge_vertex(e, k), t1 = edge_vertex(e, k + 1);
+				const unsigned short b0 = GRID_VERTICES + e * SIDE + k, b1 = b0 + 1;
+				const unsigned short quad[12] = { t0, t1, b1, t0, b1, b0, t0, b1, t1, t0, b0, b1 };
+				indices.insert(indices.end(), quad, quad + 12);
+			}
+	}
+
+	/// grid vertex k along edge e, see VERTICES
+	static unsigned short edge_vertex(int e, int k) {
+		switch (e) {
+		case 0: return (unsigned short)k;
+		case 1: return (unsigned short)(k * SIDE + CELLS);
+		case 2: return (unsigned short)(CELLS * SIDE + k);
+		default: return (unsigned short)(k * SIDE);
+		}
+	}
+
+	static float height(const terrain& ter, int ix, int iz) {
+		return terrain_mesh::height(ter, ix, iz);
+	}
+
+	/// the errors of the given nodes, which include all the ancestors of those that changed, then their vertices.
+	/// Returns true if the error of the root changed, so that all the skirts have to be made again
+	bool compute(const terrain& ter, const std::vector<int>& ids) {
+		// a level at a time from the leaves up, a node needs the errors of its children
+		std::vector<int> at;
+		for (int level = 0; level < levels; ++level) {
+			at.clear();
+			for (size_t k = 0; k < ids.size(); ++k)
+				if (nodes[ids[k]].level == level)
+					at.push_back(ids[k]);
+			thread_pool::global().parallel_for(at.size(), [&](size_t k) { node_error(ter, at[k]); });
+		}
+
+		const bool root_changed = nodes[0].error != _root_error;
+		_root_error = nodes[0].error;
+		if (!root_changed)
+			thread_pool::global().parallel_for(ids.size(), [&](size_t k) { make_vertices(ter, ids[k]); });
+		else
+			thread_pool::global().parallel_for(nodes.size(), [&](size_t i) { make_vertices(ter, int(i)); });
+		return root_changed;
+	}
+
+	/**
+	 * the error of node id and the box of the surface it covers. A leaf has no error and takes the box of its texels.
+	 * A node above takes the box of its children and, as error, theirs plus the largest vertical distance of its
+	 * triangles from theirs, which is at the vertices of the children: so every node costs the same whatever its level
+	 */
+	void node_error(const terrain& ter, int id) {
+		node& n = nodes[id];
+		const int X = ter.size_pix[0], Z = ter.size_pix[1];
+		n.error = 0.f;
+		n.bbox = box3();
+		if (n.level == 0) {
+			for (int iz = n.origin.y; iz <= std::min(n.origin.y + CELLS, Z - 1); ++iz)
+				for (int ix = n.origin.x; ix <= std::min(n.origin.x + CELLS, X - 1); ++ix)
+					n.bbox.add(position(ter, ix, iz, height(ter, ix, iz)));
+			return;
+		}
+
+		float below = 0.f;
+		for (int c = 0; c < 4; ++c)
+			if (n.children[c] >= 0) {
+				below = std::max(below, nodes[n.children[c]].error);
+				n.bbox.add(nodes[n.children[c]].bbox);
+			}
+		const int step = 1 << n.level, half = step / 2;
+		for (int b = 0; b < CELLS; ++b) {
+			const int iz0 = std::min(n.origin.y + b * step, Z - 1), iz1 = std::min(iz0 + step, Z - 1);
+			if (b > 0 && iz0 == Z - 1)
+				break;
+			const int izs[3] = { iz0, std::min(iz0 + half, Z - 1), iz1 };
+			for (int a = 0; a < CELLS; ++a) {
+				const int ix0 = std::min(n.origin.x + a * step, X - 1), ix1 = std::min(ix0 + step, X - 1);
+				if (a > 0 && ix0 == X - 1)
+					break;
+				const int ixs[3] = { ix0, std::min(ix0 + half, X - 1), ix1 };
+				const float h00 = height(ter, ix0, iz0), h10 = height(ter, ix1, iz0);
+				const float h01 = height(ter, ix0, iz1), h11 = height(ter, ix1, iz1);
+				for (int j = 0; j < 3; ++j)
+					for (int i = 0; i < 3; ++i) {
+						// the cells are split along the diagonal from (ix0, iz0) to (ix1, iz1)
+						const float u = (ix1 > ix0) ? float(ixs[i] - ix0) / (ix1 - ix0) : 0.f;
+						const float v = (iz1 > iz0) ? float(izs[j] - iz0) / (iz1 - iz0) : 0.f;
+						const float mesh = (u >= v) ? h00 + u * (h10 - h00) + v * (h11 - h10) : h00 + v * (h01 - h00) + u * (h11 - h01);
+						n.error = std::max(n.error, fabsf(height(ter, ixs[i], izs[j]) - mesh));
+					}
+			}
+		}
+		n.error += below;
+	}
+
+	glm::vec3 position(const terrain& ter, int ix, int iz, float h) const {
+		return glm::vec3(ter.rect_xz[0] + (ix / float(ter.size_pix[0])) * ter.rect_xz[2], h,
+			ter.rect_xz[1] + (iz / float(ter.size_pix[1])) * ter.rect_xz[3]);
+	}
+
+	void make_vertices(const terrain& ter, int id) {
+		const node& n = nodes[id];
+		const int X = ter.size_pix[0], Z = ter.size_pix[1];
+		const int step = 1 << n.level;
+		float* out = &vertices[size_t(id) * VERTICES * FLOATS];
+		for (int b = 0; b < SIDE; ++b)
+			for (int a = 0; a < SIDE; ++a) {
+				// the vertex of the full resolution mesh, its normal included
+				const int ix = std::min(n.origin.x + a * step, X - 1), iz = std::min(n.origin.y + b * step, Z - 1);
+				terrain_mesh::vertex(ter, ix, iz, _tiles, out + (b * SIDE + a) * FLOATS);
+			}
+
+		// a crack is at most as deep as the errors of the two nodes on its sides, and no node has a larger error
+		// than the root. The edges on the border of the terrain get no skirt
+		const float depth = n.error + _root_error + 0.01f;
+		const int span = CELLS << n.level;
+		const bool border[4] = { n.origin.y == 0, n.origin.x + span >= X - 1, n.origin.y + span >= Z - 1, n.origin.x == 0 };
+		for (int e = 0; e < 4; ++e)
+			for (int k = 0; k < SIDE; ++k) {
+				float* v = out + (GRID_VERTICES + e * SIDE + k) * FLOATS;
+				std::copy(out + edge_vertex(e, k) * FLOATS, out + (edge_vertex(e, k) + 1) * FLOATS, v);
+				if (!border[e])
+					v[1] -= depth;
+			}
+	}
+
+	void select(int id, const glm::mat4& m, float pixels, float tolerance, std::vector<int>& out) const {
+		const node& n = nodes[id];
+		if (n.bbox.is_empty())
+			return;
+
+		// outside the frustum if all the corners are beyond the same plane
+		int outside[6] = { 0, 0, 0, 0, 0, 0 };
+		float w_min = 1e30f;
+		for (int c = 0; c < 8; ++c) {
+			const glm::vec4 p = m * glm::vec4((c & 1) ? n.bbox.max.x : n.bbox.min.x, (c & 2) ? n.bbox.max.y : n.bbox.min.y,
+				(c & 4) ? n.bbox.max.z : n.bbox.min.z, 1.f);
+			outside[0] += p.x < -p.w;
+			outside[1] += p.x > p.w;
+			outside[2] += p.y < -p.w;
+			outside[3] += p.y > p.w;
+			outside[4] += p.z < -p.w;
+			outside[5] += p.z > p.w;
+			w_min = std::min(w_min, p.w);
+		}
+		for (int k = 0; k < 6; ++k)
+			if (outside[k] == 8)
+				return;
+
+		// w is linear, so its smallest value over the box is at a corner: the error is never larger on screen
+		// than at that distance. Boxes reaching the plane of the eye are always refined
+		const bool leaf = n.level == 0;
+		if (!leaf && (w_min <= 1e-6f || n.error * pixels / w_min > tolerance)) {
+			for (int c = 0; c < 4; ++c)
+				if (n.children[c] >= 0)
+					select(n.children[c], m, pixels, tolerance, out);
+			return;
+		}
+		out.push_back(id);
+	}
+};
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <glm/glm.hpp>
+#include "..\thread_pool.h"
+#include "carousel.h"
+
+/**
+	Horizon of the terrain mesh along the plane the sun turns in. race::sun_at rotates the sun around the X axis, so
+	its direction is always in the YZ plane and a vertex of the terrain sees it if the sun is higher than the horizon
+	of the vertex towards -Z (where the sun is when its direction has a negative z) or towards +Z.
+
+	The horizon of a vertex only depends on the vertices with its same ix, a line of the image in memory (see
+	terrain::hf): every line is swept once per side keeping the upper convex hull of the vertices already passed,
+	whose tangent from the current vertex is its horizon, so a line of n vertices takes O(n).
+
+	The angles are stored as bytes, two per vertex (towards -Z, towards +Z), at index (ix * Z + iz) * 2: a texture
+	Z texels wide and X high. See encode for the scale.
+*/
+struct terrain_horizon {
+
+	/// byte of an angle in [-pi/2, pi/2] radians: 0 is straight down, 255 straight up, about 0.7 degrees per step
+	static unsigned char encode(float angle) {
+		const float v = (angle / 3.14159265f + 0.5f) * 255.f + 0.5f;
+		return (unsigned char)std::min(std::max(v, 0.f), 255.f);
+	}
+
+	/// angle in radians of a byte of encode
+	static float decode(unsigned char b) {
+		return (b / 255.f - 0.5f) * 3.14159265f;
+	}
+
+	/// encode(atan(slope)), without the arc tangent: the byte is the number of steps whose lower bound is below the slope
+	static unsigned char encode_slope(float slope) {
+		struct bounds {
+			float tan[255];
+			bounds() {
+				for (int b = 1; b < 256; ++b)
+					tan[b - 1] = tanf(((b - 0.5f) / 255.f - 0.5f) * 3.14159265f);
+			}
+		};
+		static const bounds steps;
+		return (unsigned char)(std::upper_bound(steps.tan, steps.tan + 255, slope) - steps.tan);
+	}
+
+	/// horizon of all the vertices into out, in parallel on the global thread pool
+	static void build(const terrain& ter, std::vector<unsigned char>& out) {
+		out.resize(size_t(ter.size_pix[0]) * ter.size_pix[1] * 2);
+		lines(ter, 0, ter.size_pix[0] - 1, out);
+	}
+
+	/// horizon of the lines of vertices [ix0, ix1] into out, already of the size build gives it
+	static void lines(const terrain& ter, int ix0, int ix1, std::vector<unsigned char>& out) {
+		const int X = ter.size_pix[0], Z = ter.size_pix[1];
+		if (ix1 < ix0 || Z == 0)
+			return;
+		const float dz = ter.rect_xz[3] / Z;
+		thread_pool::global().parallel_for(size_t(ix1 - ix0 + 1), [&](size_t i) {
+			const int ix = ix0 + int(i);
+			std::vector<glm::vec2> hull;
+			std::vector<float> h(Z);
+			// in memory, the vertices (ix, 0..Z-1) are a line of the image
+			if (!ter.tiles) {
+				const unsigned char* line = ter.height_field.get() + size_t(X - 1 - ix) * X;
+				for (int iz = 0; iz < Z; ++iz)
+					h[iz] = line[iz] / 50.f;
+			}
+			else
+				for (int iz = 0; iz < Z; ++iz)
+					h[iz] = ter.hf(ix, iz);
+			unsigned char* o = &out[size_t(ix) * Z * 2];
+			sweep(&h[0], Z, dz, 1, hull, o);
+			sweep(&h[0], Z, dz, -1, hull, o + 1);
+		}, 8);
+	}
+
+private:
+	/**
+	 * horizon of every vertex of a line towards the vertices before it (step 1: towards -Z) or after it (step -1:
+	 * towards +Z), written at out[2 * iz]. The hull keeps (z, height) of the vertices already passed
+	 */
+	static void sweep(const float* h, int n, float dz, int step, std::vector<glm::vec2>& hull, unsigned char* out) {
+		hull.clear();
+		const int first = (step > 0) ? 0 : n - 1;
+		for (int k = 0, iz = first; k < n; ++k, iz += step) {
+			const glm::vec2 p(iz * dz, h[iz]);
+			// the vertices of the hull under the line from p to the one before them can not be the horizon of
+			// p or of any vertex past it
+			while (hull.size() >= 2 && below(p, hull[hull.size() - 1], hull[hull.size() - 2]))
+				hull.pop_back();
+			out[2 * iz] = encode_slope(hull.empty() ? 0.f : slope(p, hull.back()));
+			hull.push_back(p);
+		}
+	}
+
+	/// rise over run from a to b, whichever side of a b is on
+	static float slope(glm::vec2 a, glm::vec2 b) {
+		return (b.y - a.y) / fabsf(b.x - a.x);
+	}
+
+	/// slope(p, a) <= slope(p, b), for a and b on the same side of p, without dividing
+	static bool below(glm::vec2 p, glm::vec2 a, glm::vec2 b) {
+		return (a.y - p.y) * fabsf(b.x - p.x) <= (b.y - p.y) * fabsf(a.x - p.x);
+	}
+};
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <vector>
+#include <glm/glm.hpp>
+#include "..\thread_pool.h"
+#include "carousel.h"
+
+/**
+	The full resolution mesh of a terrain: a vertex for each texel of the height field, two triangles for each cell.
+	Vertex (ix, iz) has the height hf(ix, iz) and comes at index iz * X + ix, with its position, normal and texture
+	coordinates interleaved (FLOATS floats). The builders read the terrain in place and write into buffers allocated
+	once; the rows of vertices are built in parallel on the global thread pool.
+*/
+struct terrain_mesh {
+	enum {
+		/// position, normal, texture coordinates
+		FLOATS = 8
+	};
+
+	/// vertex (ix, iz) into out[0, FLOATS). The texture coordinates repeat tiles times across the terrain
+	static void vertex(const terrain& ter, int ix, int iz, float tiles, float* out) {
+		const int X = ter.size_pix[0], Z = ter.size_pix[1];
+		out[0] = ter.rect_xz[0] + (ix / float(X)) * ter.rect_xz[2];
+		out[1] = height(ter, ix, iz);
+		out[2] = ter.rect_xz[1] + (iz / float(Z)) * ter.rect_xz[3];
+		out[3] = (height(ter, ix - 1, iz) - height(ter, ix + 1, iz)) / 2.f;
+		out[4] = 1.f;
+		out[5] = (height(ter, ix, iz - 1) - height(ter, ix, iz + 1)) / 2.f;
+		out[6] = tiles * ix / float(X);
+		out[7] = tiles * iz / float(Z);
+	}
+
+	/// vertices [ix0, ix1] of row iz into out, FLOATS floats each
+	static void row(const terrain& ter, int iz, int ix0, int ix1, float tiles, float* out) {
+		if (ter.tiles) {
+			for (int ix = ix0; ix <= ix1; ++ix, out += FLOATS)
+				vertex(ter, ix, iz, tiles, out);
+			return;
+		}
+
+		// in memory, the row of vertices is the column iz of the image, read bottom up (see terrain::hf)
+		const int X = ter.size_pix[0], Z = ter.size_pix[1];
+		const unsigned char* data = ter.height_field.get();
+		const int zd = std::max(iz - 1, 0), zu = std::min(iz + 1, Z - 1);
+		for (int ix = ix0; ix <= ix1; ++ix, out += FLOATS) {
+			const unsigned char* t = data + size_t(X - 1 - ix) * X;
+			const unsigned char* tl = data + size_t(X - 1 - std::max(ix - 1, 0)) * X;
+			const unsigned char* tr = data + size_t(X - 1 - std::min(ix + 1, X - 1)) * X;
+			out[0] = ter.rect_xz[0] + (ix / float(X)) * ter.rect_xz[2];
+			out[1] = t[iz] / 50.f;
+			out[2] = ter.rect_xz[1] + (iz / float(Z)) * ter.rect_xz[3];
+			out[3] = (tl[iz] / 50.f - tr[iz] / 50.f) / 2.f;
+			out[4] = 1.f;
+			out[5] = (t[zd] / 50.f - t[zu] / 50.f) / 2.f;
+			out[6] = tiles * ix / float(X);
+			out[7] = tiles * iz / float(Z);
+		}
+	}
+
+	/// all the vertices, see row
+	static void vertices(const terrain& ter, float tiles, std::vector<float>& out) {
+		const int X = ter.size_pix[0], Z = ter.size_pix[1];
+		out.resize(size_t(X) * Z * FLOATS);
+		float* base = out.empty() ? 0 : &out[0];
+		// blocks of rows, so that a worker reuses the image lines it reads for the neighbouring rows
+		thread_pool::global().parallel_for(Z, [&](size_t iz) {
+			row(ter, int(iz), 0, X - 1, tiles, base + size_t(iz) * X * FLOATS);
+		}, 32);
+	}
+
+	/// two triangles per cell, the diagonal from (ix, iz) to (ix + 1, iz + 1)
+	static void indices(const terrain& ter, std::vector<unsigned int>& out) {
+		const unsigned int X = ter.size_pix[0], Z = ter.size_pix[1];
+		out.resize(size_t(X - 1) * (Z - 1) * 6);
+		unsigned int* o = out.empty() ? 0 : &out[0];
+		for (unsigned int iz = 0; iz + 1 < Z; ++iz)
+			for (unsigned int ix = 0; ix + 1 < X; ++ix, o += 6) {
+				o[0] = iz * X + ix;
+				o[1] = iz * X + ix + 1;
+				o[2] = (iz + 1) * X + ix + 1;
+				o[3] = iz * X + ix;
+				o[4] = (iz + 1) * X + ix + 1;
+				o[5] = (iz + 1) * X + ix;
+			}
+	}
+
+	/// height of vertex (ix, iz), clamped to the terrain
+	static float height(const terrain& ter, int ix, int iz) {
+		return ter.hf(std::min(std::max(ix, 0), ter.size_pix[0] - 1), std::min(std::max(iz, 0), ter.size_pix[1] - 1));
+	}
+};
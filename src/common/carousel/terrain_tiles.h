@@ -0,0 +1,242 @@
+#pragma once
+
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <list>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include "..\mapped_file.h"
+#include "..\hash64.h"
+
+/**
+	Height field stored as fixed size tiles in a file, for terrains too large to be decoded and kept in memory as a
+	whole. Opening reads only the header; a tile is mapped the first time one of its texels is read and stays
+	mapped in an LRU cache of at most capacity tiles, so the memory taken does not depend on the size of the terrain.
+	Every thread remembers the tile it read last in a slot of the instance, which the cache empties before unmapping
+	the tile, so no tile stays mapped past its eviction or the instance.
+
+	layout (".tiles"): "CRTL" u32 version u32 width u32 height u32 tile size, padded to HEADER_BYTES, then the tiles
+	in row major order, TILE x TILE bytes each, then the hash of each tile (u64, see hash), which tells the tiles an
+	edit changed without reading them. The texels past the border of the terrain repeat the last row and column.
+	Every tile starts at a multiple of 64 KB, so that it can be mapped on its own. Version 1 files have no hashes.
+*/
+struct terrain_tiles {
+	enum { VERSION = 2, TILE = 256, TILE_BYTES = TILE * TILE, HEADER_BYTES = 1 << 16 };
+
+	terrain_tiles() :_width(0), _height(0), tiles_x(0), tiles_y(0), capacity(0), _misses(0) {}
+
+	/**
+	 * write a width x height height field, rows of width bytes, in the tiled format.
+	 * The file is written under a temporary name and renamed, so the tiles a terrain has mapped from the file it
+	 * replaces stay valid, and a reader never sees it half written
+	 */
+	static bool write(const char* filename, const unsigned char* data, int width, int height) {
+		const std::string tmp = std::string(filename) + ".tmp";
+		FILE* f = fopen(tmp.c_str(), "wb");
+		if (!f)
+			return false;
+		std::vector<unsigned char> block(HEADER_BYTES, 0);
+		const unsigned int header[4] = { (unsigned int)VERSION, (unsigned int)width, (unsigned int)height, (unsigned int)TILE };
+		memcpy(&block[0], "CRTL", 4);
+		memcpy(&block[4], header, sizeof(header));
+		bool written = fwrite(&block[0], 1, block.size(), f) == block.size();
+
+		block.resize(TILE_BYTES);
+		const int tx = (width + TILE - 1) / TILE, ty = (height + TILE - 1) / TILE;
+		std::vector<unsigned long long> hashes;
+		for (int it = 0; it < ty && written; ++it)
+			for (int jt = 0; jt < tx && written; ++jt) {
+				for (int r = 0; r < TILE; ++r) {
+					const int row = std::min(it * TILE + r, height - 1);
+					for (int c = 0; c < TILE; ++c)
+						block[r * TILE + c] = data[size_t(row) * width + std::min(jt * TILE + c, width - 1)];
+				}
+				written = fwrite(&block[0], 1, block.size(), f) == block.size();
+				hashes.push_back(hash(&block[0], block.size()));
+			}
+		if (written && !hashes.empty())
+			written = fwrite(&hashes[0], sizeof(hashes[0]), hashes.size(), f) == hashes.size();
+		written = (fclose(f) == 0) && written;
+		if (!written) {
+			remove(tmp.c_str());
+			return false;
+		}
+		remove(filename);
+		return rename(tmp.c_str(), filename) == 0;
+	}
+
+	/**
+	 * open a tiled height field, only the header is read
+	 * @param max_tiles how many tiles are kept mapped at most
+	 */
+	bool open(const char* filename, size_t max_tiles = 64) {
+		FILE* f = fopen(filename, "rb");
+		if (!f)
+			return false;
+		char magic[4];
+		unsigned int header[4];
+		bool ok = fread(magic, 1, 4, f) == 4 && fread(header, sizeof(unsigned int), 4, f) == 4;
+		fclose(f);
+		if (!ok || memcmp(magic, "CRTL", 4) != 0 || (header[0] != 1 && header[0] != VERSION) || header[3] != TILE || header[1] == 0 || header[2] == 0)
+			return false;
+		const int tx = (int(header[1]) + TILE - 1) / TILE, ty = (int(header[2]) + TILE - 1) / TILE;
+		std::vector<unsigned long long> hashes;
+		if (header[0] == VERSION) {
+			const size_t n = size_t(tx) * ty;
+			mapped_file m(filename, HEADER_BYTES + (unsigned long long)n * TILE_BYTES, n * sizeof(unsigned long long));
+			if (!m.is_open() || m.size() < n * sizeof(unsigned long long))
+				return false;
+			hashes.resize(n);
+			memcpy(&hashes[0], m.data(), n * sizeof(unsigned long long));
+		}
+
+		std::lock_guard<std::mutex> lock(mutex);
+		file = filename;
+		_width = int(header[1]);
+		_height = int(header[2]);
+		tiles_x = tx;
+		tiles_y = ty;
+		_hashes.swap(hashes);
+		capacity = std::max<size_t>(max_tiles, 1);
+		for (int i = 0; i < SLOTS; ++i)
+			forget(slots[i], -1);
+		lru.clear();
+		cached.clear();
+		_misses = 0;
+		return true;
+	}
+
+	const std::string& filename() const { return file; }
+
+	/// the hash of each tile, in row major order. Empty for a version 1 file
+	const std::vector<unsigned long long>& tile_hashes() const { return _hashes; }
+	int tiles_across() const { return tiles_x; }
+
+	/// hash of n bytes: the one of the tiles, also used to compare row blocks of flat height fields
+	static unsigned long long hash(const unsigned char* data, size_t n) {
+		return hash64::bytes(hash64::basis() ^ n, data, n);
+	}
+	int width() const { return _width; }
+	int height() const { return _height; }
+
+	/// the texel at row, col of the height field, clamped to its border. 0 if the tile cannot be mapped
+	unsigned char texel(int row, int col) const {
+		row = std::min(std::max(row, 0), _height - 1);
+		col = std::min(std::max(col, 0), _width - 1);
+		const int it = (row / TILE) * tiles_x + col / TILE;
+
+		// the tile of the last lookup of this thread, which is often the one of the next: only the slot of the
+		// thread is taken, which the cache takes too before it unmaps the tile
+		slot& s = slots[thread_slot()];
+		hold(s);
+		if (s.it != it) {
+			s.busy.clear(std::memory_order_release);
+			tile(it, s);
+		}
+		const unsigned char t = s.data ? s.data[(row % TILE) * TILE + col % TILE] : 0;
+		s.busy.clear(std::memory_order_release);
+		return t;
+	}
+
+	/// number of tiles mapped now
+	size_t resident() const {
+		std::lock_guard<std::mutex> lock(mutex);
+		return cached.size();
+	}
+
+	/// number of times a tile had to be mapped
+	size_t misses() const {
+		std::lock_guard<std::mutex> lock(mutex);
+		return _misses;
+	}
+
+private:
+	typedef std::list<int> lru_list;
+
+	std::string file;
+	int _width, _height, tiles_x, tiles_y;
+	std::vector<unsigned long long> _hashes;
+	size_t capacity;
+
+	mutable std::mutex mutex;
+
+	/// mapped tiles, most recently used first
+	mutable lru_list lru;
+	mutable std::unordered_map<int, std::pair<lru_list::iterator, std::shared_ptr<const mapped_file> > > cached;
+	mutable size_t _misses;
+
+	enum { SLOTS = 64 };
+
+	/// the tile a thread read last, see texel. busy is held while the tile is read or changed. A cache line each
+	struct slot {
+		slot() :it(-1), data(0) { busy.clear(); }
+		std::atomic_flag busy;
+		int it;
+		const unsigned char* data;
+		char pad[64 - 2 * sizeof(void*)];
+	};
+	mutable slot slots[SLOTS];
+
+	/// the slot of the calling thread. Threads past SLOTS share them
+	static int thread_slot() {
+		static std::atomic<unsigned int> threads(0);
+		static thread_local int s = int(threads++ % SLOTS);
+		return s;
+	}
+
+	/// wait for slot s and take it
+	static void hold(slot& s) {
+		while (s.busy.test_and_set(std::memory_order_acquire))
+			std::this_thread::yield();
+	}
+
+	/// empty slot s if it holds tile it (-1: any), waiting for its reader
+	static void forget(slot& s, int it) {
+		hold(s);
+		if (it == -1 || s.it == it) {
+			s.it = -1;
+			s.data = 0;
+		}
+		s.busy.clear(std::memory_order_release);
+	}
+
+	/// make tile it, mapped if needed, the tile of slot s, and return with s held. The data of s is 0 if the tile
+	/// cannot be mapped
+	void tile(int it, slot& s) const {
+		std::lock_guard<std::mutex> lock(mutex);
+		const unsigned char* data = 0;
+		auto c = cached.find(it);
+		if (c != cached.end()) {
+			lru.splice(lru.begin(), lru, c->second.first);
+			data = c->second.second->data();
+		}
+		else {
+			++_misses;
+			if (cached.size() >= capacity) {
+				// no slot may point into the tile once it is unmapped
+				for (int i = 0; i < SLOTS; ++i)
+					forget(slots[i], lru.back());
+				cached.erase(lru.back());
+				lru.pop_back();
+			}
+			std::shared_ptr<mapped_file> m = std::make_shared<mapped_file>(file.c_str(), HEADER_BYTES + (unsigned long long)it * TILE_BYTES, (size_t)TILE_BYTES);
+			if (m->is_open() && m->size() >= (size_t)TILE_BYTES) {
+				lru.push_front(it);
+				cached[it] = std::make_pair(lru.begin(), std::shared_ptr<const mapped_file>(m));
+				data = m->data();
+			}
+		}
+		hold(s);
+		s.it = it;
+		s.data = data;
+	}
+
+	terrain_tiles(const terrain_tiles&);
+	terrain_tiles& operator=(const terrain_tiles&);
+};
@@ -5,6 +5,7 @@
 #include "texture.h"
 #include "renderable.h"
 #include "debugging.h"
+#include "load_profile.h"
 
 struct gltf_loader {
 
@@ -295,8 +296,16 @@ struct gltf_loader {
 	void load_to_renderable(std::string input_filename, std::vector<renderable> & _renderable, box3 & bbox) {
 		reset();
 		std::cout << "Loading model " << input_filename << "... ";
-		load(input_filename);
-		create_renderable(_renderable, bbox);
+		load_profile::phase loading(("gltf_loader::load_to_renderable " + input_filename).c_str());
+		{
+			load_profile::phase parse("parse");
+			load(input_filename);
+			parse.read_file(input_filename.c_str());
+		}
+		{
+			load_profile::phase upload("create_renderable");
+			create_renderable(_renderable, bbox);
+		}
 		std::cout << "done" << std::endl;
 	}
 
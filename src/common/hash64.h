@@ -0,0 +1,30 @@
+#pragma once
+
+#include <stddef.h>
+#include <string.h>
+
+/**
+	64 bit hash of bytes, 8 at a time: FNV-1a on words, with the high bits folded back after each multiply so that
+	they reach the low ones. Used for the keys of scene_cache, the sources of the svg shapes (svg_stream) and the
+	tiles and row blocks of the height fields (terrain_tiles, scene_watch). Not meant to resist collisions on purpose.
+*/
+struct hash64 {
+	/// the FNV offset basis, the value to start a hash from
+	static unsigned long long basis() { return 14695981039346656037ULL; }
+
+	/// h updated with the n bytes at data. Hashing a buffer in parts gives the hash of the whole if every part but
+	/// the last is a multiple of 8 bytes long
+	static unsigned long long bytes(unsigned long long h, const void* data, size_t n) {
+		const unsigned char* p = (const unsigned char*)data;
+		size_t i = 0;
+		for (; i + 8 <= n; i += 8) {
+			unsigned long long w;
+			memcpy(&w, p + i, 8);
+			h = (h ^ w) * 1099511628211ULL;
+			h ^= h >> 29;
+		}
+		for (; i < n; ++i)
+			h = (h ^ p[i]) * 1099511628211ULL;
+		return h;
+	}
+};
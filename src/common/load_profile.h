@@ -0,0 +1,264 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <new>
+#include <sys/stat.h>
+
+/**
+	Startup profile: wall time, bytes read and heap usage of each loading phase, written as JSON to follow startup
+	regressions over time. A phase is timed by a load_profile::phase object; phases opened while another one is open
+	on the same thread are its children. Work handed to other threads names its parent explicitly (see current()).
+	Phases with the same name and parent are merged: their times and bytes are summed and their count is reported.
+
+	The heap is measured by replacing the global operator new and delete, which is done only in the translation unit
+	that defines LOAD_PROFILE_IMPLEMENTATION before including this header. Otherwise the heap fields are 0.
+*/
+struct load_profile {
+
+	/// the profile of the process
+	static load_profile& global() {
+		static load_profile p;
+		return p;
+	}
+
+	/// times the scope it lives in, see load_profile
+	struct phase {
+		/// @param parent the phase this one belongs to, -1 for the innermost open phase of this thread
+		phase(const char* name, int parent = -1) :id(global().open(name, parent)) {}
+		~phase() { global().close(id); }
+
+		/// count n bytes read by this phase
+		void read(unsigned long long n) { global().read(id, n); }
+
+		/// count the size of a file read by this phase
+		void read_file(const char* filename) { read(file_size(filename)); }
+
+		const int id;
+	private:
+		phase(const phase&);
+		phase& operator=(const phase&);
+	};
+
+	/// innermost open phase of the calling thread, -1 if none
+	static int current() {
+		std::vector<int>& open = open_phases();
+		return open.empty() ? -1 : open.back();
+	}
+
+	static unsigned long long file_size(const char* filename) {
+		struct stat st;
+		return (stat(filename, &st) == 0) ? (unsigned long long)st.st_size : 0;
+	}
+
+	/// bytes allocated with operator new and not yet released
+	static long long heap() { return heap_now().load(std::memory_order_relaxed); }
+
+	/// are allocations counted, see LOAD_PROFILE_IMPLEMENTATION
+	static bool& tracking() { static bool t = false; return t; }
+
+	/// the phases as a JSON document
+	std::string json() const {
+		std::lock_guard<std::mutex> lock(m);
+		std::string s = "{\n  \"allocations_tracked\": ";
+		s += tracking() ? "true" : "false";
+		s += ",\n  \"phases\": ";
+		write_children(s, -1, 1);
+		s += "\n}\n";
+		return s;
+	}
+
+	bool write(const char* filename) const {
+		FILE* f = fopen(filename, "w");
+		if (!f)
+			return false;
+		std::string s = json();
+		bool written = fwrite(s.c_str(), 1, s.size(), f) == s.size();
+		return (fclose(f) == 0) && written;
+	}
+
+	// allocation counters, used by the operator new and delete of LOAD_PROFILE_IMPLEMENTATION
+	static std::atomic<long long>& heap_now() { static std::atomic<long long> h(0); return h; }
+	static std::atomic<long long>& heap_peak() { static std::atomic<long long> h(0); return h; }
+
+	static void allocated(long long n) {
+		long long now = heap_now().fetch_add(n, std::memory_order_relaxed) + n;
+		long long peak = heap_peak().load(std::memory_order_relaxed);
+		while (now > peak && !heap_peak().compare_exchange_weak(peak, now, std::memory_order_relaxed)) {}
+	}
+
+	static void released(long long n) { heap_now().fetch_sub(n, std::memory_order_relaxed); }
+
+private:
+	typedef std::chrono::steady_clock clock;
+
+	struct record {
+		std::string name;
+		int parent;
+		int count, running;
+		double start_ms, ms;
+		unsigned long long bytes_read;
+		long long heap_start, heap_peak;
+
+		/// while running: the peak of the heap before the phase opened, restored when it closes
+		long long saved_peak;
+		clock::time_point started;
+	};
+
+	mutable std::mutex m;
+	std::vector<record> records;
+	std::map<std::pair<int, std::string>, int> by_name;
+	clock::time_point t0;
+
+	load_profile() :t0(clock::now()) {}
+
+	static std::vector<int>& open_phases() {
+		static thread_local std::vector<int> open;
+		return open;
+	}
+
+	int open(const char* name, int parent) {
+		if (parent < 0)
+			parent = current();
+		std::lock_guard<std::mutex> lock(m);
+		std::pair<int, std::string> key(parent, name);
+		std::map<std::pair<int, std::string>, int>::iterator it = by_name.find(key);
+		int id;
+		if (it == by_name.end()) {
+			id = int(records.size());
+			by_name[key] = id;
+			record r;
+			r.name = name;
+			r.parent = parent;
+			r.count = r.running = 0;
+			r.start_ms = std::chrono::duration<double, std::milli>(clock::now() - t0).count();
+			r.ms = 0.0;
+			r.bytes_read = 0;
+			r.heap_start = heap();
+			r.heap_peak = r.heap_start;
+			records.push_back(r);
+		}
+		else
+			id = it->second;
+
+		record& r = records[id];
+		if (r.running++ == 0) {
+			// the peak is measured from here: exact for nested phases, an upper bound for overlapping ones
+			r.started = clock::now();
+			r.saved_peak = heap_peak().exchange(heap());
+		}
+		open_phases().push_back(id);
+		return id;
+	}
+
+	void close(int id) {
+		std::vector<int>& open = open_phases();
+		if (!open.empty() && open.back() == id)
+			open.pop_back();
+		std::lock_guard<std::mutex> lock(m);
+		record& r = records[id];
+		++r.count;
+		if (--r.running == 0) {
+			r.ms += std::chrono::duration<double, std::milli>(clock::now() - r.started).count();
+			long long peak = heap_peak().load();
+			r.heap_peak = std::max(r.heap_peak, peak);
+			long long p = peak;
+			while (r.saved_peak > p && !heap_peak().compare_exchange_weak(p, r.saved_peak)) {}
+		}
+	}
+
+	void read(int id, unsigned long long n) {
+		std::lock_guard<std::mutex> lock(m);
+		for (; id >= 0; id = records[id].parent)
+			records[id].bytes_read += n;
+	}
+
+	void write_children(std::string& s, int parent, int depth) const {
+		const std::string indent(2 * depth, ' ');
+		s += "[";
+		bool first = true;
+		for (size_t i = 0; i < records.size(); ++i) {
+			const record& r = records[i];
+			if (r.parent != parent)
+				continue;
+			char buf[512];
+			snprintf(buf, sizeof(buf), "%s\n%s  { \"name\": \"%s\", \"count\": %d, \"start_ms\": %.3f, \"ms\": %.3f, "
+				"\"bytes_read\": %llu, \"heap_start\": %lld, \"heap_peak\": %lld, \"children\": ",
+				first ? "" : ",", indent.c_str(), escaped(r.name).c_str(), r.count, r.start_ms, r.ms, r.bytes_read,
+				r.heap_start, r.heap_peak);
+			s += buf;
+			write_children(s, int(i), depth + 1);
+			s += " }";
+			first = false;
+		}
+		if (!first)
+			s += "\n" + indent;
+		s += "]";
+	}
+
+	static std::string escaped(const std::string& name) {
+		std::string e;
+		for (size_t i = 0; i < name.size(); ++i) {
+			if (name[i] == '"' || name[i] == '\\')
+				e += '\\';
+			e += (name[i] < ' ') ? ' ' : name[i];
+		}
+		return e;
+	}
+};
+
+#ifdef LOAD_PROFILE_IMPLEMENTATION
+// every block carries its size in front, aligned as operator new requires
+namespace load_profile_heap {
+	const size_t HEADER = alignof(std::max_align_t) > sizeof(size_t) ? alignof(std::max_align_t) : sizeof(size_t);
+
+	inline void* allocate(size_t n) {
+		unsigned char* p = (unsigned char*)malloc(n + HEADER);
+		if (!p)
+			return 0;
+		*(size_t*)p = n;
+		load_profile::allocated((long long)n);
+		return p + HEADER;
+	}
+
+	inline void release(void* q) {
+		if (!q)
+			return;
+		unsigned char* p = (unsigned char*)q - HEADER;
+		load_profile::released((long long)*(size_t*)p);
+		free(p);
+	}
+
+	struct enable { enable() { load_profile::tracking() = true; } };
+	static enable enabled;
+}
+
+void* operator new(size_t n) {
+	void* p = load_profile_heap::allocate(n);
+	if (!p)
+		throw std::bad_alloc();
+	return p;
+}
+void* operator new[](size_t n) {
+	void* p = load_profile_heap::allocate(n);
+	if (!p)
+		throw std::bad_alloc();
+	return p;
+}
+void* operator new(size_t n, const std::nothrow_t&) noexcept { return load_profile_heap::allocate(n); }
+void* operator new[](size_t n, const std::nothrow_t&) noexcept { return load_profile_heap::allocate(n); }
+void operator delete(void* p) noexcept { load_profile_heap::release(p); }
+void operator delete[](void* p) noexcept { load_profile_heap::release(p); }
+void operator delete(void* p, size_t) noexcept { load_profile_heap::release(p); }
+void operator delete[](void* p, size_t) noexcept { load_profile_heap::release(p); }
+void operator delete(void* p, const std::nothrow_t&) noexcept { load_profile_heap::release(p); }
+void operator delete[](void* p, const std::nothrow_t&) noexcept { load_profile_heap::release(p); }
+#endif
@@ -0,0 +1,122 @@
+#pragma once
+
+#include <stddef.h>
+
+#if defined(_WIN32)
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+/**
+	A file, or a range of it, mapped read only in memory. The mapping is released when the object is destroyed, so pointers
+	into data() must not outlive it; hold the object in a shared_ptr to share the mapping.
+*/
+struct mapped_file {
+	mapped_file() :_data(0), _size(0) { init_handles(); }
+	mapped_file(const char* filename) :_data(0), _size(0) { init_handles(); open(filename); }
+	mapped_file(const char* filename, unsigned long long offset, size_t length) :_data(0), _size(0) { init_handles(); open(filename, offset, length); }
+	~mapped_file() { close(); }
+
+	/// map the whole file
+	bool open(const char* filename) { return open(filename, 0, 0); }
+
+	/**
+	 * map length bytes from offset (0: up to the end of the file). The offset must be a multiple of 65536,
+	 * the allocation granularity of Windows, which is also a multiple of the page size elsewhere
+	 */
+	bool open(const char* filename, unsigned long long offset, size_t length) {
+		close();
+#if defined(_WIN32)
+		file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+		if (file == INVALID_HANDLE_VALUE)
+			return false;
+		LARGE_INTEGER size;
+		if (!GetFileSizeEx(file, &size) || (unsigned long long)size.QuadPart <= offset) {
+			close();
+			return false;
+		}
+		if (length == 0 || offset + length > (unsigned long long)size.QuadPart)
+			length = (size_t)(size.QuadPart - offset);
+		mapping = CreateFileMappingA(file, 0, PAGE_READONLY, 0, 0, 0);
+		if (!mapping) {
+			close();
+			return false;
+		}
+		_data = (const unsigned char*)MapViewOfFile(mapping, FILE_MAP_READ, DWORD(offset >> 32), DWORD(offset & 0xffffffff), length);
+		if (!_data) {
+			close();
+			return false;
+		}
+		_size = length;
+#else
+		fd = ::open(filename, O_RDONLY);
+		if (fd == -1)
+			return false;
+		struct stat st;
+		if (fstat(fd, &st) != 0 || (unsigned long long)st.st_size <= offset) {
+			close();
+			return false;
+		}
+		if (length == 0 || offset + length > (unsigned long long)st.st_size)
+			length = (size_t)(st.st_size - offset);
+		void* p = mmap(0, length, PROT_READ, MAP_PRIVATE, fd, (off_t)offset);
+		if (p == MAP_FAILED) {
+			close();
+			return false;
+		}
+		_data = (const unsigned char*)p;
+		_size = length;
+#endif
+		return true;
+	}
+
+	void close() {
+#if defined(_WIN32)
+		if (_data)
+			UnmapViewOfFile(_data);
+		if (mapping)
+			CloseHandle(mapping);
+		if (file != INVALID_HANDLE_VALUE)
+			CloseHandle(file);
+#else
+		if (_data)
+			munmap((void*)_data, _size);
+		if (fd != -1)
+			::close(fd);
+#endif
+		_data = 0;
+		_size = 0;
+		init_handles();
+	}
+
+	bool is_open() const { return _data != 0; }
+
+	const unsigned char* data() const { return _data; }
+
+	size_t size() const { return _size; }
+
+private:
+	const unsigned char* _data;
+	size_t _size;
+
+#if defined(_WIN32)
+	HANDLE file, mapping;
+	void init_handles() { file = INVALID_HANDLE_VALUE; mapping = 0; }
+#else
+	int fd;
+	void init_handles() { fd = -1; }
+#endif
+
+	mapped_file(const mapped_file&);
+	mapped_file& operator=(const mapped_file&);
+};
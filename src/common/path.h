@@ -2,8 +2,14 @@
 
 #include <iostream>
 #include <vector>
+#include <algorithm>
+#include <cmath>
 #include <glm/glm.hpp>
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define BEZIER_SSE2
+#endif
  
 
 struct bezier_path {
@@ -33,7 +39,11 @@ struct bezier_path {
             3.f * (controlPoints[3].z - controlPoints[2].z) * t2;
     }
 
-    static void regular_sampling( const std::vector<glm::vec3>& controlPoints, double delta, std::vector<glm::vec3>&samples, std::vector<glm::vec3>& tans,float * tot=0) {
+    /**
+     * samples at (about) every delta along the path, found by walking each segment with a fixed step of the parameter.
+     * Kept as a reference for regular_sampling, see main_bench
+     */
+    static void fixed_step_sampling( const std::vector<glm::vec3>& controlPoints, double delta, std::vector<glm::vec3>&samples, std::vector<glm::vec3>& tans,float * tot=0) {
   
         float eps = 0.001f;
         float residual = 0.f;
@@ -76,4 +86,204 @@ struct bezier_path {
             *tot = l;
     }
 
-};
\ No newline at end of file
+    /// length of the path, within rel_tol
+    static float length(const std::vector<glm::vec3>& controlPoints, float rel_tol = 1e-4f) {
+        double l = 0.0;
+        for (unsigned int ib = 0; ib + 3 < controlPoints.size(); ib += 3) {
+            float whole = segment_length(&controlPoints[ib], 0.f, 1.f);
+            l += adaptive_length(&controlPoints[ib], 0.f, 1.f, whole, rel_tol * std::max(whole, 1e-6f), 0);
+        }
+        return float(l);
+    }
+
+    /**
+     * samples every delta along the path, by arc length: the first sample is the start of the path, the last one is
+     * less than delta from its end. Segment lengths come from adaptive Gauss-Legendre quadrature; each sample is found
+     * from the previous one with Newton steps on the length, so consecutive samples are delta apart along the curve
+     * within rel_tol * delta.
+     * @param tot if given, the length of the whole path
+     */
+    static void regular_sampling( const std::vector<glm::vec3>& controlPoints, double delta, std::vector<glm::vec3>&samples, std::vector<glm::vec3>& tans,float * tot=0, float rel_tol = 1e-3f) {
+        if (controlPoints.size() < 4 || delta <= 0.0)
+            return;
+
+        // arc length at the start of each segment
+        const float tol = float(delta) * rel_tol * 0.25f;
+        const int n_seg = int(controlPoints.size() - 1) / 3;
+        std::vector<double> start(n_seg + 1, 0.0);
+        for (int j = 0; j < n_seg; ++j) {
+            const glm::vec3* bz = &controlPoints[j * 3];
+            start[j + 1] = start[j] + adaptive_length(bz, 0.f, 1.f, segment_length(bz, 0.f, 1.f), tol, 0);
+        }
+        const double total = start[n_seg];
+
+        // segment and parameter of each sample. s is the arc length at (j,t), errors included, so that they do not add up
+        std::vector<int> seg;
+        std::vector<float> par;
+        int j = 0;
+        float t = 0.f;
+        double s = 0.0;
+        for (long long i = 0; i * delta < total; ++i) {
+            const double target = i * delta;
+            while (j + 1 < n_seg && start[j + 1] <= target) {
+                ++j;
+                t = 0.f;
+                s = start[j];
+            }
+            float err;
+            t = invert_length(&controlPoints[j * 3], t, float(target - s), tol, err);
+            s = target + err;
+            seg.push_back(j);
+            par.push_back(t);
+        }
+
+        // positions and tangents, four at a time
+        const size_t first = samples.size();
+        samples.resize(first + par.size());
+        tans.resize(first + par.size());
+        for (size_t i = 0; i < par.size(); i += 4) {
+            const glm::vec3* cps[4];
+            float ts[4];
+            for (int l = 0; l < 4; ++l) {
+                size_t k = std::min(i + l, par.size() - 1);
+                cps[l] = &controlPoints[seg[k] * 3];
+                ts[l] = par[k];
+            }
+            glm::vec3 pos[4], tan[4];
+            cubicBezierCurve4(cps, ts, pos, tan);
+            for (int l = 0; l < 4 && i + l < par.size(); ++l) {
+                samples[first + i + l] = pos[l];
+                tans[first + i + l] = tan[l];
+            }
+        }
+
+        if (tot)
+            *tot = float(total);
+    }
+
+private:
+    /// position and tangent at four (segment, parameter) pairs at once
+    static void cubicBezierCurve4(const glm::vec3* const* cps, const float* t, glm::vec3* position, glm::vec3* tangent) {
+#if defined(BEZIER_SSE2)
+        __m128 tt = _mm_loadu_ps(t);
+        __m128 u = _mm_sub_ps(_mm_set1_ps(1.f), tt);
+        __m128 u2 = _mm_mul_ps(u, u), t2 = _mm_mul_ps(tt, tt);
+        __m128 three = _mm_set1_ps(3.f);
+        __m128 b0 = _mm_mul_ps(u2, u);
+        __m128 b1 = _mm_mul_ps(three, _mm_mul_ps(u2, tt));
+        __m128 b2 = _mm_mul_ps(three, _mm_mul_ps(u, t2));
+        __m128 b3 = _mm_mul_ps(t2, tt);
+        __m128 d0 = _mm_mul_ps(three, u2);
+        __m128 d1 = _mm_mul_ps(_mm_set1_ps(6.f), _mm_mul_ps(u, tt));
+        __m128 d2 = _mm_mul_ps(three, t2);
+        float p[3][4], d[3][4];
+        for (int c = 0; c < 3; ++c) {
+            __m128 c0 = _mm_setr_ps(cps[0][0][c], cps[1][0][c], cps[2][0][c], cps[3][0][c]);
+            __m128 c1 = _mm_setr_ps(cps[0][1][c], cps[1][1][c], cps[2][1][c], cps[3][1][c]);
+            __m128 c2 = _mm_setr_ps(cps[0][2][c], cps[1][2][c], cps[2][2][c], cps[3][2][c]);
+            __m128 c3 = _mm_setr_ps(cps[0][3][c], cps[1][3][c], cps[2][3][c], cps[3][3][c]);
+            __m128 pc = _mm_add_ps(_mm_add_ps(_mm_mul_ps(b0, c0), _mm_mul_ps(b1, c1)), _mm_add_ps(_mm_mul_ps(b2, c2), _mm_mul_ps(b3, c3)));
+            __m128 dc = _mm_add_ps(_mm_add_ps(_mm_mul_ps(d0, _mm_sub_ps(c1, c0)), _mm_mul_ps(d1, _mm_sub_ps(c2, c1))), _mm_mul_ps(d2, _mm_sub_ps(c3, c2)));
+            _mm_storeu_ps(p[c], pc);
+            _mm_storeu_ps(d[c], dc);
+        }
+        for (int l = 0; l < 4; ++l) {
+            position[l] = glm::vec3(p[0][l], p[1][l], p[2][l]);
+            tangent[l] = glm::vec3(d[0][l], d[1][l], d[2][l]);
+        }
+#else
+        for (int l = 0; l < 4; ++l)
+            cubicBezierCurve(cps[l], t[l], position[l], tangent[l]);
+#endif
+    }
+
+    /// |B'(t)| at four parameters of the same segment
+    static void speed4(const glm::vec3* cp, const float* t, float* speed) {
+#if defined(BEZIER_SSE2)
+        __m128 tt = _mm_loadu_ps(t);
+        __m128 u = _mm_sub_ps(_mm_set1_ps(1.f), tt);
+        __m128 d0 = _mm_mul_ps(_mm_set1_ps(3.f), _mm_mul_ps(u, u));
+        __m128 d1 = _mm_mul_ps(_mm_set1_ps(6.f), _mm_mul_ps(u, tt));
+        __m128 d2 = _mm_mul_ps(_mm_set1_ps(3.f), _mm_mul_ps(tt, tt));
+        __m128 sq = _mm_setzero_ps();
+        for (int c = 0; c < 3; ++c) {
+            __m128 dc = _mm_add_ps(_mm_add_ps(
+                _mm_mul_ps(d0, _mm_set1_ps(cp[1][c] - cp[0][c])),
+                _mm_mul_ps(d1, _mm_set1_ps(cp[2][c] - cp[1][c]))),
+                _mm_mul_ps(d2, _mm_set1_ps(cp[3][c] - cp[2][c])));
+            sq = _mm_add_ps(sq, _mm_mul_ps(dc, dc));
+        }
+        _mm_storeu_ps(speed, _mm_sqrt_ps(sq));
+#else
+        glm::vec3 p, d;
+        for (int l = 0; l < 4; ++l) {
+            cubicBezierCurve(cp, t[l], p, d);
+            speed[l] = glm::length(d);
+        }
+#endif
+    }
+
+    /// length of a segment between parameters a and b, 4 point Gauss-Legendre: enough for the span between two samples
+    static float short_length(const glm::vec3* cp, float a, float b) {
+        static const float x[2] = { 0.3399810436f, 0.8611363116f };
+        static const float w[2] = { 0.6521451549f, 0.3478548451f };
+        const float h = (b - a) * 0.5f, m = (a + b) * 0.5f;
+        float ts[4] = { m - h * x[0], m + h * x[0], m - h * x[1], m + h * x[1] }, sp[4];
+        speed4(cp, ts, sp);
+        return (w[0] * (sp[0] + sp[1]) + w[1] * (sp[2] + sp[3])) * h;
+    }
+
+    /// length of a segment between parameters a and b, 8 point Gauss-Legendre
+    static float segment_length(const glm::vec3* cp, float a, float b) {
+        static const float x[4] = { 0.1834346425f, 0.5255324099f, 0.7966664774f, 0.9602898565f };
+        static const float w[4] = { 0.3626837834f, 0.3137066459f, 0.2223810345f, 0.1012285363f };
+        const float h = (b - a) * 0.5f, m = (a + b) * 0.5f;
+        float t0[4], t1[4], s0[4], s1[4];
+        for (int i = 0; i < 4; ++i) {
+            t0[i] = m - h * x[i];
+            t1[i] = m + h * x[i];
+        }
+        speed4(cp, t0, s0);
+        speed4(cp, t1, s1);
+        float l = 0.f;
+        for (int i = 0; i < 4; ++i)
+            l += w[i] * (s0[i] + s1[i]);
+        return l * h;
+    }
+
+    /// length of [a,b] (whole is its estimate), split until the halves agree with the whole within tol
+    static double adaptive_length(const glm::vec3* cp, float a, float b, float whole, float tol, int depth) {
+        const float m = (a + b) * 0.5f;
+        const float left = segment_length(cp, a, m), right = segment_length(cp, m, b);
+        if (depth >= 16 || std::fabs(left + right - whole) <= tol)
+            return left + right;
+        return adaptive_length(cp, a, m, left, tol * 0.5f, depth + 1) + adaptive_length(cp, m, b, right, tol * 0.5f, depth + 1);
+    }
+
+    /**
+     * parameter t in [a,1] where the length from a is dist, within tol
+     * @param err length from a to the returned t, minus dist
+     */
+    static float invert_length(const glm::vec3* cp, float a, float dist, float tol, float& err) {
+        glm::vec3 p, d;
+        cubicBezierCurve(cp, a, p, d);
+        float speed = glm::length(d);
+        float lo = a, hi = 1.f;
+        float t = (speed > 0.f) ? std::min(a + dist / speed, 1.f) : a;
+        for (int it = 0; ; ++it) {
+            err = short_length(cp, a, t) - dist;
+            if (std::fabs(err) <= tol || it == 8)
+                break;
+            if (err > 0.f)
+                hi = t;
+            else
+                lo = t;
+            cubicBezierCurve(cp, t, p, d);
+            speed = glm::length(d);
+            float tn = (speed > 0.f) ? t - err / speed : 0.5f * (lo + hi);
+            // Newton step, falling back to bisection when it leaves the bracket
+            t = (tn > lo && tn < hi) ? tn : 0.5f * (lo + hi);
+        }
+        return t;
+    }
+};
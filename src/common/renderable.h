@@ -1,6 +1,7 @@
 #pragma once
 #include <GL/glew.h>
 #include <vector>
+#include <algorithm>
 #include <type_traits>
 #include "box3.h"
 
@@ -72,17 +73,18 @@ struct renderable {
 
 		glBindVertexArray(vao);
 
-		/* create a buffer for the render data in video RAM */
-		vbos.push_back(va_id);
+		/* the buffer is recorded once: the attributes interleaved in it share it, and destroy deletes it once */
+		if (std::find(vbos.begin(), vbos.end(), va_id) == vbos.end())
+			vbos.push_back(va_id);
 		
-		glBindBuffer(GL_ARRAY_BUFFER, vbos.back());
+		glBindBuffer(GL_ARRAY_BUFFER, va_id);
 		glEnableVertexAttribArray(attribute_index);
 
 		/* specify the data format */
 		glVertexAttribPointer(attribute_index, num_components, TYPE, false, stride, (void*)(size_t)offset);
 
 		glBindVertexArray(NULL);
-		return vbos.back();
+		return va_id;
 	}
 
 
@@ -117,6 +119,27 @@ struct renderable {
 	
 
 
+	/* overwrite count values of the vertex buffer vbos[ivbo], from value first on. The buffer keeps its size,
+	*  so only the part that changed is sent to the GPU
+	*/
+	template <class T>
+	void update_vertex_attribute(unsigned int ivbo, const T* values, unsigned int first, unsigned int count) {
+		glBindBuffer(GL_ARRAY_BUFFER, vbos[ivbo]);
+		glBufferSubData(GL_ARRAY_BUFFER, sizeof(T) * first, sizeof(T) * count, values);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	}
+
+	/* release the vertex array and the buffers. create() makes the renderable usable again */
+	void destroy() {
+		if (!vbos.empty())
+			glDeleteBuffers((GLsizei)vbos.size(), &vbos[0]);
+		for (unsigned int i = 0; i < elements.size(); ++i)
+			glDeleteBuffers(1, &elements[i].ind);
+		glDeleteVertexArrays(1, &vao);
+		vbos.clear();
+		elements.clear();
+	}
+
 	template <class C>
 	int type_to_GL() { 
 		if(std::is_same<C,unsigned int>	()	) return GL_UNSIGNED_INT;
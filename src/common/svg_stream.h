@@ -0,0 +1,948 @@
+#pragma once
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <glm/glm.hpp>
+#include "hash64.h"
+
+/**
+	Streaming reader of the shapes of an svg file. The file is read once, in blocks, and scanned tag by tag: only the
+	shapes whose id is accepted by the caller are turned into paths and kept, everything else is dropped as soon as
+	it has been read. The memory taken is that of the kept shapes plus the longest single tag, never the document.
+
+	The paths are those nanosvg builds with nsvgParseFromFile(file, "px", dpi): each sub path is a sequence of cubic
+	Bezier segments (lines, quadratic curves and arcs are converted to cubics), the transforms of the element and of
+	its groups are applied, and the points are mapped from the viewBox to the size of the image.
+	Elements: path, rect, circle, ellipse, line, polyline and polygon, in svg and g. The content of defs is skipped.
+	As in nanosvg, an element without an id takes the id of the enclosing group.
+
+	Every shape carries a hash of its source: the text of its tag and of the tags of the groups it is in. Two shapes
+	with the same source have the same paths, so a caller reading a file again after an edit (see reparse) can skip
+	the shapes it already has and only build the paths of the ones that changed.
+*/
+struct svg_stream {
+
+	/// a sub path: pts[0], then two control points and the end point of each cubic segment
+	struct path {
+		std::vector<glm::vec2> pts;
+		bool closed;
+	};
+
+	struct shape {
+		shape() :source(0) {}
+		std::string id;
+		std::vector<path> paths;
+
+		/// hash of the text the shape comes from, 0 if its paths depend on the rest of the document
+		unsigned long long source;
+	};
+
+	struct image {
+		image() :width(0.f), height(0.f) {}
+
+		/// size of the image in pixels
+		float width, height;
+		std::vector<shape> shapes;
+	};
+
+	/**
+	 * read the shapes of filename whose id satisfies keep(const std::string&), in document order
+	 * @param dpi resolution converting the physical units of the document (mm, in, pt...) to pixels
+	 * @return false if the file cannot be opened
+	 */
+	template <class KEEP>
+	static bool parse(const char* filename, KEEP keep, image& out, float dpi = 96.f) {
+		return reparse(filename, keep, unknown(), out, dpi);
+	}
+
+	/**
+	 * as parse, but the kept shapes whose source satisfies known(unsigned long long) get no paths: their paths are
+	 * not built, the caller has them from a shape with the same source
+	 */
+	template <class KEEP, class KNOWN>
+	static bool reparse(const char* filename, KEEP keep, KNOWN known, image& out, float dpi = 96.f) {
+		FILE* f = fopen(filename, "rb");
+		if (!f)
+			return false;
+		out = image();
+		parser<KEEP, KNOWN> p(keep, known, out, dpi);
+
+		// buf holds the unconsumed input: at most a partial tag and the next block
+		std::vector<char> buf;
+		bool eof = false;
+		while (!eof) {
+			const size_t kept = buf.size();
+			buf.resize(kept + BLOCK);
+			const size_t n = fread(&buf[kept], 1, BLOCK, f);
+			buf.resize(kept + n);
+			eof = (n < BLOCK);
+			const size_t used = p.scan(buf.empty() ? 0 : &buf[0], buf.size(), eof);
+			buf.erase(buf.begin(), buf.begin() + used);
+			if (buf.capacity() > 4 * BLOCK && buf.size() < BLOCK)
+				std::vector<char>(buf).swap(buf);
+		}
+		fclose(f);
+		p.finish();
+		return true;
+	}
+
+private:
+	enum { BLOCK = 1 << 16 };
+
+	struct unknown {
+		bool operator()(unsigned long long) const { return false; }
+	};
+
+	/// 2d affine transform: x' = t[0] x + t[2] y + t[4], y' = t[1] x + t[3] y + t[5], as in nanosvg
+	struct xform {
+		float t[6];
+		xform() { t[0] = 1.f; t[1] = 0.f; t[2] = 0.f; t[3] = 1.f; t[4] = 0.f; t[5] = 0.f; }
+		xform(float a, float b, float c, float d, float e, float f) { t[0] = a; t[1] = b; t[2] = c; t[3] = d; t[4] = e; t[5] = f; }
+
+		glm::vec2 apply(float x, float y) const { return glm::vec2(x * t[0] + y * t[2] + t[4], x * t[1] + y * t[3] + t[5]); }
+		glm::vec2 apply_vec(float x, float y) const { return glm::vec2(x * t[0] + y * t[2], x * t[1] + y * t[3]); }
+
+		/// the transform that applies q, then this
+		xform operator*(const xform& q) const {
+			return xform(t[0] * q.t[0] + t[2] * q.t[1], t[1] * q.t[0] + t[3] * q.t[1],
+				t[0] * q.t[2] + t[2] * q.t[3], t[1] * q.t[2] + t[3] * q.t[3],
+				t[0] * q.t[4] + t[2] * q.t[5] + t[4], t[1] * q.t[4] + t[3] * q.t[5] + t[5]);
+		}
+	};
+
+	struct attribute {
+		std::string name, value;
+	};
+
+	template <class KEEP, class KNOWN>
+	struct parser {
+		parser(KEEP& k, KNOWN& kn, image& o, float d) :keep(k), known(kn), out(o), dpi(d), view_min(0.f), view_size(0.f),
+			align_x(1), align_y(1), align_type(MEET), seen_svg(false), need_bounds(false), bmin(1e30f), bmax(-1e30f) {
+			frames.push_back(frame());
+		}
+
+		KEEP& keep;
+		KNOWN& known;
+		image& out;
+		float dpi;
+
+		enum { MEET, SLICE, NONE };
+		glm::vec2 view_min, view_size;
+		int align_x, align_y, align_type;   // align: 0 min, 1 mid, 2 max
+		bool seen_svg, need_bounds;
+
+		/// bounds of all the shapes, used only when the document gives neither its size nor a viewBox
+		glm::vec2 bmin, bmax;
+
+		/// what a group passes to its content
+		struct frame {
+			frame() :defs(false), source(14695981039346656037ULL) {}
+			std::string tag, id;
+			xform ctm;
+			bool defs;
+			unsigned long long source;
+		};
+		std::vector<frame> frames;
+
+		std::vector<attribute> attrs;
+
+		// the sub path being built, and the paths of the current shape, in user units
+		std::vector<glm::vec2> pts;
+		std::vector<path> paths;
+
+		/**
+		 * consume the complete tags of [s, s+n), skipping text, comments, declarations and CDATA
+		 * @return how many bytes were consumed: the rest starts with an incomplete construct
+		 */
+		size_t scan(const char* s, size_t n, bool eof) {
+			size_t i = 0;
+			while (i < n) {
+				const char* lt = (const char*)memchr(s + i, '<', n - i);
+				if (!lt)
+					return n;
+				const size_t at = lt - s;
+				size_t end;
+				if (starts(s + at, n - at, "<!--"))
+					end = find(s, n, at + 4, "-->");
+				else if (starts(s + at, n - at, "<![CDATA["))
+					end = find(s, n, at + 9, "]]>");
+				else if (starts(s + at, n - at, "<?"))
+					end = find(s, n, at + 2, "?>");
+				else if (n - at < 9 && !eof)
+					return at;   // too short to tell which construct it is
+				else if (starts(s + at, n - at, "<!"))
+					end = declaration_end(s, n, at + 2);
+				else {
+					end = tag_end(s, n, at + 1);
+					if (end != size_t(-1))
+						tag(s + at + 1, end - 1 - (at + 1));
+				}
+				if (end == size_t(-1))
+					return eof ? n : at;
+				i = end;
+			}
+			return n;
+		}
+
+		static bool starts(const char* s, size_t n, const char* w) {
+			const size_t l = strlen(w);
+			return n >= l && memcmp(s, w, l) == 0;
+		}
+
+		/// position after the first w at or after from, -1 if none
+		static size_t find(const char* s, size_t n, size_t from, const char* w) {
+			const size_t l = strlen(w);
+			for (size_t i = from; i + l <= n; ++i)
+				if (s[i] == w[0] && memcmp(s + i, w, l) == 0)
+					return i + l;
+			return size_t(-1);
+		}
+
+		/// position after the '>' closing a tag, skipping the quoted values
+		static size_t tag_end(const char* s, size_t n, size_t from) {
+			char quote = 0;
+			for (size_t i = from; i < n; ++i) {
+				if (quote) {
+					if (s[i] == quote)
+						quote = 0;
+				}
+				else if (s[i] == '"' || s[i] == '\'')
+					quote = s[i];
+				else if (s[i] == '>')
+					return i + 1;
+			}
+			return size_t(-1);
+		}
+
+		/// position after the '>' closing a <!DOCTYPE ...>, skipping its internal subset
+		static size_t declaration_end(const char* s, size_t n, size_t from) {
+			int depth = 0;
+			for (size_t i = from; i < n; ++i) {
+				if (s[i] == '[')
+					++depth;
+				else if (s[i] == ']')
+					--depth;
+				else if (s[i] == '>' && depth <= 0)
+					return i + 1;
+			}
+			return size_t(-1);
+		}
+
+		/// s: the text between '<' and '>'
+		void tag(const char* s, size_t n) {
+			if (n > 0 && s[0] == '/') {
+				size_t i = 1;
+				std::string name;
+				while (i < n && !space(s[i]))
+					name += s[i++];
+				end_element(name);
+				return;
+			}
+			const unsigned long long source = hash64::bytes(frames.back().source, s, n);
+			bool empty = (n > 0 && s[n - 1] == '/');
+			if (empty)
+				--n;
+			size_t i = 0;
+			std::string name;
+			while (i < n && !space(s[i]))
+				name += s[i++];
+
+			attrs.clear();
+			while (i < n) {
+				while (i < n && space(s[i]))
+					++i;
+				attribute a;
+				while (i < n && s[i] != '=' && !space(s[i]))
+					a.name += s[i++];
+				while (i < n && space(s[i]))
+					++i;
+				if (i < n && s[i] == '=') {
+					++i;
+					while (i < n && space(s[i]))
+						++i;
+					if (i < n && (s[i] == '"' || s[i] == '\'')) {
+						const char q = s[i++];
+						const size_t b = i;
+						while (i < n && s[i] != q)
+							++i;
+						a.value.assign(s + b, i - b);
+						++i;
+					}
+				}
+				if (!a.name.empty())
+					attrs.push_back(a);
+			}
+			start_element(name, empty, source);
+		}
+
+		static bool space(char c) { return c == ' ' || c == '\t' || c == '\n' || c == '\r'; }
+
+		const std::string* attr(const char* name) const {
+			for (size_t i = 0; i < attrs.size(); ++i)
+				if (attrs[i].name == name)
+					return &attrs[i].value;
+			return 0;
+		}
+
+		void start_element(const std::string& name, bool empty, unsigned long long source) {
+			const frame& top = frames.back();
+			if (name == "g" || name == "svg" || name == "defs") {
+				if (name == "svg" && !seen_svg)
+					svg_attributes();
+				if (empty)
+					return;
+				frame f = top;
+				f.tag = name;
+				if (name == "defs")
+					f.defs = true;
+				f.source = source;
+				element_state(f.id, f.ctm);
+				frames.push_back(f);
+				return;
+			}
+			if (top.defs)
+				return;
+
+			std::string id = top.id;
+			xform ctm = top.ctm;
+			element_state(id, ctm);
+			const bool kept = keep(id);
+			if (!kept && !need_bounds)
+				return;
+			if (kept && !need_bounds && shape_element(name) && known(source)) {
+				out.shapes.push_back(shape());
+				out.shapes.back().id = id;
+				out.shapes.back().source = source;
+				return;
+			}
+
+			paths.clear();
+			if (name == "path")
+				parse_path();
+			else if (name == "rect")
+				parse_rect();
+			else if (name == "circle" || name == "ellipse")
+				parse_ellipse(name == "circle");
+			else if (name == "line")
+				parse_line();
+			else if (name == "polyline" || name == "polygon")
+				parse_poly(name == "polygon");
+			else
+				return;
+			if (paths.empty())
+				return;
+
+			for (size_t ip = 0; ip < paths.size(); ++ip)
+				for (size_t i = 0; i < paths[ip].pts.size(); ++i) {
+					glm::vec2& p = paths[ip].pts[i];
+					p = ctm.apply(p.x, p.y);
+					bmin = glm::min(bmin, p);
+					bmax = glm::max(bmax, p);
+				}
+			if (kept) {
+				out.shapes.push_back(shape());
+				out.shapes.back().id = id;
+				out.shapes.back().paths.swap(paths);
+				out.shapes.back().source = source;
+			}
+		}
+
+		static bool shape_element(const std::string& name) {
+			return name == "path" || name == "rect" || name == "circle" || name == "ellipse" || name == "line" ||
+				name == "polyline" || name == "polygon";
+		}
+
+		void end_element(const std::string& name) {
+			if (frames.size() > 1 && frames.back().tag == name)
+				frames.pop_back();
+		}
+
+		/// the id and the transform an element passes to its content
+		void element_state(std::string& id, xform& ctm) const {
+			if (const std::string* v = attr("id"))
+				id = *v;
+			if (const std::string* v = attr("transform"))
+				ctm = ctm * parse_transform(*v);
+		}
+
+		void svg_attributes() {
+			seen_svg = true;
+			if (const std::string* v = attr("width"))
+				out.width = length(*v, 0.f);
+			if (const std::string* v = attr("height"))
+				out.height = length(*v, 0.f);
+			if (const std::string* v = attr("viewBox")) {
+				float b[4] = { 0.f, 0.f, 0.f, 0.f };
+				const char* s = v->c_str();
+				for (int k = 0; k < 4; ++k)
+					s = next_number(s, b[k]);
+				view_min = glm::vec2(b[0], b[1]);
+				view_size = glm::vec2(b[2], b[3]);
+			}
+			if (const std::string* v = attr("preserveAspectRatio")) {
+				if (v->find("none") != std::string::npos)
+					align_type = NONE;
+				else {
+					if (v->find("xMin") != std::string::npos) align_x = 0;
+					else if (v->find("xMid") != std::string::npos) align_x = 1;
+					else if (v->find("xMax") != std::string::npos) align_x = 2;
+					if (v->find("YMin") != std::string::npos) align_y = 0;
+					else if (v->find("YMid") != std::string::npos) align_y = 1;
+					else if (v->find("YMax") != std::string::npos) align_y = 2;
+					align_type = (v->find("slice") != std::string::npos) ? SLICE : MEET;
+				}
+			}
+			need_bounds = (view_size.x == 0.f && out.width == 0.f) || (view_size.y == 0.f && out.height == 0.f);
+		}
+
+		/// map the kept shapes from the viewBox to the image, as nanosvg does once the document is parsed
+		void finish() {
+			if (view_size.x == 0.f) {
+				if (out.width > 0.f)
+					view_size.x = out.width;
+				else if (bmax.x >= bmin.x) {
+					view_min.x = bmin.x;
+					view_size.x = bmax.x - bmin.x;
+				}
+			}
+			if (view_size.y == 0.f) {
+				if (out.height > 0.f)
+					view_size.y = out.height;
+				else if (bmax.y >= bmin.y) {
+					view_min.y = bmin.y;
+					view_size.y = bmax.y - bmin.y;
+				}
+			}
+			if (out.width == 0.f)
+				out.width = view_size.x;
+			if (out.height == 0.f)
+				out.height = view_size.y;
+
+			glm::vec2 t = -view_min;
+			glm::vec2 sc(view_size.x > 0.f ? out.width / view_size.x : 0.f, view_size.y > 0.f ? out.height / view_size.y : 0.f);
+			if (align_type != NONE && sc.x > 0.f && sc.y > 0.f) {
+				sc.x = sc.y = (align_type == MEET) ? std::min(sc.x, sc.y) : std::max(sc.x, sc.y);
+				t.x += align(view_size.x * sc.x, out.width, align_x) / sc.x;
+				t.y += align(view_size.y * sc.y, out.height, align_y) / sc.y;
+			}
+			for (size_t is = 0; is < out.shapes.size(); ++is) {
+				// the bounds of all the shapes map every one of them
+				if (need_bounds)
+					out.shapes[is].source = 0;
+				for (size_t ip = 0; ip < out.shapes[is].paths.size(); ++ip) {
+					std::vector<glm::vec2>& p = out.shapes[is].paths[ip].pts;
+					for (size_t i = 0; i < p.size(); ++i)
+						p[i] = (p[i] + t) * sc;
+				}
+			}
+		}
+
+		static float align(float content, float container, int type) {
+			if (type == 0)
+				return 0.f;
+			if (type == 2)
+				return container - content;
+			return (container - content) * 0.5f;
+		}
+
+		/*   ------   numbers and lengths   ------   */
+
+		static bool number_start(char c) { return (c >= '0' && c <= '9') || c == '-' || c == '+' || c == '.'; }
+
+		/// parse a number at s, without locale; returns s if there is none
+		static const char* number(const char* s, float& v) {
+			const char* p = s;
+			double sign = 1.0, r = 0.0;
+			if (*p == '+' || *p == '-')
+				sign = (*p++ == '-') ? -1.0 : 1.0;
+			bool digits = false;
+			while (*p >= '0' && *p <= '9') {
+				r = r * 10.0 + (*p++ - '0');
+				digits = true;
+			}
+			if (*p == '.') {
+				++p;
+				double w = 0.1;
+				while (*p >= '0' && *p <= '9') {
+					r += (*p++ - '0') * w;
+					w *= 0.1;
+					digits = true;
+				}
+			}
+			if (!digits)
+				return s;
+			if (*p == 'e' || *p == 'E') {
+				const char* q = p + 1;
+				int es = 1, e = 0;
+				if (*q == '+' || *q == '-')
+					es = (*q++ == '-') ? -1 : 1;
+				if (*q >= '0' && *q <= '9') {
+					while (*q >= '0' && *q <= '9')
+						e = e * 10 + (*q++ - '0');
+					r *= pow(10.0, es * e);
+					p = q;
+				}
+			}
+			v = float(sign * r);
+			return p;
+		}
+
+		/// skip separators and parse the next number, v = 0 if there is none
+		static const char* next_number(const char* s, float& v) {
+			while (*s && (space(*s) || *s == ','))
+				++s;
+			v = 0.f;
+			const char* e = number(s, v);
+			return (e == s && *s) ? s + 1 : e;
+		}
+
+		/// a coordinate or a length with its unit, in user units. ref is what 100% is
+		float length(const std::string& s, float ref) const {
+			float v = 0.f;
+			const char* p = s.c_str();
+			while (space(*p))
+				++p;
+			p = number(p, v);
+			if (p[0] == '%')
+				return v / 100.f * ref;
+			if (p[0] == 0 || p[1] == 0)
+				return v;
+			const char u[3] = { p[0], p[1], 0 };
+			if (!strcmp(u, "pt")) return v * dpi / 72.f;
+			if (!strcmp(u, "pc")) return v * dpi / 6.f;
+			if (!strcmp(u, "mm")) return v * dpi / 25.4f;
+			if (!strcmp(u, "cm")) return v * dpi / 2.54f;
+			if (!strcmp(u, "in")) return v * dpi;
+			if (!strcmp(u, "em")) return v * 12.f;
+			if (!strcmp(u, "ex")) return v * 12.f * 0.52f;
+			return v;
+		}
+
+		float attr_length(const char* name, float ref, float def = 0.f) const {
+			const std::string* v = attr(name);
+			return v ? length(*v, ref) : def;
+		}
+
+		float ref_length() const { return sqrtf(view_size.x * view_size.x + view_size.y * view_size.y) / sqrtf(2.f); }
+
+		/*   ------   transforms   ------   */
+
+		static xform parse_transform(const std::string& str) {
+			xform m;
+			const char* s = str.c_str();
+			while (*s) {
+				while (*s && (space(*s) || *s == ','))
+					++s;
+				const char* name = s;
+				while (*s && *s != '(' && !space(*s))
+					++s;
+				const std::string fn(name, s - name);
+				while (*s && *s != '(')
+					++s;
+				if (!*s)
+					break;
+				++s;
+				float a[6] = { 0.f, 0.f, 0.f, 0.f, 0.f, 0.f };
+				int na = 0;
+				while (*s && *s != ')') {
+					if (number_start(*s)) {
+						float v;
+						const char* e = number(s, v);
+						if (e != s) {
+							if (na < 6)
+								a[na++] = v;
+							s = e;
+							continue;
+						}
+					}
+					++s;
+				}
+				if (*s)
+					++s;
+
+				xform t;
+				if (fn == "matrix" && na == 6)
+					t = xform(a[0], a[1], a[2], a[3], a[4], a[5]);
+				else if (fn == "translate")
+					t = xform(1.f, 0.f, 0.f, 1.f, a[0], na > 1 ? a[1] : 0.f);
+				else if (fn == "scale")
+					t = xform(a[0], 0.f, 0.f, na > 1 ? a[1] : a[0], 0.f, 0.f);
+				else if (fn == "rotate") {
+					const float r = a[0] / 180.f * 3.14159265358979323846f, cs = cosf(r), sn = sinf(r);
+					t = xform(cs, sn, -sn, cs, 0.f, 0.f);
+					if (na > 1)
+						t = xform(1.f, 0.f, 0.f, 1.f, a[1], a[2]) * t * xform(1.f, 0.f, 0.f, 1.f, -a[1], -a[2]);
+				}
+				else if (fn == "skewX")
+					t = xform(1.f, 0.f, tanf(a[0] / 180.f * 3.14159265358979323846f), 1.f, 0.f, 0.f);
+				else if (fn == "skewY")
+					t = xform(1.f, tanf(a[0] / 180.f * 3.14159265358979323846f), 0.f, 1.f, 0.f, 0.f);
+				m = m * t;
+			}
+			return m;
+		}
+
+		/*   ------   path building, as nanosvg   ------   */
+
+		void move_to(float x, float y) {
+			if (!pts.empty())
+				pts.back() = glm::vec2(x, y);
+			else
+				pts.push_back(glm::vec2(x, y));
+		}
+
+		void line_to(float x, float y) {
+			if (pts.empty())
+				return;
+			const glm::vec2 p = pts.back(), d = glm::vec2(x, y) - p;
+			pts.push_back(p + d / 3.f);
+			pts.push_back(glm::vec2(x, y) - d / 3.f);
+			pts.push_back(glm::vec2(x, y));
+		}
+
+		void cubic_to(float x1, float y1, float x2, float y2, float x, float y) {
+			if (pts.empty())
+				return;
+			pts.push_back(glm::vec2(x1, y1));
+			pts.push_back(glm::vec2(x2, y2));
+			pts.push_back(glm::vec2(x, y));
+		}
+
+		/// commit the sub path being built
+		void add_path(bool closed) {
+			if (pts.size() < 4)
+				return;
+			if (closed)
+				line_to(pts[0].x, pts[0].y);
+			if (pts.size() % 3 != 1)
+				return;
+			paths.push_back(path());
+			paths.back().pts = pts;
+			paths.back().closed = closed;
+		}
+
+		static int args_per_command(char c) {
+			switch (c) {
+			case 'v': case 'V': case 'h': case 'H': return 1;
+			case 'm': case 'M': case 'l': case 'L': case 't': case 'T': return 2;
+			case 'q': case 'Q': case 's': case 'S': return 4;
+			case 'c': case 'C': return 6;
+			case 'a': case 'A': return 7;
+			case 'z': case 'Z': return 0;
+			}
+			return -1;
+		}
+
+		void parse_path() {
+			const std::string* d = attr("d");
+			if (!d)
+				return;
+			const char* s = d->c_str();
+			float cpx = 0.f, cpy = 0.f, cpx2 = 0.f, cpy2 = 0.f, args[10];
+			int nargs = 0, rargs = 0;
+			char cmd = 0;
+			bool init = false, closed = false;
+			pts.clear();
+			for (;;) {
+				while (*s && (space(*s) || *s == ','))
+					++s;
+				if (!*s)
+					break;
+				float v;
+				const char* e = s;
+				// the flags of an arc may be written without separators
+				if ((cmd == 'a' || cmd == 'A') && (nargs == 3 || nargs == 4) && (*s == '0' || *s == '1')) {
+					v = float(*s - '0');
+					e = s + 1;
+				}
+				else if (number_start(*s))
+					e = number(s, v);
+				if (e != s) {
+					s = e;
+					if (cmd == 0)
+						continue;
+					if (nargs < 10)
+						args[nargs++] = v;
+					if (nargs < rargs)
+						continue;
+					const bool rel = (cmd >= 'a');
+					switch (cmd) {
+					case 'm': case 'M':
+						cpx = rel ? cpx + args[0] : args[0];
+						cpy = rel ? cpy + args[1] : args[1];
+						move_to(cpx, cpy);
+						// the pairs after a move are lines
+						cmd = rel ? 'l' : 'L';
+						rargs = 2;
+						cpx2 = cpx; cpy2 = cpy;
+						init = true;
+						break;
+					case 'l': case 'L':
+						cpx = rel ? cpx + args[0] : args[0];
+						cpy = rel ? cpy + args[1] : args[1];
+						line_to(cpx, cpy);
+						cpx2 = cpx; cpy2 = cpy;
+						break;
+					case 'h': case 'H':
+						cpx = rel ? cpx + args[0] : args[0];
+						line_to(cpx, cpy);
+						cpx2 = cpx; cpy2 = cpy;
+						break;
+					case 'v': case 'V':
+						cpy = rel ? cpy + args[0] : args[0];
+						line_to(cpx, cpy);
+						cpx2 = cpx; cpy2 = cpy;
+						break;
+					case 'c': case 'C': {
+						const float ox = rel ? cpx : 0.f, oy = rel ? cpy : 0.f;
+						cubic_to(ox + args[0], oy + args[1], ox + args[2], oy + args[3], ox + args[4], oy + args[5]);
+						cpx2 = ox + args[2]; cpy2 = oy + args[3];
+						cpx = ox + args[4]; cpy = oy + args[5];
+						break;
+					}
+					case 's': case 'S': {
+						const float ox = rel ? cpx : 0.f, oy = rel ? cpy : 0.f;
+						cubic_to(2.f * cpx - cpx2, 2.f * cpy - cpy2, ox + args[0], oy + args[1], ox + args[2], oy + args[3]);
+						cpx2 = ox + args[0]; cpy2 = oy + args[1];
+						cpx = ox + args[2]; cpy = oy + args[3];
+						break;
+					}
+					case 'q': case 'Q': {
+						const float ox = rel ? cpx : 0.f, oy = rel ? cpy : 0.f;
+						quad_to(cpx, cpy, ox + args[0], oy + args[1], ox + args[2], oy + args[3]);
+						cpx2 = ox + args[0]; cpy2 = oy + args[1];
+						cpx = ox + args[2]; cpy = oy + args[3];
+						break;
+					}
+					case 't': case 'T': {
+						const float ox = rel ? cpx : 0.f, oy = rel ? cpy : 0.f;
+						const float cx = 2.f * cpx - cpx2, cy = 2.f * cpy - cpy2;
+						quad_to(cpx, cpy, cx, cy, ox + args[0], oy + args[1]);
+						cpx2 = cx; cpy2 = cy;
+						cpx = ox + args[0]; cpy = oy + args[1];
+						break;
+					}
+					case 'a': case 'A':
+						arc_to(cpx, cpy, args, rel);
+						cpx2 = cpx; cpy2 = cpy;
+						break;
+					default:
+						if (nargs >= 2) {
+							cpx = args[nargs - 2]; cpy = args[nargs - 1];
+							cpx2 = cpx; cpy2 = cpy;
+						}
+					}
+					nargs = 0;
+					continue;
+				}
+
+				cmd = *s++;
+				if (cmd == 'M' || cmd == 'm') {
+					if (!pts.empty())
+						add_path(closed);
+					pts.clear();
+					closed = false;
+					nargs = 0;
+				}
+				else if (!init)
+					cmd = 0;
+				if (cmd == 'Z' || cmd == 'z') {
+					closed = true;
+					if (!pts.empty()) {
+						// back to the first point
+						cpx = pts[0].x; cpy = pts[0].y;
+						cpx2 = cpx; cpy2 = cpy;
+						add_path(closed);
+					}
+					pts.clear();
+					move_to(cpx, cpy);
+					closed = false;
+					nargs = 0;
+				}
+				rargs = args_per_command(cmd);
+				if (rargs == -1) {
+					cmd = 0;
+					rargs = 0;
+				}
+			}
+			if (!pts.empty())
+				add_path(closed);
+		}
+
+		void quad_to(float x1, float y1, float cx, float cy, float x2, float y2) {
+			cubic_to(x1 + 2.f / 3.f * (cx - x1), y1 + 2.f / 3.f * (cy - y1),
+				x2 + 2.f / 3.f * (cx - x2), y2 + 2.f / 3.f * (cy - y2), x2, y2);
+		}
+
+		static float vecang(float ux, float uy, float vx, float vy) {
+			float r = (ux * vx + uy * vy) / (sqrtf(ux * ux + uy * uy) * sqrtf(vx * vx + vy * vy));
+			r = std::max(-1.f, std::min(1.f, r));
+			return ((ux * vy < uy * vx) ? -1.f : 1.f) * acosf(r);
+		}
+
+		/// elliptical arc as cubic segments of at most 90 degrees (SVG implementation notes, as nanosvg)
+		void arc_to(float& cpx, float& cpy, const float* args, bool rel) {
+			const float PI = 3.14159265358979323846f;
+			float rx = fabsf(args[0]), ry = fabsf(args[1]);
+			const float rotx = args[2] / 180.f * PI;
+			const bool fa = fabsf(args[3]) > 1e-6f, fs = fabsf(args[4]) > 1e-6f;
+			const float x1 = cpx, y1 = cpy;
+			const float x2 = rel ? cpx + args[5] : args[5], y2 = rel ? cpy + args[6] : args[6];
+
+			float dx = x1 - x2, dy = y1 - y2;
+			float d = sqrtf(dx * dx + dy * dy);
+			if (d < 1e-6f || rx < 1e-6f || ry < 1e-6f) {
+				line_to(x2, y2);
+				cpx = x2; cpy = y2;
+				return;
+			}
+			const float sinrx = sinf(rotx), cosrx = cosf(rotx);
+
+			const float x1p = cosrx * dx / 2.f + sinrx * dy / 2.f;
+			const float y1p = -sinrx * dx / 2.f + cosrx * dy / 2.f;
+			d = (x1p * x1p) / (rx * rx) + (y1p * y1p) / (ry * ry);
+			if (d > 1.f) {
+				d = sqrtf(d);
+				rx *= d;
+				ry *= d;
+			}
+			float s = 0.f;
+			float sa = rx * rx * ry * ry - rx * rx * y1p * y1p - ry * ry * x1p * x1p;
+			const float sb = rx * rx * y1p * y1p + ry * ry * x1p * x1p;
+			if (sa < 0.f)
+				sa = 0.f;
+			if (sb > 0.f)
+				s = sqrtf(sa / sb);
+			if (fa == fs)
+				s = -s;
+			const float cxp = s * rx * y1p / ry, cyp = s * -ry * x1p / rx;
+			const float cx = (x1 + x2) / 2.f + cosrx * cxp - sinrx * cyp;
+			const float cy = (y1 + y2) / 2.f + sinrx * cxp + cosrx * cyp;
+
+			const float ux = (x1p - cxp) / rx, uy = (y1p - cyp) / ry;
+			const float vx = (-x1p - cxp) / rx, vy = (-y1p - cyp) / ry;
+			const float a1 = vecang(1.f, 0.f, ux, uy);
+			float da = vecang(ux, uy, vx, vy);
+			if (!fs && da > 0)
+				da -= 2 * PI;
+			else if (fs && da < 0)
+				da += 2 * PI;
+
+			const xform t(cosrx, sinrx, -sinrx, cosrx, cx, cy);
+			const int ndivs = int(fabsf(da) / (PI * 0.5f) + 1.f);
+			float hda = (da / float(ndivs)) / 2.f;
+			if (hda < 1e-3f && hda > -1e-3f)
+				hda *= 0.5f;
+			else
+				hda = (1.f - cosf(hda)) / sinf(hda);
+			float kappa = fabsf(4.f / 3.f * hda);
+			if (da < 0.f)
+				kappa = -kappa;
+
+			glm::vec2 prev, prev_tan;
+			for (int i = 0; i <= ndivs; ++i) {
+				const float a = a1 + da * (float(i) / float(ndivs));
+				const float c = cosf(a), sn = sinf(a);
+				const glm::vec2 p = t.apply(c * rx, sn * ry);
+				const glm::vec2 tan = t.apply_vec(-sn * rx * kappa, c * ry * kappa);
+				if (i > 0)
+					cubic_to(prev.x + prev_tan.x, prev.y + prev_tan.y, p.x - tan.x, p.y - tan.y, p.x, p.y);
+				prev = p;
+				prev_tan = tan;
+			}
+			cpx = x2; cpy = y2;
+		}
+
+		/*   ------   basic shapes, as nanosvg   ------   */
+
+		void parse_rect() {
+			const float x = attr_length("x", view_size.x), y = attr_length("y", view_size.y);
+			const float w = attr_length("width", view_size.x), h = attr_length("height", view_size.y);
+			float rx = attr("rx") ? fabsf(attr_length("rx", view_size.x)) : -1.f;
+			float ry = attr("ry") ? fabsf(attr_length("ry", view_size.y)) : -1.f;
+			if (rx < 0.f && ry > 0.f) rx = ry;
+			if (ry < 0.f && rx > 0.f) ry = rx;
+			if (rx < 0.f) rx = 0.f;
+			if (ry < 0.f) ry = 0.f;
+			if (rx > w / 2.f) rx = w / 2.f;
+			if (ry > h / 2.f) ry = h / 2.f;
+			if (w == 0.f || h == 0.f)
+				return;
+
+			const float K = 1.f - 0.5522847493f;
+			pts.clear();
+			if (rx < 0.00001f || ry < 0.0001f) {
+				move_to(x, y);
+				line_to(x + w, y);
+				line_to(x + w, y + h);
+				line_to(x, y + h);
+			}
+			else {
+				move_to(x + rx, y);
+				line_to(x + w - rx, y);
+				cubic_to(x + w - rx * K, y, x + w, y + ry * K, x + w, y + ry);
+				line_to(x + w, y + h - ry);
+				cubic_to(x + w, y + h - ry * K, x + w - rx * K, y + h, x + w - rx, y + h);
+				line_to(x + rx, y + h);
+				cubic_to(x + rx * K, y + h, x, y + h - ry * K, x, y + h - ry);
+				line_to(x, y + ry);
+				cubic_to(x, y + ry * K, x + rx * K, y, x + rx, y);
+			}
+			add_path(true);
+		}
+
+		void parse_ellipse(bool circle) {
+			const float cx = attr_length("cx", view_size.x), cy = attr_length("cy", view_size.y);
+			float rx, ry;
+			if (circle)
+				rx = ry = fabsf(attr_length("r", ref_length()));
+			else {
+				rx = fabsf(attr_length("rx", view_size.x));
+				ry = fabsf(attr_length("ry", view_size.y));
+			}
+			if (rx <= 0.f || ry <= 0.f)
+				return;
+
+			const float K = 0.5522847493f;
+			pts.clear();
+			move_to(cx + rx, cy);
+			cubic_to(cx + rx, cy + ry * K, cx + rx * K, cy + ry, cx, cy + ry);
+			cubic_to(cx - rx * K, cy + ry, cx - rx, cy + ry * K, cx - rx, cy);
+			cubic_to(cx - rx, cy - ry * K, cx - rx * K, cy - ry, cx, cy - ry);
+			cubic_to(cx + rx * K, cy - ry, cx + rx, cy - ry * K, cx + rx, cy);
+			add_path(true);
+		}
+
+		void parse_line() {
+			pts.clear();
+			move_to(attr_length("x1", view_size.x), attr_length("y1", view_size.y));
+			line_to(attr_length("x2", view_size.x), attr_length("y2", view_size.y));
+			add_path(false);
+		}
+
+		void parse_poly(bool closed) {
+			const std::string* v = attr("points");
+			if (!v)
+				return;
+			pts.clear();
+			const char* s = v->c_str();
+			float a[2];
+			int na = 0, n = 0;
+			while (*s) {
+				s = next_number(s, a[na++]);
+				if (na < 2)
+					continue;
+				if (n++ == 0)
+					move_to(a[0], a[1]);
+				else
+					line_to(a[0], a[1]);
+				na = 0;
+			}
+			add_path(closed);
+		}
+	};
+};
@@ -1,6 +1,7 @@
 #pragma once
 #include <GL/glew.h>
 #include <string>
+#include "load_profile.h"
 
 
 struct texture {
@@ -11,6 +12,8 @@ struct texture {
 	int n_components;
 	GLuint id;
 	GLuint load(std::string name, GLuint tu) {
+		load_profile::phase loading(("texture::load " + name).c_str());
+		loading.read_file(name.c_str());
 		unsigned char * data;
 		data = stbi_load(name.c_str(), &x_size, &y_size, &n_components, 0);
 		stbi__vertical_flip(data, x_size, y_size, n_components);
@@ -0,0 +1,124 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+
+/**
+	A fixed set of worker threads executing tasks in FIFO order.
+	submit() queues a task and returns a future for its result; parallel_for() splits an index range
+	among the workers and the calling thread, and returns when all the indices have been processed.
+*/
+struct thread_pool {
+
+	/// create n workers (0: one per hardware thread)
+	thread_pool(unsigned int n = 0) :stopping(false) {
+		if (n == 0)
+			n = std::thread::hardware_concurrency();
+		if (n == 0)
+			n = 1;
+		for (unsigned int i = 0; i < n; ++i)
+			workers.push_back(std::thread(&thread_pool::work, this));
+	}
+
+	~thread_pool() {
+		{
+			std::lock_guard<std::mutex> lock(m);
+			stopping = true;
+		}
+		cv.notify_all();
+		for (size_t i = 0; i < workers.size(); ++i)
+			workers[i].join();
+	}
+
+	/// number of worker threads
+	size_t size() const { return workers.size(); }
+
+	/// queue f for execution
+	template <class F>
+	std::future<decltype(std::declval<F>()())> submit(F f) {
+		typedef decltype(std::declval<F>()()) R;
+		std::shared_ptr<std::packaged_task<R()> > task = std::make_shared<std::packaged_task<R()> >(f);
+		std::future<R> res = task->get_future();
+		{
+			std::lock_guard<std::mutex> lock(m);
+			tasks.push_back([task]() { (*task)(); });
+		}
+		cv.notify_one();
+		return res;
+	}
+
+	/// call f(i) for each i in [0,n). Indices are handed out in chunks of the given size
+	template <class F>
+	void parallel_for(size_t n, F f, size_t chunk = 1) {
+		if (n == 0)
+			return;
+		std::shared_ptr<std::atomic<size_t> > next = std::make_shared<std::atomic<size_t> >(0);
+		auto run = [next, n, chunk, &f]() {
+			for (size_t b = next->fetch_add(chunk); b < n; b = next->fetch_add(chunk))
+				for (size_t i = b; i < n && i < b + chunk; ++i)
+					f(i);
+		};
+
+		const size_t n_tasks = std::min(workers.size(), (n + chunk - 1) / chunk);
+		std::vector<std::future<void> > done;
+		for (size_t t = 1; t < n_tasks; ++t)
+			done.push_back(submit(run));
+		run();
+
+		// help with the queue while waiting, so that a parallel_for called from a worker cannot starve the pool
+		for (size_t t = 0; t < done.size(); ++t) {
+			while (done[t].wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+				if (!run_one())
+					std::this_thread::yield();
+			done[t].get();
+		}
+	}
+
+	/// a pool shared by the whole program, created on first use
+	static thread_pool& global() { static thread_pool p; return p; }
+
+private:
+	std::vector<std::thread> workers;
+	std::deque<std::function<void()> > tasks;
+	std::mutex m;
+	std::condition_variable cv;
+	bool stopping;
+
+	/// run a queued task in the calling thread, if there is one
+	bool run_one() {
+		std::function<void()> task;
+		{
+			std::lock_guard<std::mutex> lock(m);
+			if (tasks.empty())
+				return false;
+			task = tasks.front();
+			tasks.pop_front();
+		}
+		task();
+		return true;
+	}
+
+	void work() {
+		for (;;) {
+			std::function<void()> task;
+			{
+				std::unique_lock<std::mutex> lock(m);
+				cv.wait(lock, [this]() { return stopping || !tasks.empty(); });
+				if (stopping && tasks.empty())
+					return;
+				task = tasks.front();
+				tasks.pop_front();
+			}
+			task();
+		}
+	}
+};
@@ -0,0 +1,109 @@
+#pragma once
+#include <GL/glew.h>
+#include <vector>
+#include <iostream>
+#define GLM_ENABLE_EXPERIMENTAL
+#include <glm/glm.hpp>
+
+#include "common/shaders.h"
+#include "common/carousel/carousel.h"
+#include "common/carousel/terrain_horizon.h"
+#include "common/carousel/scene_watch.h"
+
+/*
+   The horizon of the terrain towards -Z and +Z (see terrain_horizon) in an RG8 texture, so that world.frag tells
+   whether the terrain hides the sun from a fragment with a single lookup. With it the terrain needs not be drawn in
+   the sun's shadow map, which is left to the objects standing on the terrain.
+
+   The texture is Z texels wide and X high: texel (iz, ix) is the horizon of vertex (ix, iz) of the terrain mesh, two
+   bytes (R towards -Z, G towards +Z), so the map takes 2 X Z bytes on the GPU.
+*/
+
+class HorizonMap {
+   protected:
+      GLuint horizon;
+      int textureSlot;
+      glm::ivec2 size;
+      glm::vec4 rect;
+      std::vector<unsigned char> texels;
+
+      // upload lines [ix0, ix1] of texels
+      void upload(int ix0, int ix1) {
+         glBindTexture(GL_TEXTURE_2D, horizon);
+         glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+         glTexSubImage2D(GL_TEXTURE_2D, 0, 0, ix0, size[1], ix1 - ix0 + 1, GL_RG, GL_UNSIGNED_BYTE, &texels[size_t(ix0) * size[1] * 2]);
+         glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+      }
+
+   public:
+      HorizonMap() : horizon(0), textureSlot(0), size(0) {}
+
+      // compute the horizon of ter and upload it to texture_slot. Returns false if it is larger than the textures the
+      // GL allows
+      bool create(const terrain& ter, int texture_slot) {
+         GLint maxSize = 0;
+         glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxSize);
+         if (ter.size_pix[0] > maxSize || ter.size_pix[1] > maxSize) {
+            std::cout << "the horizon map is larger than the largest texture (" << maxSize << ")" << std::endl;
+            return false;
+         }
+         size = ter.size_pix;
+         rect = ter.rect_xz;
+         textureSlot = texture_slot;
+         terrain_horizon::build(ter, texels);
+
+         glActiveTexture(GL_TEXTURE0 + textureSlot);
+         glGenTextures(1, &horizon);
+         glBindTexture(GL_TEXTURE_2D, horizon);
+         glTexImage2D(GL_TEXTURE_2D, 0, GL_RG8, size[1], size[0], 0, GL_RG, GL_UNSIGNED_BYTE, NULL);
+         // interpolated between the vertices, no mipmaps
+         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+         upload(0, size[0] - 1);
+         return true;
+      }
+
+      void destroy() {
+         glDeleteTextures(1, &horizon);
+         horizon = 0;
+      }
+
+      // compute and upload again the horizon of the vertices whose height a reload changed: their lines are all that
+      // depends on them. If the size of the height field changed the texture is made again
+      void update(const terrain& ter, const scene_watch::changes& changes) {
+         if (ter.size_pix != size || ter.rect_xz != rect) {
+            destroy();
+            create(ter, textureSlot);
+            return;
+         }
+         const glm::ivec4 v = changes.vertices(size[0], size[1]);
+         if (v[0] <= v[2]) {
+            const int ix0 = v[0], ix1 = v[2];
+            terrain_horizon::lines(ter, ix0, ix1, this->texels);
+            glActiveTexture(GL_TEXTURE0 + textureSlot);
+            upload(ix0, ix1);
+         }
+      }
+
+      // bind the texture and set the uniforms of world.frag. toScene takes the world to the space of vPosWS.
+      // s.program must be in use
+      void updateUniforms(shader s, const glm::mat4& toScene) {
+         glActiveTexture(GL_TEXTURE0 + textureSlot);
+         glBindTexture(GL_TEXTURE_2D, horizon);
+         glUniform1i(s["uHorizon"], textureSlot);
+
+         // the texture coordinates of a point p of the scene are (p.z, p.x) * scale + offset: vertex ix is at
+         // x = rect.x + ix / X * rect.z, and its texel is centered at (ix + 0.5) / X
+         const glm::vec3 origin = glm::vec3(toScene * glm::vec4(rect[0], 0.f, rect[1], 1.f));
+         const glm::vec3 extent = glm::vec3(toScene * glm::vec4(rect[2], 0.f, rect[3], 0.f));
+         const glm::vec2 scale(1.f / extent.z, 1.f / extent.x);
+         glUniform4f(s["uHorizonTransform"], scale.x, scale.y, 0.5f / size[1] - origin.z * scale.x, 0.5f / size[0] - origin.x * scale.y);
+      }
+
+      // bytes taken on the GPU
+      size_t getBytes() {
+         return size_t(size[0]) * size[1] * 2;
+      }
+};
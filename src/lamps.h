@@ -107,6 +107,18 @@ class LampGroup {
          return result;
       }
 
+      // move the lamps, which keep their state and shadowmaps. Returns false if the number of positions is not getSize()
+      bool setPositions(std::vector<glm::vec3> positions) {
+         if (positions.size() != size)
+            return false;
+         lampPositions = positions;
+         for (unsigned int i = 0; i < size; ++i) {
+            lampProjectors[i].setPosition(positions[i]);
+            lampMatrices[i] = lampProjectors[i].lightMatrix();
+         }
+         return true;
+      }
+
       // get the texture slot buffer, can be passed as uniform
       std::vector<int> getTextureSlots() {
          return lampTextureSlots;
@@ -0,0 +1,95 @@
+#define STB_IMAGE_IMPLEMENTATION
+#include <tinygltf/stb_image.h>
+
+#include <string>
+#include <iostream>
+#include <chrono>
+#include <cstdlib>
+
+#define GLM_ENABLE_EXPERIMENTAL
+#include <glm/glm.hpp>
+
+#include "common/thread_pool.h"
+#include "common/carousel/carousel.h"
+#include "common/carousel/carousel_loader.h"
+
+/*
+   Headless runner of many independent races on the same scene.
+   The scene is loaded once; every race is a copy of the loaded one, so terrain, track, carpaths and visibility
+   tables are shared and only cars, cameramen and clocks are per race. Races are stepped in parallel on a thread pool.
+
+   usage: main_batch [races] [steps] [step_ms] [cars] [threads] [svg terrain]
+      races    number of scenario variants (default 64)
+      steps    updates per race (default 10000)
+      step_ms  simulated milliseconds per update (default 33)
+      cars     cars of the smallest variant, variant i has cars*(1 + i%4) (default 100)
+      threads  worker threads, 0 for one per hardware thread (default 0)
+      svg terrain  the scene (default assets/small_test.svg and assets/terrain_256.png), see main_generate
+*/
+
+std::string assets_path("assets/");
+
+int argOr(int argc, char** argv, int i, int def) {
+   return (argc > i) ? atoi(argv[i]) : def;
+}
+
+// one scenario variant: a race with its own clock
+struct Scenario {
+   race r;
+   fixed_step_clock clock;
+   double checksum;
+};
+
+int main(int argc, char** argv) {
+   const int numRaces = argOr(argc, argv, 1, 64);
+   const int numSteps = argOr(argc, argv, 2, 10000);
+   const int stepMs   = argOr(argc, argv, 3, 1000 / 30);
+   const int numCars  = argOr(argc, argv, 4, 100);
+   const int threads  = argOr(argc, argv, 5, 0);
+
+   const std::string svg_file = (argc > 7) ? argv[6] : assets_path + "small_test.svg";
+   const std::string terrain_file = (argc > 7) ? argv[7] : assets_path + "terrain_256.png";
+
+   race scene;
+   carousel_loader::load(svg_file.c_str(), terrain_file.c_str(), scene);
+
+   // the variants differ in car count, path assignment and time of day
+   std::vector<Scenario> scenarios(numRaces);
+   for (int i = 0; i < numRaces; ++i) {
+      Scenario& s = scenarios[i];
+      s.r = scene;
+      s.clock.step = stepMs;
+      s.r.set_clock(&s.clock);
+      s.checksum = 0.0;
+      srand(i);
+      for (int c = 0; c < numCars * (1 + i % 4); ++c)
+         s.r.add_car();
+      s.r.start(6 + i % 12, 0, 0, 60);
+   }
+   std::cout << numRaces << " races sharing one scene (" << scene.scene().use_count() << " references)" << std::endl;
+
+   thread_pool pool(threads);
+   std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+   pool.parallel_for(numRaces, [&](size_t i) {
+      Scenario& s = scenarios[i];
+      for (int step = 0; step < numSteps; ++step) {
+         s.r.update();
+         s.checksum += s.r.sunlight_direction().y;
+      }
+      if (s.r.pool().size() > 0)
+         s.checksum += s.r.pool().frames[0][3][0];
+   });
+
+   double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+   double raceSteps = double(numRaces) * numSteps;
+   double checksum = 0.0;
+   for (int i = 0; i < numRaces; ++i)
+      checksum += scenarios[i].checksum;
+
+   printf("%d races x %d steps on %zu threads: %.3f s\n", numRaces, numSteps, pool.size(), seconds);
+   printf("%.0f race-steps/s, %.1f simulated seconds per real second per race\n",
+      raceSteps / seconds, (numSteps * stepMs / 1000.0) / seconds);
+   printf("(checksum %f)\n", checksum);
+   return 0;
+}
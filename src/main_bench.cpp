@@ -0,0 +1,720 @@
+// nanosvg is only the reference of the svg benchmark, the loader reads the svg with svg_stream
+#define NANOSVG_IMPLEMENTATION   // Expands implementation
+#include "../3dparty/nanosvg/src/nanosvg.h"
+
+#define STB_IMAGE_IMPLEMENTATION
+#include <tinygltf/stb_image.h>
+
+#include <string>
+#include <iostream>
+#include <fstream>
+#include <chrono>
+
+#define GLM_ENABLE_EXPERIMENTAL
+#include <glm/glm.hpp>
+
+#include "common/carousel/carousel.h"
+#include "common/carousel/carousel_loader.h"
+#include "common/carousel/car_broadphase.h"
+#include "common/carousel/race_recorder.h"
+#include "common/carousel/terrain_chunks.h"
+#include "common/carousel/terrain_mesh.h"
+#include "common/carousel/height_pyramid.h"
+#include "common/carousel/terrain_horizon.h"
+
+/*
+   Headless benchmarks of the simulation. No window or GL context is created.
+   usage: main_bench [name]   (runs all the benchmarks if no name is given)
+*/
+
+std::string assets_path("assets/");
+
+typedef std::chrono::steady_clock bench_clock;
+
+double elapsedMs(bench_clock::time_point start) {
+   return std::chrono::duration<double, std::milli>(bench_clock::now() - start).count();
+}
+
+// keeps the optimizer from dropping the computed frames
+float sink = 0.f;
+
+// terrain_256.png scaled up to an N x N height field with nearest texels, over a square of the given side
+terrain upscaled_terrain(int N, float side) {
+   int sx, sy, comp;
+   unsigned char* data = stbi_load((assets_path + "terrain_256.png").c_str(), &sx, &sy, &comp, 1);
+   std::vector<unsigned char> big(size_t(N) * N);
+   for (int r = 0; r < N; ++r)
+      for (int c = 0; c < N; ++c)
+         big[size_t(r) * N + c] = data[size_t(r * sy / N) * sx + c * sx / N];
+   stbi_image_free(data);
+
+   terrain ter;
+   ter.set_height_field(&big[0], N, N);
+   ter.rect_xz = glm::vec4(0.f, 0.f, side, side);
+   return ter;
+}
+
+
+/*   ------   benchmarks   ------   */
+
+// per car cost of race::update with 1k, 10k and 100k cars
+void bench_cars(const race& scene) {
+   std::cout << "race::update, per car cost\n";
+   const unsigned int counts[3] = { 1000, 10000, 100000 };
+   for (unsigned int ic = 0; ic < 3; ++ic) {
+      race r = scene;
+      fixed_step_clock clock(1000 / 30);
+      r.set_clock(&clock);
+      for (unsigned int i = 0; i < counts[ic]; ++i)
+         r.add_car();
+      r.start();
+      r.update();
+
+      const unsigned int steps = 20000000 / counts[ic];
+      bench_clock::time_point start = bench_clock::now();
+      for (unsigned int s = 0; s < steps; ++s) {
+         r.update();
+         sink += r.pool().frames[s % counts[ic]][3][0];
+      }
+      double ms = elapsedMs(start);
+      printf("  %7u cars: %8.2f ns/car  (%u updates, %.1f ms)\n", counts[ic], ms * 1e6 / (double(steps) * counts[ic]), steps, ms);
+   }
+}
+
+// memory taken by the paths and cost of evaluating an interpolated frame
+void bench_paths(const race& scene) {
+   std::cout << "paths, memory and interpolation cost\n";
+   scene.wait_paths();
+   if (scene.paths().empty()) {
+      std::cout << "  no carpaths in the scene, skipped\n";
+      return;
+   }
+   size_t packed = 0, dense = 0;
+   for (unsigned int ip = 0; ip < scene.paths().size(); ++ip) {
+      const path& p = scene.paths()[ip];
+      packed += p.bytes();
+      dense += p.size() * sizeof(glm::mat4);
+      printf("  path %u: %zu samples, %zu bytes (%zu as glm::mat4)\n", ip, p.size(), p.bytes(), p.size() * sizeof(glm::mat4));
+   }
+   printf("  total: %zu bytes, %.2fx smaller than glm::mat4 frames\n", packed, double(dense) / double(packed));
+
+   const path& p = scene.paths()[0];
+   const unsigned int evals = 10000000;
+   bench_clock::time_point start = bench_clock::now();
+   for (unsigned int i = 0; i < evals; ++i)
+      sink += p.frame(i % p.size(), (i % 33) / 33.f)[3][0];
+   printf("  path::frame(i, u): %.2f ns\n", elapsedMs(start) * 1e6 / evals);
+}
+
+// sweep and prune against the all pairs test, with thousands of cars
+void bench_broadphase(const race& scene) {
+   std::cout << "car_broadphase, update + overlaps(2.0)\n";
+   const unsigned int counts[3] = { 1000, 5000, 20000 };
+   for (unsigned int ic = 0; ic < 3; ++ic) {
+      race r = scene;
+      fixed_step_clock clock(1000 / 30);
+      r.set_clock(&clock);
+      for (unsigned int i = 0; i < counts[ic]; ++i)
+         r.add_car();
+      r.start();
+      r.update();
+
+      car_broadphase bp;
+      std::vector<std::pair<int, int> > pairs;
+      const unsigned int steps = 100;
+      double ms_update = 0.0, ms_query = 0.0;
+      for (unsigned int s = 0; s < steps; ++s) {
+         r.update();
+         bench_clock::time_point start = bench_clock::now();
+         bp.update(r);
+         ms_update += elapsedMs(start);
+         start = bench_clock::now();
+         bp.overlaps(2.f, pairs);
+         ms_query += elapsedMs(start);
+      }
+
+      // all pairs, once, on the same boxes
+      bench_clock::time_point start = bench_clock::now();
+      size_t n_brute = 0;
+      for (unsigned int i = 0; i < counts[ic]; ++i)
+         for (unsigned int j = i + 1; j < counts[ic]; ++j) {
+            box3 a = bp.box(i), b = bp.box(j);
+            if (a.min.x <= b.max.x + 2.f && b.min.x <= a.max.x + 2.f &&
+                a.min.y <= b.max.y + 2.f && b.min.y <= a.max.y + 2.f &&
+                a.min.z <= b.max.z + 2.f && b.min.z <= a.max.z + 2.f)
+               ++n_brute;
+         }
+      double ms_brute = elapsedMs(start);
+
+      printf("  %6u cars: update %.3f ms, overlaps %.3f ms, %zu pairs (all pairs test: %.3f ms, %zu pairs)\n",
+         counts[ic], ms_update / steps, ms_query / steps, pairs.size(), ms_brute, n_brute);
+   }
+}
+
+// update rate level of detail, 10k cars seen from above one corner of the scene
+void bench_lod(const race& scene) {
+   std::cout << "race::update with level of detail, 10000 cars\n";
+   const glm::vec3 c = scene.bbox().center(), e = scene.bbox().max - scene.bbox().min;
+   const glm::mat4 view = glm::lookAt(glm::vec3(c.x - e.x * 0.4f, 40.f, c.z - e.z * 0.4f), glm::vec3(c.x, 0.f, c.z), glm::vec3(0, 1, 0));
+   const glm::mat4 proj = glm::perspective(glm::radians(45.f), 16.f / 9.f, 0.1f, 1000.f);
+   const int periods[3] = { 1, 4, 16 };
+   for (unsigned int ip = 0; ip < 3; ++ip) {
+      race r = scene;
+      fixed_step_clock clock(1000 / 30);
+      r.set_clock(&clock);
+      for (unsigned int i = 0; i < 10000; ++i)
+         r.add_car();
+      r.set_lod(e.x * 0.25f, periods[ip]);
+      r.set_lod_view(view, proj);
+      r.start();
+      r.update();
+
+      const unsigned int steps = 2000;
+      lod_counters total;
+      bench_clock::time_point start = bench_clock::now();
+      for (unsigned int s = 0; s < steps; ++s) {
+         r.update();
+         total.near += r.lod_stats().near;
+         total.far_updated += r.lod_stats().far_updated;
+         total.far_skipped += r.lod_stats().far_skipped;
+         total.forced += r.lod_stats().forced;
+         sink += r.pool().frames[s % 10000][3][0];
+      }
+      double ms = elapsedMs(start);
+      printf("  period %2d: %.3f ms/update, per update %zu near, %zu far updated, %zu skipped, %zu forced\n", periods[ip], ms / steps,
+         total.near / steps, total.far_updated / steps, total.far_skipped / steps, total.forced / steps);
+   }
+}
+
+// race::evaluate at shuffled times against the sequential updates, 1000 cars
+void bench_evaluate(const race& scene) {
+   std::cout << "race::evaluate, random access against sequential update, 1000 cars\n";
+   race r = scene;
+   fixed_step_clock clock(1000 / 60);
+   r.set_clock(&clock);
+   srand(1);
+   for (unsigned int i = 0; i < 1000; ++i)
+      r.add_car();
+   r.start();
+
+   const unsigned int steps = 3000;
+   std::vector<race_state> seq(steps);
+   bench_clock::time_point start = bench_clock::now();
+   for (unsigned int s = 0; s < steps; ++s) {
+      r.update();
+      seq[s].t = r.elapsed();
+      seq[s].cameramen = r.cameramen();
+   }
+   double ms_seq = elapsedMs(start);
+
+   std::vector<unsigned int> order(steps);
+   for (unsigned int s = 0; s < steps; ++s)
+      order[s] = s;
+   for (unsigned int s = steps - 1; s > 0; --s)
+      std::swap(order[s], order[rand() % (s + 1)]);
+
+   unsigned int mismatches = 0;
+   start = bench_clock::now();
+   for (unsigned int k = 0; k < steps; ++k) {
+      const race_state& expected = seq[order[k]];
+      race_state st = r.evaluate(expected.t);
+      for (unsigned int ic = 0; ic < st.cameramen.size(); ++ic) {
+         const cameraman& a = st.cameramen[ic], &b = expected.cameramen[ic];
+         if (a.is_locked() != b.is_locked() || (a.is_locked() && a.target() != b.target()) || a.frame != b.frame)
+            ++mismatches;
+      }
+      sink += st.car_frames[0][3][0];
+   }
+   double ms_eval = elapsedMs(start);
+   printf("  update: %.3f ms/step, evaluate: %.3f ms/call, %u cameraman mismatches\n", ms_seq / steps, ms_eval / steps, mismatches);
+}
+
+// recording 1000 cars: encoding cost, size, and seek time of the reader
+void bench_record(const race& scene) {
+   std::cout << "race_recorder, 1000 cars, 3000 updates\n";
+   race r = scene;
+   fixed_step_clock clock(1000 / 60);
+   r.set_clock(&clock);
+   for (unsigned int i = 0; i < 1000; ++i)
+      r.add_car();
+   r.start();
+
+   const char* filename = "bench_record.rec";
+   race_recorder recorder;
+   recorder.open(filename);
+
+   const unsigned int steps = 3000;
+   std::vector<long long> times(steps);
+   std::vector<glm::vec3> positions(steps);   // of car 0, to check the decoded ones
+   double ms_update = 0.0, ms_record = 0.0;
+   for (unsigned int s = 0; s < steps; ++s) {
+      // the recorder is called by hand instead of through race::set_observer, to time it apart from the update
+      bench_clock::time_point start = bench_clock::now();
+      r.update();
+      ms_update += elapsedMs(start);
+      start = bench_clock::now();
+      recorder.updated(r);
+      ms_record += elapsedMs(start);
+      times[s] = r.elapsed();
+      positions[s] = glm::vec3(r.pool().frames[0][3]);
+   }
+   recorder.close();
+   printf("  update %.3f ms, recording %.3f ms per update, %.2f bytes per car per update (%zu as glm::mat4)\n",
+      ms_update / steps, ms_record / steps, double(recorder.bytes()) / (double(steps) * 1000), sizeof(glm::mat4));
+
+   race_reader reader;
+   reader.open(filename);
+   race_record rec;
+   float max_err = 0.f;
+   bench_clock::time_point start = bench_clock::now();
+   for (unsigned int k = 0; k < 200; ++k) {
+      unsigned int s = (k * 7919) % steps;
+      reader.seek(times[s], rec);
+      max_err = std::max(max_err, glm::length(glm::vec3(rec.car_frames[0][3]) - positions[s]));
+   }
+   printf("  seek: %.3f ms, max position error %f\n", elapsedMs(start) / 200, max_err);
+   reader.close();
+   remove(filename);
+}
+
+// carousel_loader::load, serial against parallel, on a generated scene with dozens of carpaths
+void bench_load() {
+   std::cout << "carousel_loader::load, 48 carpaths, serial and parallel\n";
+   // closed loops of four cubic Bezier segments around the center of a 378x378 scene
+   const char* filename = "bench_load.svg";
+   {
+      std::ofstream svg(filename);
+      svg << "<svg xmlns=\"http://www.w3.org/2000/svg\" width=\"378\" height=\"378\">\n";
+      for (int i = 0; i < 49; ++i) {
+         float R = 40.f + 2.5f * i, k = 0.5523f * R, cx = 189.f, cy = 189.f;
+         svg << "<path id=\"" << (i == 0 ? std::string("track") : "carpath" + std::to_string(i - 1)) << "\" d=\"M " << cx + R << " " << cy
+             << " C " << cx + R << " " << cy + k << " " << cx + k << " " << cy + R << " " << cx << " " << cy + R
+             << " C " << cx - k << " " << cy + R << " " << cx - R << " " << cy + k << " " << cx - R << " " << cy
+             << " C " << cx - R << " " << cy - k << " " << cx - k << " " << cy - R << " " << cx << " " << cy - R
+             << " C " << cx + k << " " << cy - R << " " << cx + R << " " << cy - k << " " << cx + R << " " << cy << " Z\"/>\n";
+      }
+      for (int i = 0; i < 20; ++i)
+         svg << "<rect id=\"tree" << i << "\" x=\"" << 10 + 17 * i << "\" y=\"10\" width=\"1\" height=\"1\"/>\n";
+      for (int i = 0; i < 4; ++i)
+         svg << "<rect id=\"cameraman_15_" << i << "\" x=\"" << 60 + 80 * i << "\" y=\"189\" width=\"1\" height=\"1\"/>\n";
+      svg << "</svg>\n";
+   }
+
+   double ms[2];
+   for (int p = 0; p < 2; ++p) {
+      carousel_loader::parallel() = (p == 1);
+      race r;
+      bench_clock::time_point start = bench_clock::now();
+      carousel_loader::load(filename, (assets_path + "terrain_256.png").c_str(), r, false);
+      r.wait_paths();
+      ms[p] = elapsedMs(start);
+      sink += r.paths().back().position(0).x;
+   }
+   carousel_loader::parallel() = true;
+   printf("  serial %.1f ms, parallel %.1f ms on %zu threads: %.2fx\n", ms[0], ms[1], thread_pool::global().size(), ms[0] / ms[1]);
+   remove(filename);
+}
+
+// arc length sampling of a long track (200 segments, about 31400 units) against the fixed step walker
+void bench_sampler() {
+   std::cout << "bezier_path, arc length sampler against the fixed step walker\n";
+   std::vector<glm::vec3> cp;
+   const float R = 100.f, k = 0.5523f * R;
+   cp.push_back(glm::vec3(R, 0, 0));
+   for (int l = 0; l < 50; ++l) {
+      const glm::vec3 loop[12] = { glm::vec3(R, 0, k), glm::vec3(k, 0, R), glm::vec3(0, 0, R),
+                                   glm::vec3(-k, 0, R), glm::vec3(-R, 0, k), glm::vec3(-R, 0, 0),
+                                   glm::vec3(-R, 0, -k), glm::vec3(-k, 0, -R), glm::vec3(0, 0, -R),
+                                   glm::vec3(k, 0, -R), glm::vec3(R, 0, -k), glm::vec3(R, 0, 0) };
+      cp.insert(cp.end(), loop, loop + 12);
+   }
+
+   const double deltas[2] = { 0.1, 1.0 };
+   for (int id = 0; id < 2; ++id)
+      for (int m = 0; m < 2; ++m) {
+         std::vector<glm::vec3> samples, tans;
+         float tot = 0.f;
+         bench_clock::time_point start = bench_clock::now();
+         if (m == 0)
+            bezier_path::fixed_step_sampling(cp, deltas[id], samples, tans, &tot);
+         else
+            bezier_path::regular_sampling(cp, deltas[id], samples, tans, &tot);
+         double ms = elapsedMs(start);
+
+         double max_err = 0.0;
+         for (size_t i = 1; i < samples.size(); ++i)
+            max_err = std::max(max_err, fabs(glm::length(samples[i] - samples[i - 1]) - deltas[id]));
+         printf("  delta %.1f, %s: %.2f ms, %zu samples, length %.1f, max spacing error %.5f\n", deltas[id],
+            m == 0 ? "fixed step" : "arc length", ms, samples.size(), tot, max_err);
+      }
+}
+
+
+// tiled height field of a 4096x4096 terrain against the same one decoded in memory: open time, cost of
+// random and coherent terrain::y lookups, tiles kept mapped
+void bench_tiles() {
+   std::cout << "terrain_tiles, 4096x4096 height field, tiled against in memory\n";
+   const int N = 4096;
+   const terrain big = upscaled_terrain(N, 4000.f);
+
+   const char* filename = "bench_terrain.tiles";
+   terrain_tiles::write(filename, big.height_field.get(), N, N);
+
+   terrain ter[2];
+   double open_ms[2];
+   bench_clock::time_point start = bench_clock::now();
+   ter[0].set_height_field(big.height_field.get(), N, N);
+   open_ms[0] = elapsedMs(start);
+   start = bench_clock::now();
+   ter[1].set_tiles(filename, 16);
+   open_ms[1] = elapsedMs(start);
+   for (int t = 0; t < 2; ++t)
+      ter[t].rect_xz = glm::vec4(0.f, 0.f, 4000.f, 4000.f);
+
+   const int Q = 1000000;
+   std::vector<glm::vec2> random_xz(Q), walk_xz(Q);
+   for (int i = 0; i < Q; ++i) {
+      random_xz[i] = glm::vec2(float(rand() % 3990), float(rand() % 3990));
+      float a = 6.2831853f * i / Q;
+      walk_xz[i] = glm::vec2(2000.f + 1800.f * cos(a), 2000.f + 1800.f * sin(a));
+   }
+   for (int t = 0; t < 2; ++t) {
+      double ms[2];
+      float check = 0.f;
+      for (int w = 0; w < 2; ++w) {
+         const std::vector<glm::vec2>& q = (w == 0) ? random_xz : walk_xz;
+         start = bench_clock::now();
+         for (int i = 0; i < Q; ++i)
+            check += ter[t].y(q[i].x, q[i].y);
+         ms[w] = elapsedMs(start);
+      }
+      sink += check;
+      printf("  %s: open %.2f ms, random %.1f ns/lookup, walk %.1f ns/lookup (sum %.1f)", t == 0 ? "in memory" : "tiled    ",
+         open_ms[t], ms[0] * 1e6 / Q, ms[1] * 1e6 / Q, check);
+      if (t == 1)
+         printf(", %zu tiles mapped, %zu misses", ter[1].tiles->resident(), ter[1].tiles->misses());
+      printf("\n");
+   }
+   ter[1].tiles.reset();
+   remove(filename);
+}
+
+// batch terrain::heights against one terrain::y per point on the terrain of the scene, 1M random points: heights
+// alone, then heights and slopes against the three projections a carpath frame took before
+void bench_terrain(const race& scene) {
+   std::cout << "terrain::heights, batch against scalar terrain::y, 1M points\n";
+   const terrain& ter = scene.ter();
+   const int Q = 1000000;
+   std::vector<float> xs(Q), zs(Q), hs(Q);
+   std::vector<glm::vec2> grads(Q);
+   for (int i = 0; i < Q; ++i) {
+      // inside the height field, where terrain::y reads no texel out of it
+      xs[i] = ter.rect_xz[0] + ter.rect_xz[2] * (rand() % 10000) / 10000.f * (ter.size_pix[0] - 1) / ter.size_pix[0];
+      zs[i] = ter.rect_xz[1] + ter.rect_xz[3] * (rand() % 10000) / 10000.f * (ter.size_pix[1] - 1) / ter.size_pix[1];
+   }
+
+   float check = 0.f;
+   bench_clock::time_point start = bench_clock::now();
+   for (int i = 0; i < Q; ++i)
+      check += ter.y(xs[i], zs[i]);
+   double scalar_ms = elapsedMs(start);
+   start = bench_clock::now();
+   ter.heights(&xs[0], &zs[0], Q, &hs[0]);
+   double batch_ms = elapsedMs(start);
+   float max_diff = 0.f;
+   for (int i = 0; i < Q; ++i)
+      max_diff = std::max(max_diff, fabsf(hs[i] - ter.y(xs[i], zs[i])));
+   printf("  heights: scalar %.1f ns/point, batch %.1f ns/point: %.2fx, max difference %g\n", scalar_ms * 1e6 / Q,
+      batch_ms * 1e6 / Q, scalar_ms / batch_ms, max_diff);
+
+   // the slope along a unit direction, from three projections as the loader did and from the gradient
+   const glm::vec3 dir = glm::normalize(glm::vec3(1.f, 0.f, 2.f));
+   start = bench_clock::now();
+   for (int i = 0; i < Q; ++i) {
+      const glm::vec3 p(xs[i], 0.f, zs[i]);
+      const glm::vec3 o = ter.p(p);
+      check += (ter.p(p + dir) - o).y + (ter.p(p - dir) - o).y;
+   }
+   scalar_ms = elapsedMs(start);
+   start = bench_clock::now();
+   ter.heights(&xs[0], &zs[0], Q, &hs[0], &grads[0]);
+   for (int i = 0; i < Q; ++i)
+      check += grads[i].x * dir.x + grads[i].y * dir.z;
+   batch_ms = elapsedMs(start);
+   sink += check;
+   printf("  slopes: three projections %.1f ns/point, batch gradient %.1f ns/point: %.2fx\n", scalar_ms * 1e6 / Q,
+      batch_ms * 1e6 / Q, scalar_ms / batch_ms);
+}
+
+// chunked terrain level of detail on a 2048x2048 terrain: time to build the chunks, then the chunks and triangles
+// selected against the full mesh for a view from the ground and for a shadow map covering the whole terrain
+void bench_chunks() {
+   std::cout << "terrain_chunks, 2048x2048 height field, selected triangles against the full mesh\n";
+   const int N = 2048;
+   const terrain ter = upscaled_terrain(N, 2000.f);
+   terrain_chunks chunks;
+   bench_clock::time_point start = bench_clock::now();
+   chunks.build(ter, 20.f);
+   const double build_ms = elapsedMs(start);
+   printf("  build %.1f ms on %zu threads: %zu chunks in %d levels, %.1f MB of vertices\n", build_ms,
+      thread_pool::global().size(), chunks.nodes.size(), chunks.levels, chunks.vertices.size() * sizeof(float) / 1e6);
+
+   const glm::vec3 eye(300.f, ter.y(300.f, 300.f) + 2.f, 300.f);
+   const glm::mat4 views[2] = {
+      glm::perspective(glm::radians(45.f), 1440.f / 900.f, 0.1f, 3000.f) *
+         glm::lookAt(eye, glm::vec3(1000.f, ter.y(1000.f, 1000.f), 1000.f), glm::vec3(0.f, 1.f, 0.f)),
+      glm::ortho(-1500.f, 1500.f, -1500.f, 1500.f, 0.f, 4000.f) *
+         glm::lookAt(glm::vec3(1000.f, 2000.f, 1500.f), glm::vec3(1000.f, 0.f, 1000.f), glm::vec3(0.f, 1.f, 0.f)) };
+   const char* names[2] = { "ground view, 900 px  ", "shadow map, 2048 px  " };
+   const unsigned int resolutions[2] = { 900, 2048 };
+   const size_t full = terrain_chunks::full_triangles(ter);
+   std::vector<int> selection;
+   for (int v = 0; v < 2; ++v)
+      for (float tolerance = 1.f; tolerance <= 4.f; tolerance *= 2.f) {
+         start = bench_clock::now();
+         chunks.select(views[v], (float)resolutions[v], tolerance, selection);
+         const double ms = elapsedMs(start);
+         printf("  %s tolerance %.0f px: %zu chunks, %zu triangles (%.2f%% of %zu), selected in %.3f ms\n", names[v],
+            tolerance, selection.size(), chunks.triangles(selection), 100.0 * chunks.triangles(selection) / full, full, ms);
+      }
+}
+
+// full resolution terrain mesh of a 2048x2048 terrain: terrain_mesh against one vertex at a time through terrain::hf
+// on a single thread, checked to give the same vertices
+void bench_mesh() {
+   std::cout << "terrain_mesh, 2048x2048 height field, interleaved vertices and indices\n";
+   const int N = 2048;
+   std::vector<unsigned char> big(size_t(N) * N);
+   for (int r = 0; r < N; ++r)
+      for (int c = 0; c < N; ++c)
+         big[size_t(r) * N + c] = (unsigned char)(60 + 50 * sin(r * 0.01) * cos(c * 0.013));
+   terrain ter;
+   ter.set_height_field(&big[0], N, N);
+   ter.rect_xz = glm::vec4(0.f, 0.f, 2000.f, 2000.f);
+
+   // both outputs allocated and touched up front, so that only building is timed
+   std::vector<float> reference(size_t(N) * N * terrain_mesh::FLOATS), vertices(reference.size());
+   std::vector<unsigned int> indices;
+   bench_clock::time_point start = bench_clock::now();
+   for (int iz = 0; iz < N; ++iz)
+      for (int ix = 0; ix < N; ++ix)
+         terrain_mesh::vertex(ter, ix, iz, 20.f, &reference[(size_t(iz) * N + ix) * terrain_mesh::FLOATS]);
+   const double scalar_ms = elapsedMs(start);
+   start = bench_clock::now();
+   terrain_mesh::vertices(ter, 20.f, vertices);
+   const double rows_ms = elapsedMs(start);
+   start = bench_clock::now();
+   terrain_mesh::indices(ter, indices);
+   const double indices_ms = elapsedMs(start);
+   printf("  vertices: one at a time %.1f ms, rows on %zu threads %.1f ms: %.2fx, %s; indices %.1f ms; %.1f MB\n", scalar_ms,
+      thread_pool::global().size(), rows_ms, scalar_ms / rows_ms, vertices == reference ? "same vertices" : "DIFFERENT vertices",
+      indices_ms, (vertices.size() * sizeof(float) + indices.size() * sizeof(unsigned int)) / 1e6);
+}
+
+// ray casts against a 4096x4096 terrain with height_pyramid: build time, then grazing rays like those of picking and
+// lines of sight between points above the ground like those of the cameramen, one at a time and in batch, against
+// marching each ray with fixed steps of half a texel through terrain::y
+void bench_raycast() {
+   std::cout << "height_pyramid, 4096x4096 height field, ray casts against a fixed step march\n";
+   const int N = 4096;
+   const terrain ter = upscaled_terrain(N, 4000.f);
+   height_pyramid pyramid;
+   bench_clock::time_point start = bench_clock::now();
+   pyramid.build(ter);
+   printf("  build %.1f ms on %zu threads: %d levels, %.1f MB\n", elapsedMs(start), thread_pool::global().size(),
+      pyramid.levels(), pyramid.bytes() / 1e6);
+
+   // grazing rays from above the highest point, then segments between two points 1.5 above the ground
+   const int Q = 20000;
+   const float step = 0.5f;
+   std::vector<glm::vec3> o[2], d[2];
+   float t_max[2] = { 4000.f, 1.f };
+   for (int i = 0; i < Q; ++i) {
+      const glm::vec2 a(10.f + (rand() % 39800) / 10.f, 10.f + (rand() % 39800) / 10.f);
+      const float angle = 6.2831853f * (rand() % 10000) / 10000.f;
+      o[0].push_back(glm::vec3(a.x, 6.f, a.y));
+      d[0].push_back(glm::normalize(glm::vec3(cos(angle), -0.02f - 0.2f * (rand() % 1000) / 1000.f, sin(angle))));
+      const glm::vec2 b = glm::clamp(a + 500.f * glm::vec2(cos(angle), sin(angle)), 10.f, 3990.f);
+      o[1].push_back(glm::vec3(a.x, ter.y(a.x, a.y) + 1.5f, a.y));
+      d[1].push_back(glm::vec3(b.x, ter.y(b.x, b.y) + 1.5f, b.y) - o[1].back());
+   }
+   const char* names[2] = { "picking rays   ", "lines of sight " };
+   std::vector<float> hits(Q), batch(Q), marched(Q);
+   for (int k = 0; k < 2; ++k) {
+      start = bench_clock::now();
+      for (int i = 0; i < Q; ++i)
+         if (!pyramid.ray(o[k][i], d[k][i], t_max[k], hits[i]))
+            hits[i] = -1.f;
+      const double single_ms = elapsedMs(start);
+      start = bench_clock::now();
+      pyramid.rays(&o[k][0], &d[k][0], Q, t_max[k], &batch[0]);
+      const double batch_ms = elapsedMs(start);
+      start = bench_clock::now();
+      for (int i = 0; i < Q; ++i) {
+         const float dt = step / glm::length(d[k][i]);
+         marched[i] = -1.f;
+         for (float t = 0.f; t <= t_max[k]; t += dt) {
+            const glm::vec3 p = o[k][i] + t * d[k][i];
+            if (p.y <= ter.y(p.x, p.z)) {
+               marched[i] = t;
+               break;
+            }
+         }
+      }
+      const double march_ms = elapsedMs(start);
+
+      // the march sees the bilinear surface of terrain::y, the pyramid the triangles of the mesh
+      int agree = 0, n_hits = 0;
+      for (int i = 0; i < Q; ++i) {
+         n_hits += hits[i] >= 0.f;
+         agree += (hits[i] < 0.f) == (marched[i] < 0.f) &&
+            (hits[i] < 0.f || fabsf(hits[i] - marched[i]) * glm::length(d[k][i]) < 2.f * step);
+         sink += hits[i] + batch[i];
+      }
+      printf("  %s pyramid %.0f ns/ray, batch %.0f ns/ray, march %.0f ns/ray: %.1fx; %d of %d hit, %.1f%% agree with the "
+         "march, batch %s\n", names[k], single_ms * 1e6 / Q, batch_ms * 1e6 / Q, march_ms * 1e6 / Q, march_ms / single_ms,
+         n_hits, Q, 100.0 * agree / Q, batch == hits ? "same" : "DIFFERENT");
+   }
+}
+
+// horizon map of a 4096x4096 terrain (terrain_horizon): build time, then a few lines against the horizon of every
+// vertex searched over all the vertices of its line, time per line and vertices whose byte differs
+void bench_horizon() {
+   std::cout << "terrain_horizon, 4096x4096 height field, hull sweep against an exhaustive search\n";
+   const int N = 4096;
+   const terrain ter = upscaled_terrain(N, 4000.f);
+   std::vector<unsigned char> horizon;
+   bench_clock::time_point start = bench_clock::now();
+   terrain_horizon::build(ter, horizon);
+   const double build_ms = elapsedMs(start);
+
+   const int L = 4;
+   const float dz = ter.rect_xz[3] / N;
+   int differ = 0;
+   start = bench_clock::now();
+   for (int l = 0; l < L; ++l) {
+      const int ix = l * (N / L);
+      for (int iz = 0; iz < N; ++iz)
+         for (int side = 0; side < 2; ++side) {
+            float best = 0.f;
+            bool any = false;
+            for (int j = (side == 0) ? 0 : iz + 1; j < ((side == 0) ? iz : N); ++j) {
+               const float a = atanf((ter.hf(ix, j) - ter.hf(ix, iz)) / (abs(j - iz) * dz));
+               best = any ? std::max(best, a) : a;
+               any = true;
+            }
+            differ += abs(int(terrain_horizon::encode(best)) - int(horizon[(size_t(ix) * N + iz) * 2 + side])) > 1;
+         }
+   }
+   const double search_ms = elapsedMs(start);
+   printf("  build %.1f ms on %zu threads, %.1f MB: %.3f ms per line against %.1f ms exhaustive, %d of %d vertices differ "
+      "by more than a step\n", build_ms, thread_pool::global().size(), horizon.size() / 1e6, build_ms / N, search_ms / L,
+      differ, L * N * 2);
+}
+
+// svg_stream against nanosvg on a generated svg with 40k trees and lamps and a few carpaths drawn with every
+// path command: parse time and the largest difference between the points of the shapes the loader uses
+void bench_svg() {
+   std::cout << "svg_stream against nsvgParseFromFile, 40k trees and lamps\n";
+   const char* filename = "bench_svg.svg";
+   {
+      std::ofstream svg(filename);
+      svg << "<?xml version=\"1.0\"?>\n<!-- generated -->\n"
+          << "<svg xmlns=\"http://www.w3.org/2000/svg\" width=\"1000\" height=\"800\" viewBox=\"0 0 250 200\">\n"
+          << "<defs><rect id=\"tree_in_defs\" x=\"1\" y=\"1\" width=\"1\" height=\"1\"/></defs>\n"
+          << "<g id=\"layer\" transform=\"translate(5,3) scale(0.9)\">\n";
+      for (int i = 0; i < 40000; ++i)
+         svg << "<rect style=\"fill:#00ff00;stroke:none\" id=\"" << (i % 2 ? "tree" : "lamp") << i << "\" width=\"0.4\" height=\"0.4\" x=\""
+             << (i % 200) * 1.2f << "\" y=\"" << (i / 200) * 0.9f << "\" />\n";
+      svg << "<circle id=\"cameraman_15_0\" cx=\"40\" cy=\"50\" r=\"1\"/>\n"
+          << "<g transform=\"rotate(10 120 100)\"><path id=\"track\" d=\"M 20,100 C 20,40 220,40 220,100 S 20,160 20,100 Z\"/></g>\n"
+          << "<path id=\"carpath0\" d=\"m 30,100 l 50,-40 h 40 q 40,0 60,40 t -20,40 a 30 20 15 0 1 -60,10 v -10 L 30,100 z\"/>\n"
+          << "<path id=\"carpath1\" transform=\"matrix(1 0.1 -0.1 1 4 -2)\" d=\"M40 100C40-5e1 200 50 200 100s-160 50-160 0z M60 100 H 70\"/>\n"
+          << "<polygon id=\"carpath2\" points=\"30,30 60,35 50,70\"/>\n"
+          << "</g>\n</svg>\n";
+   }
+
+   bench_clock::time_point start = bench_clock::now();
+   NSVGimage* ref = nsvgParseFromFile(filename, "px", 96);
+   double ms_nanosvg = elapsedMs(start);
+
+   start = bench_clock::now();
+   svg_stream::image img;
+   svg_stream::parse(filename, carousel_loader::wanted, img, 96.f);
+   double ms_stream = elapsedMs(start);
+
+   // the shapes of nanosvg the loader would use, in order, against the extracted ones
+   size_t n = 0;
+   bool same = (ref->width == img.width && ref->height == img.height);
+   float max_diff = 0.f;
+   for (NSVGshape* shape = ref->shapes; shape != NULL; shape = shape->next) {
+      if (!carousel_loader::wanted(shape->id))
+         continue;
+      if (n >= img.shapes.size() || img.shapes[n].id != shape->id) {
+         same = false;
+         break;
+      }
+      size_t ip = 0;
+      for (NSVGpath* path = shape->paths; path != NULL; path = path->next, ++ip) {
+         if (ip >= img.shapes[n].paths.size() || img.shapes[n].paths[ip].pts.size() != size_t(path->npts)) {
+            same = false;
+            break;
+         }
+         for (int i = 0; i < path->npts; ++i)
+            max_diff = std::max(max_diff, glm::length(img.shapes[n].paths[ip].pts[i] - glm::vec2(path->pts[2 * i], path->pts[2 * i + 1])));
+      }
+      same = same && (ip == img.shapes[n].paths.size());
+      ++n;
+   }
+   same = same && (n == img.shapes.size());
+   nsvgDelete(ref);
+   printf("  nanosvg %.1f ms, svg_stream %.1f ms: %.2fx, %zu shapes kept, %s, max point difference %g\n", ms_nanosvg, ms_stream,
+      ms_nanosvg / ms_stream, img.shapes.size(), same ? "same shapes" : "DIFFERENT shapes", max_diff);
+   remove(filename);
+}
+
+/*   ------   main   ------   */
+
+int main(int argc, char** argv) {
+   std::string which = (argc > 1) ? argv[1] : "all";
+
+   // the simulation benchmarks run on the shipped scene, or on the one given (see main_generate)
+   const std::string svg_file = (argc > 3) ? argv[2] : assets_path + "small_test.svg";
+   const std::string terrain_file = (argc > 3) ? argv[3] : assets_path + "terrain_256.png";
+   race scene;
+   carousel_loader::load(svg_file.c_str(), terrain_file.c_str(), scene);
+
+   if (which == "all" || which == "cars")
+      bench_cars(scene);
+   if (which == "all" || which == "paths")
+      bench_paths(scene);
+   if (which == "all" || which == "broadphase")
+      bench_broadphase(scene);
+   if (which == "all" || which == "lod")
+      bench_lod(scene);
+   if (which == "all" || which == "evaluate")
+      bench_evaluate(scene);
+   if (which == "all" || which == "record")
+      bench_record(scene);
+   if (which == "all" || which == "load")
+      bench_load();
+   if (which == "all" || which == "sampler")
+      bench_sampler();
+   if (which == "all" || which == "tiles")
+      bench_tiles();
+   if (which == "all" || which == "svg")
+      bench_svg();
+   if (which == "all" || which == "terrain")
+      bench_terrain(scene);
+   if (which == "all" || which == "chunks")
+      bench_chunks();
+   if (which == "all" || which == "mesh")
+      bench_mesh();
+   if (which == "all" || which == "raycast")
+      bench_raycast();
+   if (which == "all" || which == "horizon")
+      bench_horizon();
+
+   std::cout << "(" << sink << ")" << std::endl;
+   return 0;
+}
@@ -1,8 +1,3 @@
-#define NANOSVG_IMPLEMENTATION   // Expands implementation
-#include "../3dparty/nanosvg/src/nanosvg.h"
-#define NANOSVGRAST_IMPLEMENTATION
-#include "../3dparty/nanosvg/src/nanosvgrast.h"
-
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
 #include <string>
@@ -16,6 +11,9 @@
 #include "common/simple_shapes.h"
 #include "common/matrix_stack.h"
 
+#define LOAD_PROFILE_IMPLEMENTATION  // counts the heap in the startup profile
+#include "common/load_profile.h"
+
 #define STB_IMAGE_IMPLEMENTATION
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #define TINYGLTF_IMPLEMENTATION
@@ -25,8 +23,15 @@
 #include "common/carousel/carousel.h"
 #include "common/carousel/carousel_to_renderable.h"
 #include "common/carousel/carousel_loader.h"
+#include "common/carousel/race_recorder.h"
+#include "common/carousel/scene_watch.h"
+#include "common/carousel/height_pyramid.h"
 
 #include "carousel_augment.h"
+#include "terrain_lod.h"
+#include "terrain_displaced.h"
+#include "horizon_map.h"
+#include "sun_shadow_cache.h"
 #include "camera_controls.h"
 #include "transformations.h"
 #include "headlights.h"
@@ -61,9 +66,16 @@ int height = 900;
 
 // opening angle of the headlights' beam
 #define HEADLIGHT_ANGLE  glm::radians(50.f)
-// how many cars should be displayed
+// how many cars should be displayed, unless given on the command line
 #define CARS_NUM 1
 
+// lamps that cast light, at most: NUM_LAMPS of the world shaders
+#define MAX_LAMP_LIGHTS 19
+
+// cars farther than CARS_LOD_DISTANCE from the view (in scene units), or off screen, update once every CARS_LOD_PERIOD frames
+#define CARS_LOD_DISTANCE  150.f
+#define CARS_LOD_PERIOD    4
+
 // determines the time of day the lights should turn on/off
 // insert the angular distance of the Sun above the horizon
 #define LAMP_NIGHTTIME_THRESHOLD         20.0
@@ -77,6 +89,24 @@ float headlight_nighttime = glm::cos(glm::radians(90.0 - HEADLIGHT_NIGHTTIME_THR
 #define LAMP_SHADOWMAP_SIZE        1024u
 #define HEADLIGHT_SHADOWMAP_SIZE   1024u
 
+// how the terrain is drawn: TERRAIN_MESH, the whole full resolution mesh in every pass, TERRAIN_CHUNKS, the chunks
+// of terrain_lod.h each pass needs, with a geometric error of at most TERRAIN_LOD_TOLERANCE pixels on its target, or
+// TERRAIN_DISPLACED, a grid displaced on the GPU by the height field uploaded as a texture (terrain_displaced.h)
+#define TERRAIN_MESH      0
+#define TERRAIN_CHUNKS    1
+#define TERRAIN_DISPLACED 2
+#define TERRAIN_RENDERER  TERRAIN_CHUNKS
+#define TERRAIN_LOD_TOLERANCE  1.5f
+
+// the terrain shades itself from the sun with the horizon map of horizon_map.h, and is not drawn in the sun's shadow map
+#define TERRAIN_HORIZON  1
+
+// the static casters of the sun's shadow map are cached (sun_shadow_cache.h) for SUN_SHADOW_CACHE_ENTRIES angles of the
+// sun, quantized to SUN_SHADOW_STEP degrees: each frame only the cars and the cameramen are drawn on top of them
+#define SUN_SHADOW_CACHE          1
+#define SUN_SHADOW_STEP           0.5f
+#define SUN_SHADOW_CACHE_ENTRIES  2u
+
 #define CAMERA_FAST 0.250f
 #define CAMERA_SLOW 0.025f
 
@@ -91,6 +121,8 @@ bool lampState = false;
 bool lampUserState = false;
 bool headlightState = false;
 bool headlightUserState = false;
+bool recordUserState = false;
+bool pickUserState = false;
 float playerMinHeight = 0.01;
 
 // textures and shading
@@ -106,6 +138,8 @@ typedef enum textureSlot {
    TEXTURE_GRASS,
    TEXTURE_ROAD,
    TEXTURE_DIFFUSE,
+   TEXTURE_HEIGHTFIELD,
+   TEXTURE_HORIZON,
    TEXTURE_SHADOWMAP_SUN,
    TEXTURE_SHADOWMAP_LAMPS,
    TEXTURE_SHADOWMAP_CARS
@@ -177,7 +211,8 @@ void updateDelta() {
    lastFrame = currentFrame;
 }
 
-void processInput(GLFWwindow* window, terrain t) {
+// ground is the terrain mesh in world coordinates, toScene takes them to the scene the camera moves in
+void processInput(GLFWwindow* window, const height_pyramid& ground, const glm::mat4& toScene) {
    if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS)
       glfwSetWindowShouldClose(window, true);
 
@@ -191,11 +226,32 @@ void processInput(GLFWwindow* window, terrain t) {
       camera.step(CAMERA_RIGHT, deltaTime);
    if (glfwGetKey(window, GLFW_KEY_SPACE) == GLFW_PRESS)
       camera.step(CAMERA_UP, deltaTime);
-   if (glfwGetKey(window, GLFW_KEY_LEFT_SHIFT) == GLFW_PRESS) {
-      glm::vec3 pos = camera.getPosition();
-      //if (pos.y > t.y(pos.x, pos.z))
-      if (pos.y > playerMinHeight)
-         camera.step(CAMERA_DOWN, deltaTime);
+   if (glfwGetKey(window, GLFW_KEY_LEFT_SHIFT) == GLFW_PRESS)
+      camera.step(CAMERA_DOWN, deltaTime);
+
+   // keep the camera playerMinHeight above the terrain, walking into a hill climbs it
+   const glm::mat4 toWorld = glm::inverse(toScene);
+   glm::vec3 pos = camera.getPosition();
+   const glm::vec3 world = glm::vec3(toWorld * glm::vec4(pos, 1.f));
+   float groundY, minY = playerMinHeight;
+   if (ground.height(world.x, world.z, groundY))
+      minY += (toScene * glm::vec4(world.x, groundY, world.z, 1.f)).y;
+   if (pos.y < minY) {
+      pos.y = minY;
+      camera.setPosition(pos);
+   }
+
+   // the point of the terrain at the center of the view
+   if (pickUserState) {
+      pickUserState = false;
+      const glm::vec3 ahead = -glm::vec3(glm::inverse(camera.matrix())[2]);
+      float t;
+      if (ground.ray(glm::vec3(toWorld * glm::vec4(pos, 1.f)), glm::vec3(toWorld * glm::vec4(ahead, 0.f)), 1e6f, t)) {
+         const glm::vec3 hit = glm::vec3(toWorld * glm::vec4(pos + t * ahead, 1.f));
+         std::cout << "terrain at (" << hit.x << ", " << hit.y << ", " << hit.z << ")" << std::endl;
+      }
+      else
+         std::cout << "no terrain at the center of the view" << std::endl;
    }
 }
 
@@ -245,6 +301,16 @@ void keyboard_callback(GLFWwindow* window, int key, int scancode, int action, in
          case GLFW_KEY_Q:
             drawShadows = !drawShadows;
             break;
+
+         // start/stop recording the race to race.rec
+         case GLFW_KEY_R:
+            recordUserState = !recordUserState;
+            break;
+
+         // print the point of the terrain at the center of the view
+         case GLFW_KEY_P:
+            pickUserState = true;
+            break;
       }
    }  
 }
@@ -285,9 +351,13 @@ void draw_sunDirection(glm::vec3 sundir) {
 }
 
 renderable r_terrain;
-void draw_terrain(shader sh, matrix_stack stack) {
+TerrainLOD terrainLOD;
+TerrainDisplaced terrainDisplaced;
+HorizonMap horizonMap;
+bool terrainHorizon = false;   // the horizon map is in use
+// view_proj takes the world to the clip space of the pass, whose target is resolution pixels high
+void draw_terrain(shader sh, matrix_stack stack, const glm::mat4& view_proj, unsigned int resolution) {
    glUseProgram(sh.program);
-   r_terrain.bind();
    
    glActiveTexture(GL_TEXTURE0 + TEXTURE_GRASS);
    glBindTexture(GL_TEXTURE_2D, texture_grass_diffuse.id);
@@ -297,7 +367,14 @@ void draw_terrain(shader sh, matrix_stack stack) {
    glUniform1f(sh["uDiffuse"], 0.9f);
    glUniform1f(sh["uSpecular"], 0.1f);
    glUniformMatrix4fv(sh["uModel"], 1, GL_FALSE, &stack.m()[0][0]);
+#if TERRAIN_RENDERER == TERRAIN_CHUNKS
+   terrainLOD.draw(view_proj * stack.m(), resolution);
+#elif TERRAIN_RENDERER == TERRAIN_DISPLACED
+   terrainDisplaced.draw(sh);
+#else
+   r_terrain.bind();
    glDrawElements(r_terrain().mode, r_terrain().count, r_terrain().itype, 0);
+#endif
    glUseProgram(0);
 }
 
@@ -376,6 +453,15 @@ void draw_cameramen(shader sh, matrix_stack stack) {
 
 renderable r_sphere;
 std::vector<glm::mat4> lampT;
+
+// the lamps that cast light, the first MAX_LAMP_LIGHTS
+std::vector<glm::vec3> lampLights(const std::vector<glm::mat4>& transforms) {
+   std::vector<glm::vec3> positions = lampLightPositions(transforms);
+   if (positions.size() > MAX_LAMP_LIGHTS)
+      positions.resize(MAX_LAMP_LIGHTS);
+   return positions;
+}
+
 void draw_lamps(shader sh, matrix_stack stack) {
    glUseProgram(sh.program);
    glUniform1i(sh["uMode"], SHADING_TEXTURED_PHONG);
@@ -460,7 +546,21 @@ void draw_bbox(box3 bbox, glm::vec3 color) {
 }
 
 
-void draw_scene(matrix_stack stack, bool depthOnly) {
+// parts of the scene for draw_scene
+enum {
+   SCENE_TERRAIN   = 1 << 0,
+   SCENE_TRACK     = 1 << 1,
+   SCENE_CARS      = 1 << 2,
+   SCENE_CAMERAMEN = 1 << 3,
+   SCENE_TREES     = 1 << 4,
+   SCENE_LAMPS     = 1 << 5,
+   SCENE_ALL       = (1 << 6) - 1,
+   SCENE_DYNAMIC   = SCENE_CARS | SCENE_CAMERAMEN,   // the parts that move
+   SCENE_STATIC    = SCENE_ALL & ~SCENE_DYNAMIC
+};
+
+// view_proj and resolution are those of the pass, see draw_terrain. parts (SCENE_*) are the parts drawn
+void draw_scene(matrix_stack stack, bool depthOnly, const glm::mat4& view_proj, unsigned int resolution, unsigned int parts = SCENE_ALL) {
    shader sh;
    if (depthOnly) {
       sh = shader_depth;
@@ -479,14 +579,17 @@ void draw_scene(matrix_stack stack, bool depthOnly) {
    }
 
    glFrontFace(GL_CW);
-   draw_terrain(sh, stack);
+   if (parts & SCENE_TERRAIN)
+      draw_terrain(sh, stack, view_proj, resolution);
     check_gl_errors(__LINE__, __FILE__);
-   draw_track(sh, stack);
+   if (parts & SCENE_TRACK)
+      draw_track(sh, stack);
     check_gl_errors(__LINE__, __FILE__);
 
    // the following models have opposite polygon handedness
    glFrontFace(GL_CCW);
-   draw_cars(sh, stack);
+   if (parts & SCENE_CARS)
+      draw_cars(sh, stack);
 
    // in the depth pass, cull the front face from the following watertight models
    if (depthOnly) {
@@ -495,11 +598,14 @@ void draw_scene(matrix_stack stack, bool depthOnly) {
    }
 
     //check_gl_errors(__LINE__, __FILE__);
-   draw_cameramen(sh, stack);
+   if (parts & SCENE_CAMERAMEN)
+      draw_cameramen(sh, stack);
     //check_gl_errors(__LINE__, __FILE__);
-   draw_trees(sh, stack);
+   if (parts & SCENE_TREES)
+      draw_trees(sh, stack);
     //check_gl_errors(__LINE__, __FILE__);
-   draw_lamps(sh, stack);
+   if (parts & SCENE_LAMPS)
+      draw_lamps(sh, stack);
     check_gl_errors(__LINE__, __FILE__);
 }
 
@@ -529,12 +635,27 @@ int main(int argc, char** argv) {
    glewInit();
    printout_opengl_glsl_info();
 
-   carousel_loader::load((assets_path + "small_test.svg").c_str(), (assets_path + "terrain_256.png").c_str(), r);
-   for (int i = 0; i < CARS_NUM; ++i)
-      r.add_car();
+   // the carpaths are baked in background while models, track and terrain are prepared
+   // usage: main_game [--watch] [svg terrain [cars]], e.g. a scene written by main_generate.
+   // --watch reloads the scene when its files are edited
+   bool watchFiles = false;
+   std::vector<const char*> args;
+   for (int i = 1; i < argc; ++i)
+      if (std::string(argv[i]) == "--watch")
+         watchFiles = true;
+      else
+         args.push_back(argv[i]);
+   const std::string svg_file = (args.size() > 1) ? args[0] : assets_path + "small_test.svg";
+   const std::string terrain_file = (args.size() > 1) ? args[1] : assets_path + "terrain_256.png";
+   const int numCars = (args.size() > 2) ? std::max(1, atoi(args[2])) : CARS_NUM;
+   carousel_loader::loaded_shapes loaded;
+   carousel_loader::load(svg_file.c_str(), terrain_file.c_str(), r, true, watchFiles ? &loaded : 0);
    
    // load the 3D models
+   {
+      load_profile::phase loading("load_models");
       load_models();
+   }
 
 
    // begin creating the world
@@ -547,8 +668,32 @@ int main(int argc, char** argv) {
    s_cube.compute_edges();
    s_cube.to_renderable(r_cube);
 
-   prepareTrack(r, r_track);
-   prepareTerrain(r, r_terrain);
+   {
+      load_profile::phase preparing("prepareTrack");
+      prepareTrack(r, r_track);
+   }
+   // the terrain mesh for ray casts: camera collision and picking
+   height_pyramid ground;
+   {
+      load_profile::phase preparing("prepareTerrain");
+#if TERRAIN_RENDERER == TERRAIN_CHUNKS
+      terrainLOD.create(r.ter(), N_GROUND_TILES, TERRAIN_LOD_TOLERANCE);
+#elif TERRAIN_RENDERER == TERRAIN_DISPLACED
+      if (terrainDisplaced.create(r.ter(), N_GROUND_TILES, TEXTURE_HEIGHTFIELD))
+         std::cout << "terrain: " << terrainDisplaced.getBytes() / 1024 << " KB on the GPU" << std::endl;
+#else
+      prepareTerrain(r, r_terrain);
+#endif
+      ground.build(r.ter());
+#if TERRAIN_HORIZON
+      terrainHorizon = horizonMap.create(r.ter(), TEXTURE_HORIZON);
+#endif
+   }
+
+   for (int i = 0; i < numCars; ++i)
+      r.add_car();
+   r.set_lod(CARS_LOD_DISTANCE, CARS_LOD_PERIOD);
+   r.pin_car(0); // it carries the headlights
    
    draw_cameraman.resize(r.cameramen().size());
    for(unsigned int i=0; i<draw_cameraman.size(); i++)
@@ -558,8 +703,14 @@ int main(int argc, char** argv) {
    glViewport(0, 0, width, height);
    glm::mat4 proj = glm::perspective(glm::radians(45.f), (float)width/(float)height, 0.001f, 10.f);
    
-   load_textures();
-   load_shaders();
+   {
+      load_profile::phase loading("load_textures");
+      load_textures();
+   }
+   {
+      load_profile::phase loading("load_shaders");
+      load_shaders();
+   }
    glUseProgram(shader_world.program);
    glUniformMatrix4fv(shader_world["uProj"], 1, GL_FALSE, &proj[0][0]);
    glUniformMatrix4fv(shader_world["uView"], 1, GL_FALSE, &camera.matrix()[0][0]);
@@ -582,6 +733,14 @@ int main(int argc, char** argv) {
    // initialize scene
    r.start(11,0,0,600);
    r.update();
+
+   // the startup profile is complete once the carpaths are baked
+   race baked = r;
+   thread_pool::global().submit([baked]() {
+      baked.wait_paths();
+      if (load_profile::global().write("load_profile.json"))
+         std::cout << "startup profile written to load_profile.json" << std::endl;
+   });
    
    // transform the scene's bounding box in world coordinates to pass it to the Sun Projector
    box3 bbox_scene = r.bbox();
@@ -590,6 +749,12 @@ int main(int argc, char** argv) {
    bbox_scene.max.y = 0.1f;
    DirectionalProjector sunProjector(bbox_scene, SUN_SHADOWMAP_SIZE, r.sunlight_direction());
    bool daytime = isDaytime(r.sunlight_direction());
+#if SUN_SHADOW_CACHE
+   SunShadowCache sunCache(SUN_SHADOWMAP_SIZE, SUN_SHADOW_STEP, SUN_SHADOW_CACHE_ENTRIES,
+      terrainHorizon ? (SCENE_STATIC & ~SCENE_TERRAIN) : SCENE_STATIC);
+   int sunKey = 0;
+   std::cout << "sun shadow cache: " << sunCache.getBytes() / (1024 * 1024) << " MB on the GPU" << std::endl;
+#endif
    
    // initialize the sun's uniforms
    glUseProgram(shader_world.program);
@@ -597,16 +762,22 @@ int main(int argc, char** argv) {
    sunProjector.bindTexture(TEXTURE_SHADOWMAP_SUN);
    glUniform1i(shader_world["uSunShadowmap"], TEXTURE_SHADOWMAP_SUN);
    glUniform1i(shader_world["uSunShadowmapSize"], SUN_SHADOWMAP_SIZE);
+   glUniform1i(shader_world["uUseHorizon"], terrainHorizon ? 1 : 0);
+   if (terrainHorizon)
+      horizonMap.updateUniforms(shader_world, stack.m());
    glUseProgram(0);
    
 
    // initialize the lamps and their lights
    lampT = lampTransform(r.t(), r.lamps(), scale, center);
-   LampGroup lamps(lampLightPositions(lampT), LAMP_ANGLE_OUT, LAMP_SHADOWMAP_SIZE, TEXTURE_SHADOWMAP_LAMPS);
-   unsigned int numActiveLamps = 3;
-   lamps.toggle(10);
-   lamps.toggle(11);
-   lamps.toggle(14);
+   LampGroup lamps(lampLights(lampT), LAMP_ANGLE_OUT, LAMP_SHADOWMAP_SIZE, TEXTURE_SHADOWMAP_LAMPS);
+   unsigned int numActiveLamps = 0;
+   const unsigned int activeLamps[3] = { 10, 11, 14 };
+   for (unsigned int i = 0; i < 3; ++i)
+      if (activeLamps[i] < lamps.getSize()) {
+         lamps.toggle(activeLamps[i]);
+         ++numActiveLamps;
+      }
 
    glUseProgram(shader_world.program);
    glUniform1f(shader_world["uLampAngleIn"], glm::cos(LAMP_ANGLE_IN));
@@ -625,8 +796,8 @@ int main(int argc, char** argv) {
    Headlights headlights(HEADLIGHT_ANGLE, center, scale, HEADLIGHT_SHADOWMAP_SIZE);
 
    int texture_slots_cars[2] =
-   { TEXTURE_SHADOWMAP_CARS + r.lamps().size(),
-     TEXTURE_SHADOWMAP_CARS + r.lamps().size() + 1 };
+   { TEXTURE_SHADOWMAP_CARS + (int)lamps.getSize(),
+     TEXTURE_SHADOWMAP_CARS + (int)lamps.getSize() + 1 };
 
    glUseProgram(shader_world.program);
    glUniform1iv(shader_world["uHeadlightShadowmap"], 2, &texture_slots_cars[0]);
@@ -635,6 +806,18 @@ int main(int argc, char** argv) {
 
    glm::vec3 skyColor(SKY_COLOR_RGB);
 
+   // records the race while recordUserState is on
+   race_recorder recorder;
+
+   // with --watch the scene is reloaded when its files are edited, redoing and uploading only what the edit changed
+   scene_watch watcher;
+   if (watchFiles)
+      watchFiles = watcher.watch(svg_file.c_str(), terrain_file.c_str(), r, &loaded);
+   double last_poll = glfwGetTime();
+
+   // the view of the screen pass, set at the end of each frame for the next one
+   glm::mat4 viewMatrix = camera.matrix();
+
    /*   ------   main draw loop   ------   */
 
    glEnable(GL_DEPTH_TEST);
@@ -647,6 +830,64 @@ int main(int argc, char** argv) {
       glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
       check_gl_errors(__LINE__, __FILE__);
       
+      if (recordUserState != recorder.is_open()) {
+         if (recordUserState && !recorder.open("race.rec"))
+            recordUserState = false;
+         if (!recordUserState)
+            recorder.close();
+         r.set_observer(recordUserState ? &recorder : 0);
+      }
+
+      // the scene files are looked at once a second
+      if (watchFiles && glfwGetTime() - last_poll > 1.0) {
+         last_poll = glfwGetTime();
+         if (watcher.changed()) {
+            shared_array<stick_object> trees_before = r.trees(), lamps_before = r.lamps();
+            scene_watch::changes changes;
+            if (watcher.reload(r, changes)) {
+               if (changes.track())
+                  updateTrack(r, r_track, changes.curbs, changes.track_resized);
+               if (changes.terrain()) {
+#if TERRAIN_RENDERER == TERRAIN_CHUNKS
+                  terrainLOD.update(r.ter(), N_GROUND_TILES, changes);
+#elif TERRAIN_RENDERER == TERRAIN_DISPLACED
+                  terrainDisplaced.update(r.ter(), changes.texels);
+#else
+                  updateTerrain(r, r_terrain, changes);
+#endif
+                  ground.update(r.ter(), changes);
+                  if (terrainHorizon) {
+                     horizonMap.update(r.ter(), changes);
+                     glUseProgram(shader_world.program);
+                     horizonMap.updateUniforms(shader_world, stack.m());
+                     glUseProgram(0);
+                  }
+               }
+               if (changes.trees && !moveTransforms(treeT, trees_before, r.trees(), scale))
+                  treeT = treeTransform(r.trees(), scale, center);
+               if (changes.lamps) {
+                  if (!moveTransforms(lampT, lamps_before, r.lamps(), scale))
+                     lampT = lampTransform(r.t(), r.lamps(), scale, center);
+                  if (lamps.setPositions(lampLights(lampT))) {
+                     glUseProgram(shader_world.program);
+                     glUniform3fv(shader_world["uLamps"], lamps.getSize(), &lamps.getPositions()[0][0]);
+                     glUniformMatrix4fv(shader_world["uLampMatrix"], lamps.getSize(), GL_FALSE, &lamps.getLightMatrices()[0][0][0]);
+                     glUseProgram(0);
+                  }
+                  else
+                     std::cout << "lamps added or removed: their lights are updated at the next start" << std::endl;
+               }
+               if (changes.cameramen)
+                  draw_cameraman.assign(r.cameramen().size(), true);
+#if SUN_SHADOW_CACHE
+               if (changes.track() || changes.terrain() || changes.trees || changes.lamps)
+                  sunCache.clear();
+#endif
+               std::cout << "scene reloaded: " << changes.carpaths.size() << " carpaths baked again" << std::endl;
+            }
+         }
+      }
+
       if (timeStep) {
          r.update(pauseLength);
          pauseLength = 0;
@@ -665,15 +906,45 @@ int main(int argc, char** argv) {
 
       glUseProgram(shader_world.program);
       sunProjector.updateLightDirectionUniform(shader_world, "uSunDirection");
+#if SUN_SHADOW_CACHE
+      // the shading keeps the exact direction of the sun, the shadow map is drawn from the step of its angle
+      sunKey = sunCache.key(r.sunlight_direction());
+      sunProjector.setDirection(sunCache.direction(sunKey));
+#endif
       sunProjector.updateLightMatrixUniform(shader_world, "uSunMatrix");
       
       // draw the sun's shadowmap
       if (sunState && drawShadows && daytime) {
          glUseProgram(shader_depth.program);
          sunProjector.updateLightMatrixUniform(shader_depth, "uLightMatrix");
+#if SUN_SHADOW_CACHE
+         // the static casters from the cache, drawn first if missing, then the ones that move
+         unsigned int missing = sunCache.bind(sunKey);
+         if (missing) {
+            draw_scene(stack, true, sunProjector.lightMatrix(), SUN_SHADOWMAP_SIZE, missing);
+            sunCache.drawn(sunKey, missing);
+         }
+         sunCache.copy(sunKey, sunProjector.getFrameBufferID());
+         sunProjector.bindTexture(TEXTURE_SHADOWMAP_SUN);
+         draw_scene(stack, true, sunProjector.lightMatrix(), SUN_SHADOWMAP_SIZE, SCENE_DYNAMIC);
+
+         // one part of the next step, so that it is complete by the time the sun gets there
+         const int next = sunCache.next(sunKey);
+         missing = sunCache.bind(next);
+         if (missing) {
+            const unsigned int part = missing & (~missing + 1);
+            sunProjector.setDirection(sunCache.direction(next));
+            sunProjector.updateLightMatrixUniform(shader_depth, "uLightMatrix");
+            draw_scene(stack, true, sunProjector.lightMatrix(), SUN_SHADOWMAP_SIZE, part);
+            sunCache.drawn(next, part);
+            sunProjector.setDirection(sunCache.direction(sunKey));
+         }
+#else
          sunProjector.bindFramebuffer();
          sunProjector.bindTexture(TEXTURE_SHADOWMAP_SUN);
-         draw_scene(stack, true);
+         draw_scene(stack, true, sunProjector.lightMatrix(), SUN_SHADOWMAP_SIZE,
+            terrainHorizon ? (SCENE_ALL & ~SCENE_TERRAIN) : SCENE_ALL);
+#endif
       }
 
       // draw the lamps' shadowmaps
@@ -683,7 +954,7 @@ int main(int argc, char** argv) {
             lamps.updateLightMatrixUniform(i, shader_depth, "uLightMatrix");
             lamps.bindFramebuffer(i);
             lamps.bindTexture(i);
-            draw_scene(stack, true);
+            draw_scene(stack, true, lamps.getLightMatrix(i), LAMP_SHADOWMAP_SIZE);
          }
          glUseProgram(0);
       }
@@ -702,7 +973,7 @@ int main(int argc, char** argv) {
             headlights.updateLightMatrixUniform(i, shader_depth, "uLightMatrix");
             headlights.bindFramebuffer(i);
             headlights.bindTexture(i, texture_slots_cars[i]);
-            draw_scene(stack, true);
+            draw_scene(stack, true, headlights.getMatrix(i), HEADLIGHT_SHADOWMAP_SIZE);
             glUseProgram(0);
          }
       }
@@ -710,7 +981,7 @@ int main(int argc, char** argv) {
       // draw the screen buffer
       glBindFramebuffer(GL_FRAMEBUFFER, 0);
       glViewport(0, 0, width, height);
-      draw_scene(stack, false);
+      draw_scene(stack, false, proj * viewMatrix, height);
       
 
       if (debugView) {
@@ -740,9 +1011,8 @@ int main(int argc, char** argv) {
       
       // update camera view according to incoming input
       updateDelta();
-      processInput(window, r.ter());
+      processInput(window, ground, stack.m());
       
-      glm::mat4 viewMatrix;
       int currentPOV = POVselected % (1+r.cameramen().size()); 
       if (currentPOV == 0) {
          viewMatrix = camera.matrix();
@@ -767,6 +1037,9 @@ int main(int argc, char** argv) {
       glUniform1f(shader_world["uHeadlightState"], (headlightState) ? (1.0) : (0.0));
       glUseProgram(shader_basic.program);
       glUniformMatrix4fv(shader_basic["uView"], 1, GL_FALSE, &viewMatrix[0][0]);
+
+      // the next update measures the level of detail from this view
+      r.set_lod_view(viewMatrix * stack.m(), proj);
       
       glfwSwapBuffers(window);
       glfwPollEvents();
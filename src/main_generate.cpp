@@ -0,0 +1,114 @@
+#define STB_IMAGE_IMPLEMENTATION
+#include <tinygltf/stb_image.h>
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include <tinygltf/stb_image_write.h>
+
+#include <string>
+#include <iostream>
+#include <chrono>
+#include <cstdlib>
+
+#define GLM_ENABLE_EXPERIMENTAL
+#include <glm/glm.hpp>
+
+#include "common/carousel/carousel.h"
+#include "common/carousel/carousel_loader.h"
+#include "common/carousel/scene_generator.h"
+
+/*
+   Generator of synthetic scenes for scaling benchmarks (see scene_generator).
+   It writes <out>.svg and the terrain, <out>.png or, with tiles=1, <out>.tiles (see terrain_tiles).
+   Cars are not part of a scene: the cars count is passed on to the runners, whose command lines are printed at the end.
+
+   usage: main_generate [out] [scale] [key=value ...]
+      out      path and name of the files, without extension (default "generated")
+      scale    how many times the objects of assets/small_test.svg (default 10), see scene_generator::params::scaled
+      keys     override the scaled counts: lamps, trees, cameramen, carpaths, cars, size (svg units),
+               terrain (texels per side), seed, tiles (0/1),
+               cache (0/1: load the scene once, timing the loader, and write its scene cache next to the svg)
+*/
+
+int main(int argc, char** argv) {
+   const std::string out = (argc > 1) ? argv[1] : "generated";
+   const float scale = (argc > 2) ? (float)atof(argv[2]) : 10.f;
+
+   scene_generator::params p = scene_generator::params::scaled(scale);
+   int cars = std::max(1, int(scale));
+   bool tiles = false, cache = false;
+   for (int i = 3; i < argc; ++i) {
+      const std::string arg = argv[i];
+      const size_t eq = arg.find('=');
+      if (eq == std::string::npos) {
+         std::cout << "expected key=value, got " << arg << std::endl;
+         return 1;
+      }
+      const std::string key = arg.substr(0, eq);
+      const double value = atof(arg.c_str() + eq + 1);
+      if (key == "lamps")          p.lamps = (int)value;
+      else if (key == "trees")     p.trees = (int)value;
+      else if (key == "cameramen") p.cameramen = (int)value;
+      else if (key == "carpaths")  p.carpaths = std::max(1, (int)value);
+      else if (key == "cars")      cars = (int)value;
+      else if (key == "size")      p.size = (float)value;
+      else if (key == "terrain")   p.terrain = std::max(2, (int)value);
+      else if (key == "seed")      p.seed = (unsigned int)value;
+      else if (key == "tiles")     tiles = value != 0.0;
+      else if (key == "cache")     cache = value != 0.0;
+      else {
+         std::cout << "unknown key " << key << std::endl;
+         return 1;
+      }
+   }
+
+   const std::string svg_file = out + ".svg";
+   const std::string terrain_file = out + (tiles ? ".tiles" : ".png");
+   std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+   if (!scene_generator::write_svg(svg_file.c_str(), p)) {
+      std::cout << "cannot write " << svg_file << std::endl;
+      return 1;
+   }
+   bool written;
+   if (tiles)
+      written = scene_generator::write_tiles(terrain_file.c_str(), p);
+   else {
+      std::vector<unsigned char> data;
+      scene_generator::height_field(p, data);
+      written = stbi_write_png(terrain_file.c_str(), p.terrain, p.terrain, 1, &data[0], p.terrain) != 0;
+   }
+   if (!written) {
+      std::cout << "cannot write " << terrain_file << std::endl;
+      return 1;
+   }
+
+   double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+   printf("%s: %g x %g, %d lamps, %d trees, %d cameramen, %d carpaths\n", svg_file.c_str(), p.size, p.size, p.lamps, p.trees,
+      p.cameramen, p.carpaths);
+   printf("%s: %d x %d texels\n", terrain_file.c_str(), p.terrain, p.terrain);
+   printf("written in %.3f s\n", seconds);
+
+   if (cache) {
+      start = std::chrono::steady_clock::now();
+      race r;
+      carousel_loader::load(svg_file.c_str(), terrain_file.c_str(), r, false);
+      r.wait_paths();
+      seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+      printf("loaded in %.3f s: %zu curb points, %zu carpaths\n", seconds, r.t().curbs[0].size(), r.paths().size());
+
+      std::vector<std::string> inputs;
+      inputs.push_back(svg_file);
+      inputs.push_back(terrain_file);
+      const std::string cache_file = svg_file + ".cache";
+      if (!scene_cache::save(cache_file.c_str(), scene_cache::hash_files(inputs), r)) {
+         std::cout << "cannot write " << cache_file << std::endl;
+         return 1;
+      }
+      printf("%s written\n", cache_file.c_str());
+   }
+
+   printf("\nrun it with:\n");
+   printf("   main_game %s %s %d\n", svg_file.c_str(), terrain_file.c_str(), cars);
+   printf("   main_bench all %s %s\n", svg_file.c_str(), terrain_file.c_str());
+   printf("   main_batch 64 10000 33 %d 0 %s %s\n", cars, svg_file.c_str(), terrain_file.c_str());
+   return 0;
+}
@@ -153,4 +153,9 @@ class SpotlightProjector : public Projector {
          lightAngle_out = angle_out;
          update();
       }
+
+      void setPosition(glm::vec3 light_position) {
+         lightPosition = light_position;
+         update();
+      }
 };
\ No newline at end of file
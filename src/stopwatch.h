@@ -1,19 +1,19 @@
 #pragma once
+#include <chrono>
 
+// measures wall time in milliseconds, the same unit the race clock uses
 class Stopwatch {
    protected:
-      unsigned long startTime;
+      std::chrono::steady_clock::time_point startTime;
 
    public:
-      Stopwatch() : startTime(0) {}
+      Stopwatch() : startTime(std::chrono::steady_clock::now()) {}
 
       void start() {
-         startTime = clock();
+         startTime = std::chrono::steady_clock::now();
       }
 
       unsigned long end() {
-         unsigned long tmp = startTime;
-         startTime = 0;
-         return clock() - tmp;
+         return (unsigned long)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - startTime).count();
       }
-};
\ No newline at end of file
+};
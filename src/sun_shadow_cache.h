@@ -0,0 +1,152 @@
+#pragma once
+#include <GL/glew.h>
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include <glm/glm.hpp>
+#include <glm/ext.hpp>
+
+/*
+   Sun's shadow maps of the static casters (the parts of the scene that do not move: track, trees, lamps and, without
+   the horizon map, the terrain) cached for quantized angles of the sun. race::sun_at turns the sun around the X
+   axis, so its direction is the angle of that rotation and the angles are quantized to steps of step_degrees: the
+   sun's projector is set to the direction of the step (see direction), and every frame the static casters of that
+   step are copied into the shadow map, where only the casters that move are drawn on top of them.
+
+   An entry is drawn a part at a time (the parts are bits of a mask, see main_game.cpp), so that the one of the next
+   step can be completed over the frames before the sun gets there. Entries are reused least recently used first.
+   The maps are packed depths as the sun's shadow map (RGB32F color and a depth buffer), so that they are copied with
+   glBlitFramebuffer.
+*/
+
+class SunShadowCache {
+   protected:
+      struct entry {
+         GLuint fbo, color, depth;
+         int key;             // step of the angle, -1 if unused
+         unsigned int drawn;  // parts drawn so far
+         unsigned long used;  // frame of the last use
+      };
+      std::vector<entry> entries;
+      unsigned int shadowmapSize;
+      unsigned int staticParts;
+      float step;
+      int steps;
+      unsigned long frame;
+
+      entry* find(int key) {
+         for (unsigned int i = 0; i < entries.size(); ++i)
+            if (entries[i].key == key)
+               return &entries[i];
+         return 0;
+      }
+
+   public:
+      // static_parts is the mask of all the parts of the static casters
+      SunShadowCache(unsigned int shadowmap_size, float step_degrees, unsigned int n_entries, unsigned int static_parts) {
+         shadowmapSize = shadowmap_size;
+         staticParts = static_parts;
+         steps = std::max(1, (int)std::lround(360.0 / step_degrees));
+         step = glm::radians(360.f / steps);
+         frame = 0;
+         entries.resize(n_entries);
+         for (unsigned int i = 0; i < entries.size(); ++i) {
+            entry& e = entries[i];
+            e.key = -1;
+            e.drawn = 0;
+            e.used = 0;
+            glGenFramebuffers(1, &e.fbo);
+            glBindFramebuffer(GL_FRAMEBUFFER, e.fbo);
+            glGenTextures(1, &e.color);
+            glBindTexture(GL_TEXTURE_2D, e.color);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB32F, shadowmapSize, shadowmapSize, 0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, e.color, 0);
+            // the format of the depth of frame_buffer_object, which glBlitFramebuffer needs to match
+            glGenRenderbuffers(1, &e.depth);
+            glBindRenderbuffer(GL_RENDERBUFFER, e.depth);
+            glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT, shadowmapSize, shadowmapSize);
+            glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, e.depth);
+         }
+         glBindFramebuffer(GL_FRAMEBUFFER, 0);
+      }
+
+      void destroy() {
+         for (unsigned int i = 0; i < entries.size(); ++i) {
+            glDeleteFramebuffers(1, &entries[i].fbo);
+            glDeleteTextures(1, &entries[i].color);
+            glDeleteRenderbuffers(1, &entries[i].depth);
+         }
+         entries.clear();
+      }
+
+      // forget all the entries, after the static casters changed
+      void clear() {
+         for (unsigned int i = 0; i < entries.size(); ++i) {
+            entries[i].key = -1;
+            entries[i].drawn = 0;
+         }
+      }
+
+      // step nearest to the direction of the sun, see race::sun_at
+      int key(glm::vec3 sun_direction) {
+         float angle = std::atan2(-sun_direction.z, -sun_direction.y);
+         if (angle < 0.f)
+            angle += 2.f * glm::pi<float>();
+         return (int)std::lround(angle / step) % steps;
+      }
+
+      // direction of the sun at step key
+      glm::vec3 direction(int key) {
+         return glm::vec3(0.f, -std::cos(key * step), -std::sin(key * step));
+      }
+
+      // step the sun gets to after key
+      int next(int key) {
+         return (key + 1) % steps;
+      }
+
+      // bind the framebuffer of the entry of key and return the parts still to draw into it. The entry is made if
+      // missing, from the one used least recently
+      unsigned int bind(int key) {
+         entry* e = find(key);
+         if (!e) {
+            e = &entries[0];
+            for (unsigned int i = 1; i < entries.size(); ++i)
+               if (entries[i].used < e->used)
+                  e = &entries[i];
+            e->key = key;
+            e->drawn = 0;
+         }
+         e->used = ++frame;
+         glBindFramebuffer(GL_FRAMEBUFFER, e->fbo);
+         glViewport(0, 0, shadowmapSize, shadowmapSize);
+         if (e->drawn == 0)
+            glClear(GL_DEPTH_BUFFER_BIT | GL_COLOR_BUFFER_BIT);
+         return staticParts & ~e->drawn;
+      }
+
+      // the parts drawn into the entry of key after bind
+      void drawn(int key, unsigned int parts) {
+         entry* e = find(key);
+         if (e)
+            e->drawn |= parts;
+      }
+
+      // copy the static casters of key, all drawn, into the framebuffer fbo, which is left bound for the others
+      void copy(int key, GLuint fbo) {
+         entry* e = find(key);
+         glBindFramebuffer(GL_READ_FRAMEBUFFER, e->fbo);
+         glBindFramebuffer(GL_DRAW_FRAMEBUFFER, fbo);
+         glBlitFramebuffer(0, 0, shadowmapSize, shadowmapSize, 0, 0, shadowmapSize, shadowmapSize,
+            GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+         glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+         glViewport(0, 0, shadowmapSize, shadowmapSize);
+      }
+
+      // bytes taken on the GPU, with 4 bytes of depth per texel
+      size_t getBytes() {
+         return entries.size() * size_t(shadowmapSize) * shadowmapSize * (3 * sizeof(float) + 4);
+      }
+};
@@ -0,0 +1,146 @@
+#pragma once
+#include <GL/glew.h>
+#include <vector>
+#include <iostream>
+#define GLM_ENABLE_EXPERIMENTAL
+#include <glm/glm.hpp>
+
+#include "common/renderable.h"
+#include "common/shaders.h"
+#include "common/carousel/carousel.h"
+
+/*
+   Draws the terrain by displacing a grid on the GPU. The height field is uploaded once, as is, to an R8 texture, and a
+   single patch of PATCH_CELLS x PATCH_CELLS cells is drawn instanced to cover the terrain. The vertex shaders (world.vert
+   and depth.vert, with uDisplacement set) read the height of each vertex and of its neighbours from the texture and
+   compute position, normal and texture coordinates the same way as the full resolution mesh (terrain_mesh), so the
+   terrain takes one byte per texel instead of the 32 of its vertex buffers.
+*/
+
+class TerrainDisplaced {
+   protected:
+      renderable patch;
+      GLuint heightField;
+      int textureSlot;
+      glm::ivec2 size;
+      glm::vec4 rect;
+      float tiles;
+      int patches;
+
+      // copy rows [row0, row1] and columns [col0, col1] of the height field into the texture
+      void uploadTexels(const terrain& ter, int row0, int col0, int row1, int col1) {
+         const int w = col1 - col0 + 1;
+         std::vector<unsigned char> rows;
+         glBindTexture(GL_TEXTURE_2D, heightField);
+         glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+         // a band of rows at a time, so that a tiled height field is never read whole
+         const int band = std::max(1, (1 << 20) / w);
+         for (int r = row0; r <= row1; r += band) {
+            const int h = std::min(band, row1 - r + 1);
+            rows.resize(size_t(w) * h);
+            for (int i = 0; i < h; ++i)
+               for (int c = 0; c < w; ++c)
+                  rows[size_t(i) * w + c] = ter.texel(r + i, col0 + c);
+            glTexSubImage2D(GL_TEXTURE_2D, 0, col0, r, w, h, GL_RED, GL_UNSIGNED_BYTE, &rows[0]);
+         }
+         glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+      }
+
+   public:
+      enum { PATCH_CELLS = 64 };
+
+      TerrainDisplaced() : heightField(0), textureSlot(0), size(0), tiles(1.f), patches(0) {}
+
+      // upload the height field to texture_slot. Returns false if it is larger than the textures the GL allows
+      bool create(const terrain& ter, float texture_tiles, int texture_slot) {
+         GLint maxSize = 0;
+         glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxSize);
+         if (ter.size_pix[0] > maxSize || ter.size_pix[1] > maxSize) {
+            std::cout << "the height field is larger than the largest texture (" << maxSize << ")" << std::endl;
+            return false;
+         }
+         size = ter.size_pix;
+         rect = ter.rect_xz;
+         tiles = texture_tiles;
+         textureSlot = texture_slot;
+
+         glActiveTexture(GL_TEXTURE0 + textureSlot);
+         glGenTextures(1, &heightField);
+         glBindTexture(GL_TEXTURE_2D, heightField);
+         glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, size[0], size[1], 0, GL_RED, GL_UNSIGNED_BYTE, NULL);
+         // read with texelFetch: no filtering, and no mipmaps for the texture to be complete
+         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+         uploadTexels(ter, 0, 0, size[1] - 1, size[0] - 1);
+
+         // the patch: vertex (a, b) at (a, 0, b), triangulated like terrain_mesh
+         const int side = PATCH_CELLS + 1;
+         std::vector<float> positions;
+         for (int b = 0; b < side; ++b)
+            for (int a = 0; a < side; ++a) {
+               positions.push_back((float)a);
+               positions.push_back(0.f);
+               positions.push_back((float)b);
+            }
+         std::vector<unsigned short> indices;
+         for (int b = 0; b < PATCH_CELLS; ++b)
+            for (int a = 0; a < PATCH_CELLS; ++a) {
+               const unsigned short v00 = b * side + a, v10 = v00 + 1, v01 = v00 + side, v11 = v01 + 1;
+               const unsigned short quad[6] = { v00, v10, v11, v00, v11, v01 };
+               indices.insert(indices.end(), quad, quad + 6);
+            }
+         patch.create();
+         patch.add_vertex_attribute<float>(&positions[0], (unsigned int)positions.size(), 0, 3);
+         patch.add_indices<unsigned short>(&indices[0], (unsigned int)indices.size(), GL_TRIANGLES);
+
+         // the mesh has size - 1 cells per side
+         patches = std::max((size[0] - 2) / PATCH_CELLS + 1, (size[1] - 2) / PATCH_CELLS + 1);
+         return true;
+      }
+
+      void destroy() {
+         glDeleteTextures(1, &heightField);
+         heightField = 0;
+         patch.destroy();
+      }
+
+      // upload again the given texels (see scene_watch::changes). If the size of the height field changed the
+      // texture is made again
+      void update(const terrain& ter, glm::ivec4 texels) {
+         if (ter.size_pix != size || ter.rect_xz != rect) {
+            destroy();
+            create(ter, tiles, textureSlot);
+            return;
+         }
+         if (texels[0] <= texels[2] && texels[1] <= texels[3]) {
+            glActiveTexture(GL_TEXTURE0 + textureSlot);
+            uploadTexels(ter, texels[0], texels[1], texels[2], texels[3]);
+         }
+      }
+
+      // draw all the patches. The program of sh and its other uniforms must be set; uDisplacement is left at 0
+      void draw(shader sh) {
+         glActiveTexture(GL_TEXTURE0 + textureSlot);
+         glBindTexture(GL_TEXTURE_2D, heightField);
+         glUniform1i(sh["uHeightField"], textureSlot);
+         glUniform4f(sh["uTerrainRect"], rect[0], rect[1], rect[2], rect[3]);
+         glUniform2i(sh["uTerrainSize"], size[0], size[1]);
+         glUniform1i(sh["uTerrainPatches"], patches);
+         glUniform1i(sh["uTerrainPatchCells"], PATCH_CELLS);
+         glUniform1f(sh["uTerrainTiles"], tiles);
+         glUniform1i(sh["uDisplacement"], 1);
+
+         patch.bind();
+         glDrawElementsInstanced(patch().mode, patch().count, patch().itype, 0, patches * patches);
+         glBindVertexArray(0);
+         glUniform1i(sh["uDisplacement"], 0);
+      }
+
+      // bytes taken on the GPU: the height field and the patch
+      size_t getBytes() {
+         const size_t side = PATCH_CELLS + 1;
+         return size_t(size[0]) * size[1] + side * side * 3 * sizeof(float) + size_t(PATCH_CELLS) * PATCH_CELLS * 6 * sizeof(unsigned short);
+      }
+};
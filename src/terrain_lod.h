@@ -0,0 +1,94 @@
+#pragma once
+#include <GL/glew.h>
+#include <vector>
+#define GLM_ENABLE_EXPERIMENTAL
+#include <glm/glm.hpp>
+
+#include "common/renderable.h"
+#include "common/carousel/carousel.h"
+#include "common/carousel/terrain_chunks.h"
+#include "common/carousel/scene_watch.h"
+
+/*
+   Draws the terrain with the chunked level of detail of terrain_chunks. The vertices of all the chunks are uploaded
+   once, interleaved in a single buffer, with the attribute locations of the full resolution mesh (position 0, normal 2,
+   texture coordinates 4), and the chunks share one index buffer.
+
+   Every pass selects its own chunks: call draw() with the matrix that takes the terrain to clip space in that pass
+   and the resolution of its target, so that shadow maps and the screen each get the detail they need.
+*/
+
+class TerrainLOD {
+   protected:
+      terrain_chunks chunks;
+      renderable r;
+      GLuint vbo;
+      float tolerance;
+      std::vector<int> selection;
+      size_t lastTriangles;
+      glm::ivec2 size;
+
+   public:
+      TerrainLOD() : vbo(0), tolerance(1.f), lastTriangles(0), size(0) {}
+
+      // tolerance_pixels is the largest geometric error allowed on screen
+      void create(const terrain& ter, float tiles, float tolerance_pixels) {
+         tolerance = tolerance_pixels;
+         size = ter.size_pix;
+         chunks.build(ter, tiles);
+
+         r.create();
+         r.bind();
+         glGenBuffers(1, &vbo);
+         glBindBuffer(GL_ARRAY_BUFFER, vbo);
+         glBufferData(GL_ARRAY_BUFFER, sizeof(float) * chunks.vertices.size(), &chunks.vertices[0], GL_STATIC_DRAW);
+         const unsigned int stride = sizeof(float) * terrain_chunks::FLOATS;
+         const unsigned int n = (unsigned int)(chunks.vertices.size() / terrain_chunks::FLOATS);
+         r.assign_vertex_attribute(vbo, n, 0, 3, GL_FLOAT, stride, 0);
+         r.assign_vertex_attribute(vbo, n, 2, 3, GL_FLOAT, stride, sizeof(float) * 3);
+         r.assign_vertex_attribute(vbo, n, 4, 2, GL_FLOAT, stride, sizeof(float) * 6);
+         r.add_indices<unsigned short>(&chunks.indices[0], (unsigned int)chunks.indices.size(), GL_TRIANGLES);
+      }
+
+      void destroy() {
+         r.destroy();
+         vbo = 0;
+      }
+
+      // upload again the chunks that depend on the texels a reload changed.
+      // If the size of the height field changed the chunks are built again
+      void update(const terrain& ter, float tiles, const scene_watch::changes& changes) {
+         if (ter.size_pix != size) {
+            destroy();
+            create(ter, tiles, tolerance);
+            return;
+         }
+         // the normals of the neighbours of a vertex read it
+         std::vector<int> changed = chunks.rebuild(ter, changes.vertices(size[0], size[1], 1));
+         const size_t floats = terrain_chunks::VERTICES * terrain_chunks::FLOATS;
+         for (unsigned int i = 0; i < changed.size(); ++i)
+            r.update_vertex_attribute<float>(0, &chunks.vertices[changed[i] * floats], (unsigned int)(changed[i] * floats),
+               (unsigned int)floats);
+      }
+
+      // draw the chunks needed by the view view_proj (projection * view * model) rendered at resolution pixels.
+      // The program and its uniforms must be set
+      void draw(const glm::mat4& view_proj, unsigned int resolution) {
+         chunks.select(view_proj, (float)resolution, tolerance, selection);
+         r.bind();
+         const GLsizei count = (GLsizei)chunks.indices.size();
+         for (unsigned int i = 0; i < selection.size(); ++i)
+            glDrawElementsBaseVertex(GL_TRIANGLES, count, GL_UNSIGNED_SHORT, 0, selection[i] * terrain_chunks::VERTICES);
+         glBindVertexArray(0);
+         lastTriangles = chunks.triangles(selection);
+      }
+
+      // triangles drawn by the last draw()
+      size_t getLastTriangles() {
+         return lastTriangles;
+      }
+
+      const terrain_chunks& getChunks() {
+         return chunks;
+      }
+};
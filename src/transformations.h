@@ -35,8 +35,8 @@ inline box3 transformBoundingBox(box3 box, glm::mat4 T) {
 }
 
 // returns the vector pointing from the given point to the curb vertex closest to it
-inline glm::vec3 findClosestCurbVertex(track t, glm::vec3 lamp_position) {
-    std::vector<glm::vec3> curbs = t.curbs[0];
+inline glm::vec3 findClosestCurbVertex(const track& t, glm::vec3 lamp_position) {
+    const shared_array<glm::vec3>& curbs = t.curbs[0];
     float min_dist = 9e99;
     glm::vec3 closest = glm::vec3(0.f);
     for (unsigned int i = 0; i < curbs.size(); i++) {
@@ -60,7 +60,7 @@ inline glm::mat4 alignVector(glm::vec3 a, glm::vec3 b) {
 }
 
 // returns a vector containing the direction each lamp should face as a rotation matrix
-inline std::vector<glm::mat4> computeLampOrientation(track t, std::vector<stick_object> lamps) {
+inline std::vector<glm::mat4> computeLampOrientation(const track& t, const shared_array<stick_object>& lamps) {
     std::vector<glm::mat4> result(lamps.size());
     for (unsigned int i = 0; i < result.size(); i++) {
         glm::vec3 closest = findClosestCurbVertex(t, lamps[i].pos);
@@ -71,7 +71,7 @@ inline std::vector<glm::mat4> computeLampOrientation(track t, std::vector<stick_
 }
 
 // returns a vector containing the transformation to be applied to each lamp
-inline std::vector<glm::mat4> lampTransform(track t, std::vector<stick_object> lamps, float scale, glm::vec3 center) {
+inline std::vector<glm::mat4> lampTransform(const track& t, const shared_array<stick_object>& lamps, float scale, glm::vec3 center) {
     std::vector<glm::mat4> result(lamps.size());
     std::vector<glm::mat4> rotations = computeLampOrientation(t, lamps);
 
@@ -104,7 +104,7 @@ inline glm::mat4 randomRotation() {
     return glm::rotate(glm::mat4(1.f), angle, glm::vec3(0.f, 1.f, 0.f));
 }
 
-inline std::vector<glm::mat4> treeTransform(std::vector<stick_object> trees, float scale, glm::vec3 center) {
+inline std::vector<glm::mat4> treeTransform(const shared_array<stick_object>& trees, float scale, glm::vec3 center) {
     std::vector<glm::mat4> result(trees.size());
 
     glm::mat4 T = glm::translate(glm::mat4(1.f), glm::vec3(0.f, 0.43f, 0.f));
@@ -116,4 +116,16 @@ inline std::vector<glm::mat4> treeTransform(std::vector<stick_object> trees, flo
     }
 
     return result;
-}
\ No newline at end of file
+}
+
+// moves the transformations of the objects that moved from before to after, keeping their rotation and size.
+// Returns false if objects were added or removed: the transformations must be computed again
+inline bool moveTransforms(std::vector<glm::mat4>& transforms, const shared_array<stick_object>& before, const shared_array<stick_object>& after, float scale) {
+    if (before.size() != after.size() || transforms.size() != after.size())
+        return false;
+    for (unsigned int i = 0; i < after.size(); i++)
+        if (after[i].pos != before[i].pos)
+            transforms[i] = glm::translate(glm::mat4(1.f), scale * (after[i].pos - before[i].pos)) * transforms[i];
+
+    return true;
+}